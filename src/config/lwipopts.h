@@ -21,7 +21,8 @@
 // This example uses a common include to avoid repetition
 #include "lwipopts_examples_common.h"
 
-#define MEMP_NUM_SYS_TIMEOUT (LWIP_NUM_SYS_TIMEOUT_INTERNAL + 1)
+// One more timeout for the SNTP client
+#define MEMP_NUM_SYS_TIMEOUT (LWIP_NUM_SYS_TIMEOUT_INTERNAL + 2)
 
 #ifdef MQTT_CERT_INC
 #define LWIP_ALTCP 1
@@ -55,4 +56,15 @@
 #undef PBUF_POOL_SIZE
 #define PBUF_POOL_SIZE 32
 
+// SNTP client (pico_w_sensor): the server is looked up by name, and each reply
+// is handed to the sensor's wall clock, which keeps its own drift estimate
+#include <stdint.h>
+void sensor_set_system_time_us(uint32_t sec, uint32_t us);
+#define SNTP_SERVER_DNS 1
+#define SNTP_SET_SYSTEM_TIME_US(sec, us) sensor_set_system_time_us(sec, us)
+#ifndef SNTP_SYNC_INTERVAL_S
+#define SNTP_SYNC_INTERVAL_S 3600
+#endif
+#define SNTP_UPDATE_DELAY (SNTP_SYNC_INTERVAL_S * 1000)
+
 #endif
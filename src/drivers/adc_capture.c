@@ -0,0 +1,106 @@
+/**
+ * Oversampled ADC capture for Raspberry Pi Pico
+ *
+ * Two chained DMA channels keep the capture running forever: the data channel
+ * moves ADC_CAPTURE_SAMPLES samples from the ADC FIFO into the ring, then
+ * triggers the control channel, which writes the ring address back into the
+ * data channel's write-address trigger register to start the next pass.
+ *
+ * Copyright (c) 2024 Peter Westlund
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "adc_capture.h"
+#include "pico/stdlib.h"
+#include "hardware/adc.h"
+#include "hardware/clocks.h"
+#include "hardware/dma.h"
+
+#if (ADC_CAPTURE_SAMPLES & (ADC_CAPTURE_SAMPLES - 1)) != 0 || ADC_CAPTURE_SAMPLES > 4096
+#error "ADC_CAPTURE_SAMPLES must be a power of two no larger than 4096"
+#endif
+
+// Onboard sensor: 3.3 V reference, 0.706 V at 27°C, -1.721 mV/°C
+#define ADC_CAPTURE_VREF_UV 3300000
+#define ADC_CAPTURE_TEMP_V27_UV 706000
+#define ADC_CAPTURE_TEMP_SLOPE_UV 1721
+
+static uint16_t adc_capture_ring[ADC_CAPTURE_SAMPLES];
+static uint16_t *adc_capture_ring_addr = adc_capture_ring; // Source for the control channel
+
+/**
+ * Start free-running capture of the currently selected ADC input
+ */
+bool adc_capture_start(void) {
+    int data_chan = dma_claim_unused_channel(false);
+    int ctrl_chan = dma_claim_unused_channel(false);
+    if (data_chan < 0 || ctrl_chan < 0) {
+        if (data_chan >= 0) {
+            dma_channel_unclaim(data_chan);
+        }
+        return false;
+    }
+
+    // Seed the ring so the first readings are not averaged with zeros
+    uint16_t first = adc_read();
+    for (int i = 0; i < ADC_CAPTURE_SAMPLES; i++) {
+        adc_capture_ring[i] = first;
+    }
+
+    // 12-bit samples, DREQ on every sample, no error flag
+    adc_fifo_setup(true, true, 1, false, false);
+    adc_set_clkdiv((float) clock_get_hz(clk_adc) / ADC_CAPTURE_RATE_HZ - 1.0f);
+
+    dma_channel_config data = dma_channel_get_default_config(data_chan);
+    channel_config_set_transfer_data_size(&data, DMA_SIZE_16);
+    channel_config_set_read_increment(&data, false);
+    channel_config_set_write_increment(&data, true);
+    channel_config_set_dreq(&data, DREQ_ADC);
+    channel_config_set_chain_to(&data, ctrl_chan);
+
+    dma_channel_config ctrl = dma_channel_get_default_config(ctrl_chan);
+    channel_config_set_transfer_data_size(&ctrl, DMA_SIZE_32);
+    channel_config_set_read_increment(&ctrl, false);
+    channel_config_set_write_increment(&ctrl, false);
+
+    dma_channel_configure(ctrl_chan, &ctrl, &dma_hw->ch[data_chan].al2_write_addr_trig,
+                          &adc_capture_ring_addr, 1, false);
+    dma_channel_configure(data_chan, &data, adc_capture_ring, &adc_hw->fifo, ADC_CAPTURE_SAMPLES,
+                          true);
+
+    adc_run(true);
+    return true;
+}
+
+/**
+ * Get the average of the last ADC_CAPTURE_SAMPLES samples
+ * Each slot is a single 16-bit DMA write, so a slot is never torn; the sum
+ * mixes samples from two passes at most, all within one ring period.
+ */
+uint32_t adc_capture_average(void) {
+    uint32_t sum = 0;
+    for (int i = 0; i < ADC_CAPTURE_SAMPLES; i++) {
+        sum += adc_capture_ring[i];
+    }
+
+    // Scale to 1/16 LSB, rounding to nearest
+    if (ADC_CAPTURE_SAMPLES >= 16) {
+        const uint32_t div = ADC_CAPTURE_SAMPLES / 16;
+        return (sum + div / 2) / div;
+    }
+    return sum * (16 / ADC_CAPTURE_SAMPLES);
+}
+
+/**
+ * Get the onboard temperature sensor reading from the averaged samples
+ */
+int32_t adc_capture_temperature_centi_c(void) {
+    // Average is 16 x 12 bits = 16 bits full scale
+    int32_t uv = (int32_t) (((uint64_t) adc_capture_average() * ADC_CAPTURE_VREF_UV) >> 16);
+
+    // 2700 - (uv - 0.706 V) * 100 / 1721, rounded to nearest
+    int32_t delta = (uv - ADC_CAPTURE_TEMP_V27_UV) * 100;
+    int32_t half = ADC_CAPTURE_TEMP_SLOPE_UV / 2;
+    int32_t centi = (delta >= 0 ? delta + half : delta - half) / ADC_CAPTURE_TEMP_SLOPE_UV;
+    return 2700 - centi;
+}
@@ -0,0 +1,59 @@
+/**
+ * Oversampled ADC capture for Raspberry Pi Pico
+ * The ADC free-runs into its FIFO and DMA copies every sample into a ring, so
+ * an averaged reading is available at any time without CPU involvement in
+ * the sampling itself.
+ *
+ * Copyright (c) 2024 Peter Westlund
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef ADC_CAPTURE_H
+#define ADC_CAPTURE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Samples averaged per reading (power of two, at most 4096)
+#ifndef ADC_CAPTURE_SAMPLES
+#define ADC_CAPTURE_SAMPLES 256
+#endif
+
+// ADC sample rate in Hz; the ring spans ADC_CAPTURE_SAMPLES / rate seconds
+#ifndef ADC_CAPTURE_RATE_HZ
+#define ADC_CAPTURE_RATE_HZ 1000
+#endif
+
+/**
+ * Start free-running capture of the currently selected ADC input
+ * Call after adc_init() and adc_select_input(); adc_read() must not be used
+ * while capture is running.
+ *
+ * @return true if the DMA channels could be claimed
+ */
+bool adc_capture_start(void);
+
+/**
+ * Get the average of the last ADC_CAPTURE_SAMPLES samples
+ *
+ * @return Average in 1/16 LSB of the 12-bit ADC (0 to 65520)
+ */
+uint32_t adc_capture_average(void);
+
+/**
+ * Get the onboard temperature sensor reading from the averaged samples
+ * Fixed-point form of T = 27 - (V - 0.706) / 0.001721 with a 3.3 V reference.
+ *
+ * @return Temperature in hundredths of a degree Celsius
+ */
+int32_t adc_capture_temperature_centi_c(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // ADC_CAPTURE_H
@@ -7,228 +7,485 @@
  */
 
 #include "ds18b20.h"
-#include "pico/stdlib.h"
-#include "hardware/gpio.h"
-#include "hardware/sync.h"
-#include "pico/time.h"
-
-static unsigned int ds18b20_gpio = 2;
+#include "onewire.h"
+#include "onewire_hal.h"
+#include <stdio.h>
+#include <string.h>
 
 // DS18B20 Commands
+#define DS18B20_SEARCH_ROM 0xF0
+#define DS18B20_MATCH_ROM 0x55
 #define DS18B20_SKIP_ROM 0xCC
 #define DS18B20_CONVERT_T 0x44
 #define DS18B20_READ_SCRATCHPAD 0xBE
+#define DS18B20_WRITE_SCRATCHPAD 0x4E
+#define DS18B20_COPY_SCRATCHPAD 0x48
+
+// Family code of DS18B20 ROM codes
+#define DS18B20_FAMILY_CODE 0x28
+
+// Scratchpad layout
+#define DS18B20_SCRATCHPAD_CONFIG 4
+#define DS18B20_SCRATCHPAD_CRC 8
+
+// Fast reads stop after the configuration register, whose fixed bits stand in for the CRC
+#define DS18B20_FAST_READ_LEN (DS18B20_SCRATCHPAD_CONFIG + 1)
+
+// Configuration register: bits 0-4 always read as 1, bit 7 as 0
+#define DS18B20_CONFIG_FIXED_MASK 0x9F
+#define DS18B20_CONFIG_FIXED_BITS 0x1F
 
-// Timing constants (microseconds) - conservative values for reliability
-#define DS18B20_RESET_PULSE 500   // Reset pulse duration
-#define DS18B20_PRESENCE_WAIT 70  // Wait for presence pulse
-#define DS18B20_PRESENCE_READ 240 // Presence detection window
-#define DS18B20_WRITE_1_LOW 6     // Write 1: low time
-#define DS18B20_WRITE_1_HIGH 64   // Write 1: high time
-#define DS18B20_WRITE_0_LOW 60    // Write 0: low time
-#define DS18B20_WRITE_0_HIGH 10   // Write 0: high time
-#define DS18B20_READ_LOW 6        // Read: initial low time
-#define DS18B20_READ_SAMPLE 9     // Read: sample timing
-#define DS18B20_READ_HIGH 55      // Read: remaining high time
+// Power-on reset value of the temperature register (85°C)
+#define DS18B20_POWER_ON_RAW 0x0550
+
+// Conversion time (milliseconds) for 12-bit resolution
+#define DS18B20_CONVERSION_TIME_MS 750
+
+// EEPROM write time (milliseconds) after COPY SCRATCHPAD
+#define DS18B20_COPY_TIME_MS 10
 
 /**
- * Initialize DS18B20 sensor
+ * Find the next device with the SEARCH ROM algorithm (Maxim AN187)
+ *
+ * @param rom ROM code of the previous device in, next device out
+ * @param last_discrepancy Bit position of the last unexplored branch, -1 to start
+ * @param last_device Set once the final device has been returned
+ * @return true if a device was found
  */
-ds18b20_result_t ds18b20_init(unsigned int gpio_pin) {
-    ds18b20_gpio = gpio_pin;
+static bool ds18b20_search_next(ds18b20_bus_t *bus, uint8_t *rom, int *last_discrepancy,
+                                bool *last_device) {
+    if (*last_device || !onewire_reset(&bus->onewire)) {
+        return false;
+    }
 
-    // Initialize GPIO with pull-up
-    gpio_init(ds18b20_gpio);
-    gpio_set_dir(ds18b20_gpio, GPIO_IN);
-    gpio_pull_up(ds18b20_gpio);
+    onewire_write_byte(&bus->onewire, DS18B20_SEARCH_ROM);
 
-    // Small delay for GPIO to settle
-    busy_wait_us(10000); // 10ms in microseconds
+    int last_zero = -1;
+    for (int bit = 0; bit < DS18B20_ROM_SIZE * 8; bit++) {
+        bool id_bit = onewire_read_bit(&bus->onewire);
+        bool cmp_bit = onewire_read_bit(&bus->onewire);
 
-    // Test if sensor responds
-    uint32_t ints = save_and_disable_interrupts();
+        if (id_bit && cmp_bit) {
+            // No device took part in this search
+            return false;
+        }
 
-    // Reset pulse
-    gpio_set_dir(ds18b20_gpio, GPIO_OUT);
-    gpio_put(ds18b20_gpio, 0);
-    busy_wait_us(DS18B20_RESET_PULSE);
+        bool direction;
+        if (id_bit != cmp_bit) {
+            // All remaining devices agree on this bit
+            direction = id_bit;
+        } else {
+            // Discrepancy: retrace the previous path, then branch
+            if (bit < *last_discrepancy) {
+                direction = (rom[bit / 8] >> (bit % 8)) & 1;
+            } else {
+                direction = (bit == *last_discrepancy);
+            }
+            if (!direction) {
+                last_zero = bit;
+            }
+        }
 
-    // Release and wait for presence
-    gpio_set_dir(ds18b20_gpio, GPIO_IN);
-    busy_wait_us(DS18B20_PRESENCE_WAIT);
+        if (direction) {
+            rom[bit / 8] |= 1 << (bit % 8);
+        } else {
+            rom[bit / 8] &= ~(1 << (bit % 8));
+        }
+        onewire_write_bit(&bus->onewire, direction);
+    }
 
-    // Check for presence pulse
-    bool presence = !gpio_get(ds18b20_gpio);
+    *last_discrepancy = last_zero;
+    if (last_zero < 0) {
+        *last_device = true;
+    }
 
-    // Wait for presence to end
-    busy_wait_us(DS18B20_PRESENCE_READ);
+    return true;
+}
 
-    restore_interrupts(ints);
+/**
+ * Address a single device with MATCH ROM
+ */
+static bool ds18b20_select(ds18b20_bus_t *bus, int index) {
+    if (!onewire_reset(&bus->onewire)) {
+        return false;
+    }
 
-    return presence ? DS18B20_OK : DS18B20_ERROR_NO_DEVICE;
+    uint8_t command[1 + DS18B20_ROM_SIZE];
+    command[0] = DS18B20_MATCH_ROM;
+    memcpy(&command[1], bus->roms[index], DS18B20_ROM_SIZE);
+    onewire_write_bytes(&bus->onewire, command, sizeof(command));
+
+    return true;
 }
 
 /**
- * Send reset pulse and check for presence
+ * Check the bits of the configuration register that never change
+ * A bus held low reads as all zeros and an open bus as all ones, both of which fail.
  */
-static bool ds18b20_reset(void) {
-    uint32_t ints = save_and_disable_interrupts();
+static bool ds18b20_config_valid(const uint8_t *scratchpad) {
+    return (scratchpad[DS18B20_SCRATCHPAD_CONFIG] & DS18B20_CONFIG_FIXED_MASK) ==
+           DS18B20_CONFIG_FIXED_BITS;
+}
 
-    // Reset pulse
-    gpio_set_dir(ds18b20_gpio, GPIO_OUT);
-    gpio_put(ds18b20_gpio, 0);
-    busy_wait_us(DS18B20_RESET_PULSE);
+/**
+ * Check a full scratchpad read
+ */
+static ds18b20_result_t ds18b20_check_scratchpad(const uint8_t *scratchpad) {
+    if (onewire_crc8(scratchpad, DS18B20_SCRATCHPAD_CRC) != scratchpad[DS18B20_SCRATCHPAD_CRC]) {
+        return DS18B20_ERROR_CRC;
+    }
 
-    // Release and wait for presence
-    gpio_set_dir(ds18b20_gpio, GPIO_IN);
-    busy_wait_us(DS18B20_PRESENCE_WAIT);
+    // An all-zero scratchpad (bus held low) has a valid CRC, so check the fixed bits too
+    if (!ds18b20_config_valid(scratchpad)) {
+        return DS18B20_ERROR_CRC;
+    }
 
-    // Check for presence pulse
-    bool presence = !gpio_get(ds18b20_gpio);
+    return DS18B20_OK;
+}
 
-    // Wait for presence to end
-    busy_wait_us(DS18B20_PRESENCE_READ);
+/**
+ * Convert the temperature bytes of a scratchpad to hundredths of a degree
+ */
+static ds18b20_result_t ds18b20_decode_temperature(const ds18b20_bus_t *bus, int index,
+                                                   const uint8_t *scratchpad, bool fast,
+                                                   int32_t *centi_c) {
+    // Combine temperature bytes
+    uint16_t raw = (scratchpad[1] << 8) | scratchpad[0];
 
-    restore_interrupts(ints);
+    // Power-on value means no conversion took place; all ones means a bus fault. A fast read
+    // has no CRC, so its fixed configuration bits tell a bus held low from a real 0.00°C
+    if (raw == DS18B20_POWER_ON_RAW || raw == 0xFFFF ||
+        (fast && !ds18b20_config_valid(scratchpad))) {
+        return DS18B20_ERROR_CRC;
+    }
+
+    // LSB is always 0.0625°C; below 12 bits the lowest bits are undefined
+    int16_t temp_raw = (int16_t) (raw & ~((1u << (12 - bus->resolution[index])) - 1));
+
+    // 1/16°C to 1/100°C: x * 100 / 16 = x * 25 / 4, rounded to nearest
+    int32_t scaled = temp_raw * 25;
+    *centi_c = (scaled >= 0 ? scaled + 2 : scaled - 2) / 4;
+
+    // Sanity check temperature range
+    if (*centi_c < DS18B20_TEMP_MIN_CENTI_C || *centi_c > DS18B20_TEMP_MAX_CENTI_C) {
+        return DS18B20_ERROR_CRC;
+    }
 
-    return presence;
+    return DS18B20_OK;
 }
 
 /**
- * Write a single bit
+ * Prepare a transaction: reset, MATCH ROM (or SKIP ROM for index -1), a
+ * function command, then rx_len scratchpad bytes
  */
-static void ds18b20_write_bit(bool bit) {
-    uint32_t ints = save_and_disable_interrupts();
-
-    if (bit) {
-        // Write 1: short low pulse
-        gpio_set_dir(ds18b20_gpio, GPIO_OUT);
-        gpio_put(ds18b20_gpio, 0);
-        busy_wait_us(DS18B20_WRITE_1_LOW);
-        gpio_set_dir(ds18b20_gpio, GPIO_IN);
-        busy_wait_us(DS18B20_WRITE_1_HIGH);
+static void ds18b20_begin(ds18b20_bus_t *bus, ds18b20_transaction_t *txn, int index,
+                          uint8_t command, size_t rx_len) {
+    *txn = (ds18b20_transaction_t){.index = index, .rx_len = (uint8_t) rx_len};
+    if (index < 0) {
+        txn->tx[txn->tx_len++] = DS18B20_SKIP_ROM;
     } else {
-        // Write 0: long low pulse
-        gpio_set_dir(ds18b20_gpio, GPIO_OUT);
-        gpio_put(ds18b20_gpio, 0);
-        busy_wait_us(DS18B20_WRITE_0_LOW);
-        gpio_set_dir(ds18b20_gpio, GPIO_IN);
-        busy_wait_us(DS18B20_WRITE_0_HIGH);
+        txn->tx[txn->tx_len++] = DS18B20_MATCH_ROM;
+        memcpy(&txn->tx[txn->tx_len], bus->roms[index], DS18B20_ROM_SIZE);
+        txn->tx_len += DS18B20_ROM_SIZE;
     }
+    txn->tx[txn->tx_len++] = command;
+}
+
+static bool ds18b20_finish(ds18b20_transaction_t *txn, ds18b20_result_t result) {
+    txn->result = result;
+    txn->done = true;
+    return false;
+}
 
-    restore_interrupts(ints);
+void ds18b20_begin_conversion(ds18b20_bus_t *bus, ds18b20_transaction_t *txn) {
+    ds18b20_begin(bus, txn, -1, DS18B20_CONVERT_T, 0);
+}
+
+void ds18b20_begin_read(ds18b20_bus_t *bus, ds18b20_transaction_t *txn, int index) {
+    if (index < 0 || index >= bus->count) {
+        *txn = (ds18b20_transaction_t){.index = index};
+        ds18b20_finish(txn, DS18B20_ERROR_TIMEOUT);
+        return;
+    }
+    bool fast = bus->read_mode == DS18B20_READ_FAST;
+    ds18b20_begin(bus, txn, index, DS18B20_READ_SCRATCHPAD,
+                  fast ? DS18B20_FAST_READ_LEN : DS18B20_SCRATCHPAD_SIZE);
+    txn->temperature = true;
 }
 
 /**
- * Read a single bit
+ * Issue the next bus operation of a transaction
+ * A full scratchpad read is validated with CRC8 and restarted from the reset
+ * while retries are left; a partial read is cut short with a reset.
  */
-static bool ds18b20_read_bit(void) {
-    uint32_t ints = save_and_disable_interrupts();
+bool ds18b20_step(ds18b20_bus_t *bus, ds18b20_transaction_t *txn) {
+    if (txn->done) {
+        return false;
+    }
 
-    // Start read slot
-    gpio_set_dir(ds18b20_gpio, GPIO_OUT);
-    gpio_put(ds18b20_gpio, 0);
-    busy_wait_us(DS18B20_READ_LOW);
+    int read_end = 1 + txn->tx_len + txn->rx_len;
+    bool partial = txn->rx_len > 0 && txn->rx_len < DS18B20_SCRATCHPAD_SIZE;
+    if (txn->step == 0) {
+        if (!onewire_reset(&bus->onewire)) {
+            return ds18b20_finish(txn, DS18B20_ERROR_NO_DEVICE);
+        }
+    } else if (txn->step <= txn->tx_len) {
+        onewire_write_byte(&bus->onewire, txn->tx[txn->step - 1]);
+    } else if (txn->step < read_end) {
+        txn->scratchpad[txn->step - 1 - txn->tx_len] = onewire_read_byte(&bus->onewire);
+    } else {
+        // A reset tells the sensor to stop sending
+        onewire_reset(&bus->onewire);
+    }
+    if (++txn->step < read_end + partial) {
+        return true;
+    }
 
-    // Release and sample
-    gpio_set_dir(ds18b20_gpio, GPIO_IN);
-    busy_wait_us(DS18B20_READ_SAMPLE);
-    bool bit = gpio_get(ds18b20_gpio);
+    if (txn->rx_len == 0) {
+        return ds18b20_finish(txn, DS18B20_OK);
+    }
+    if (!partial) {
+        // The scratchpad keeps its contents, so a corrupted read can simply be retried
+        ds18b20_result_t result = ds18b20_check_scratchpad(txn->scratchpad);
+        if (result != DS18B20_OK) {
+            if (txn->attempt < DS18B20_READ_RETRIES) {
+                txn->attempt++;
+                txn->step = 0;
+                return true;
+            }
+            return ds18b20_finish(txn, result);
+        }
+    }
+    if (txn->temperature) {
+        return ds18b20_finish(txn, ds18b20_decode_temperature(bus, txn->index, txn->scratchpad,
+                                                              partial, &txn->centi_c));
+    }
+    return ds18b20_finish(txn, DS18B20_OK);
+}
 
-    // Complete read slot
-    busy_wait_us(DS18B20_READ_HIGH);
+/**
+ * Run a transaction to completion
+ */
+static ds18b20_result_t ds18b20_run(ds18b20_bus_t *bus, ds18b20_transaction_t *txn) {
+    while (ds18b20_step(bus, txn)) {
+    }
+    return txn->result;
+}
 
-    restore_interrupts(ints);
+/**
+ * Read and validate a full scratchpad, retrying on CRC errors
+ */
+static ds18b20_result_t ds18b20_read_scratchpad(ds18b20_bus_t *bus, int index,
+                                                uint8_t *scratchpad) {
+    ds18b20_transaction_t txn;
+    ds18b20_begin(bus, &txn, index, DS18B20_READ_SCRATCHPAD, DS18B20_SCRATCHPAD_SIZE);
+    ds18b20_result_t result = ds18b20_run(bus, &txn);
+    memcpy(scratchpad, txn.scratchpad, DS18B20_SCRATCHPAD_SIZE);
+    return result;
+}
 
-    return bit;
+/**
+ * Initialize DS18B20 sensors on one bus
+ */
+ds18b20_result_t ds18b20_init(ds18b20_bus_t *bus, unsigned int gpio_pin) {
+    return ds18b20_init_backend(bus, gpio_pin, &ONEWIRE_DEFAULT_BACKEND);
 }
 
 /**
- * Write a byte
+ * Initialize DS18B20 sensors on one bus driven by a given backend
  */
-static void ds18b20_write_byte(uint8_t byte) {
-    for (int i = 0; i < 8; i++) {
-        ds18b20_write_bit(byte & (1 << i));
+ds18b20_result_t ds18b20_init_backend(ds18b20_bus_t *bus, unsigned int gpio_pin,
+                                      const onewire_backend_t *backend) {
+    bus->count = 0;
+    bus->read_mode = DS18B20_READ_FULL;
+
+    if (!onewire_init_backend(&bus->onewire, gpio_pin, backend)) {
+        return DS18B20_ERROR_NO_DEVICE;
     }
+
+    // Small delay for GPIO to settle
+    onewire_hal_delay_us(10000); // 10ms in microseconds
+
+    // Enumerate all DS18B20 sensors on the bus
+    uint8_t rom[DS18B20_ROM_SIZE] = {0};
+    int last_discrepancy = -1;
+    bool last_device = false;
+    while (bus->count < DS18B20_MAX_DEVICES &&
+           ds18b20_search_next(bus, rom, &last_discrepancy, &last_device)) {
+        if (rom[0] == DS18B20_FAMILY_CODE &&
+            onewire_crc8(rom, DS18B20_ROM_SIZE - 1) == rom[DS18B20_ROM_SIZE - 1]) {
+            memcpy(bus->roms[bus->count], rom, DS18B20_ROM_SIZE);
+            bus->resolution[bus->count] = DS18B20_RESOLUTION_MAX;
+            bus->count++;
+        }
+    }
+
+    // Pick up the resolution each sensor has stored in EEPROM
+    for (int i = 0; i < bus->count; i++) {
+        uint8_t scratchpad[DS18B20_SCRATCHPAD_SIZE];
+        if (ds18b20_read_scratchpad(bus, i, scratchpad) == DS18B20_OK) {
+            bus->resolution[i] =
+                DS18B20_RESOLUTION_MIN + ((scratchpad[DS18B20_SCRATCHPAD_CONFIG] >> 5) & 0x03);
+        }
+    }
+
+    return bus->count > 0 ? DS18B20_OK : DS18B20_ERROR_NO_DEVICE;
 }
 
 /**
- * Read a byte
+ * Get number of sensors found by ds18b20_init()
  */
-static uint8_t ds18b20_read_byte(void) {
-    uint8_t byte = 0;
-    for (int i = 0; i < 8; i++) {
-        if (ds18b20_read_bit()) {
-            byte |= (1 << i);
-        }
+int ds18b20_device_count(const ds18b20_bus_t *bus) {
+    return bus->count;
+}
+
+/**
+ * Format ROM code of a sensor as hex string
+ */
+bool ds18b20_rom_string(const ds18b20_bus_t *bus, int index, char *buf, size_t len) {
+    if (index < 0 || index >= bus->count || len < DS18B20_ROM_SIZE * 2 + 1) {
+        return false;
     }
-    return byte;
+
+    for (int i = 0; i < DS18B20_ROM_SIZE; i++) {
+        snprintf(&buf[i * 2], len - i * 2, "%02x", bus->roms[index][i]);
+    }
+
+    return true;
+}
+
+/**
+ * Start a temperature conversion on all sensors at once
+ */
+ds18b20_result_t ds18b20_start_conversion(ds18b20_bus_t *bus) {
+    ds18b20_transaction_t txn;
+    ds18b20_begin_conversion(bus, &txn);
+    return ds18b20_run(bus, &txn);
+}
+
+/**
+ * Set how scratchpads are read
+ */
+void ds18b20_set_read_mode(ds18b20_bus_t *bus, ds18b20_read_mode_t mode) {
+    bus->read_mode = mode;
 }
 
 /**
- * Read temperature from DS18B20
+ * Set conversion resolution of one sensor
  */
-ds18b20_result_t ds18b20_read_temperature(float *temperature_c) {
-    if (!temperature_c) {
+ds18b20_result_t ds18b20_set_resolution(ds18b20_bus_t *bus, int index, int bits) {
+    if (index < 0 || index >= bus->count || bits < DS18B20_RESOLUTION_MIN ||
+        bits > DS18B20_RESOLUTION_MAX) {
         return DS18B20_ERROR_TIMEOUT;
     }
 
-    // Initialize to safe value
-    *temperature_c = 0.0f;
+    // Keep the alarm thresholds (TH/TL) that share the write with the config register
+    uint8_t scratchpad[DS18B20_SCRATCHPAD_SIZE];
+    ds18b20_result_t result = ds18b20_read_scratchpad(bus, index, scratchpad);
+    if (result != DS18B20_OK) {
+        return result;
+    }
 
-    // Check if sensor is present
-    if (!ds18b20_reset()) {
-        return DS18B20_ERROR_NO_DEVICE;
+    uint8_t config = DS18B20_CONFIG_FIXED_BITS | ((bits - DS18B20_RESOLUTION_MIN) << 5);
+    if (scratchpad[DS18B20_SCRATCHPAD_CONFIG] != config) {
+        if (!ds18b20_select(bus, index)) {
+            return DS18B20_ERROR_NO_DEVICE;
+        }
+        const uint8_t write[] = {DS18B20_WRITE_SCRATCHPAD, scratchpad[2], scratchpad[3], config};
+        onewire_write_bytes(&bus->onewire, write, sizeof(write));
+
+        // Store in EEPROM so the setting survives a power cycle
+        if (!ds18b20_select(bus, index)) {
+            return DS18B20_ERROR_NO_DEVICE;
+        }
+        onewire_write_byte(&bus->onewire, DS18B20_COPY_SCRATCHPAD);
+        onewire_hal_delay_us(DS18B20_COPY_TIME_MS * 1000);
     }
 
-    // Start temperature conversion
-    ds18b20_write_byte(DS18B20_SKIP_ROM);
-    ds18b20_write_byte(DS18B20_CONVERT_T);
+    bus->resolution[index] = (uint8_t) bits;
+    return DS18B20_OK;
+}
 
-    // Wait for conversion (750ms for 12-bit resolution)
-    busy_wait_us(750000); // 750ms in microseconds
+/**
+ * Get conversion resolution of one sensor
+ */
+int ds18b20_get_resolution(const ds18b20_bus_t *bus, int index) {
+    if (index < 0 || index >= bus->count) {
+        return 0;
+    }
+    return bus->resolution[index];
+}
 
-    // Read scratchpad
-    if (!ds18b20_reset()) {
-        return DS18B20_ERROR_NO_DEVICE;
+/**
+ * Read the result of a finished conversion from one sensor
+ */
+ds18b20_result_t ds18b20_read_device(ds18b20_bus_t *bus, int index, int32_t *centi_c) {
+    if (!centi_c) {
+        return DS18B20_ERROR_TIMEOUT;
     }
 
-    ds18b20_write_byte(DS18B20_SKIP_ROM);
-    ds18b20_write_byte(DS18B20_READ_SCRATCHPAD);
+    ds18b20_transaction_t txn;
+    ds18b20_begin_read(bus, &txn, index);
+    ds18b20_result_t result = ds18b20_run(bus, &txn);
+    *centi_c = txn.centi_c;
+    return result;
+}
 
-    // Read temperature bytes (we only need first 2 bytes)
-    uint8_t temp_lsb = ds18b20_read_byte();
-    uint8_t temp_msb = ds18b20_read_byte();
+/**
+ * Read the result of a finished conversion from the first sensor
+ */
+ds18b20_result_t ds18b20_read_result(ds18b20_bus_t *bus, int32_t *centi_c) {
+    return ds18b20_read_device(bus, 0, centi_c);
+}
 
-    // Skip remaining bytes for simplicity
-    for (int i = 2; i < 9; i++) {
-        ds18b20_read_byte();
+/**
+ * Get conversion time in milliseconds
+ * A broadcast conversion lasts as long as the slowest sensor needs.
+ */
+uint32_t ds18b20_conversion_time_ms(const ds18b20_bus_t *bus) {
+    int bits = DS18B20_RESOLUTION_MIN;
+    for (int i = 0; i < bus->count; i++) {
+        if (bus->resolution[i] > bits) {
+            bits = bus->resolution[i];
+        }
+    }
+    if (bus->count == 0) {
+        bits = DS18B20_RESOLUTION_MAX;
     }
 
-    // Combine temperature bytes
-    int16_t temp_raw = (temp_msb << 8) | temp_lsb;
+    // 93.75 ms at 9 bits, doubling with every extra bit (rounded up)
+    uint32_t conversion_us = (DS18B20_CONVERSION_TIME_MS * 1000) >> (DS18B20_RESOLUTION_MAX - bits);
+    return (conversion_us + 999) / 1000;
+}
 
-    // Check for valid reading
-    if (temp_raw == 0x0550 || temp_raw == 0xFFFF || temp_raw == 0x0000) {
-        return DS18B20_ERROR_CRC;
+/**
+ * Read temperature from DS18B20 (blocking)
+ */
+ds18b20_result_t ds18b20_read_temperature(ds18b20_bus_t *bus, int32_t *centi_c) {
+    if (!centi_c) {
+        return DS18B20_ERROR_TIMEOUT;
     }
 
-    // Convert to Celsius (12-bit resolution: LSB = 0.0625°C)
-    *temperature_c = temp_raw / 16.0f;
+    // Initialize to safe value
+    *centi_c = 0;
 
-    // Sanity check temperature range
-    if (*temperature_c < -55.0f || *temperature_c > 125.0f) {
-        return DS18B20_ERROR_CRC;
+    ds18b20_result_t result = ds18b20_start_conversion(bus);
+    if (result != DS18B20_OK) {
+        return result;
     }
 
-    return DS18B20_OK;
+    // Wait for conversion (750ms for 12-bit resolution)
+    onewire_hal_delay_us(ds18b20_conversion_time_ms(bus) * 1000);
+
+    return ds18b20_read_result(bus, centi_c);
 }
 
 /**
- * Convert Celsius to Fahrenheit
+ * Convert Celsius to Fahrenheit in fixed point, rounded to nearest
  */
-float ds18b20_celsius_to_fahrenheit(float celsius) {
-    return celsius * 9.0f / 5.0f + 32.0f;
+int32_t ds18b20_celsius_to_fahrenheit(int32_t centi_c) {
+    int32_t scaled = centi_c * 9;
+    return (scaled >= 0 ? scaled + 2 : scaled - 2) / 5 + 3200;
 }
 
 /**
@@ -241,7 +498,7 @@ const char *ds18b20_error_string(ds18b20_result_t result) {
         case DS18B20_ERROR_NO_DEVICE:
             return "No device found";
         case DS18B20_ERROR_CRC:
-            return "Invalid reading";
+            return "CRC error or invalid reading";
         case DS18B20_ERROR_TIMEOUT:
             return "Timeout or invalid parameter";
         default:
@@ -11,11 +11,47 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include "onewire.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/**
+ * Maximum number of sensors enumerated on the bus
+ */
+#ifndef DS18B20_MAX_DEVICES
+#define DS18B20_MAX_DEVICES 8
+#endif
+
+/**
+ * Scratchpad re-reads after a CRC error before giving up
+ */
+#ifndef DS18B20_READ_RETRIES
+#define DS18B20_READ_RETRIES 2
+#endif
+
+/**
+ * Supported conversion resolutions in bits
+ */
+#define DS18B20_RESOLUTION_MIN 9
+#define DS18B20_RESOLUTION_MAX 12
+
+/**
+ * Size of a 1-Wire ROM code in bytes (family, 48-bit serial, CRC)
+ */
+#define DS18B20_ROM_SIZE 8
+
+/**
+ * Size of the DS18B20 scratchpad in bytes, CRC included
+ */
+#define DS18B20_SCRATCHPAD_SIZE 9
+
+// Measurement range in hundredths of a degree Celsius
+#define DS18B20_TEMP_MIN_CENTI_C (-5500)
+#define DS18B20_TEMP_MAX_CENTI_C 12500
+
 /**
  * DS18B20 result codes
  */
@@ -27,28 +63,226 @@ typedef enum {
 } ds18b20_result_t;
 
 /**
- * Initialize DS18B20 sensor on specified GPIO pin
+ * Scratchpad read modes
+ */
+typedef enum {
+    DS18B20_READ_FULL = 0, // All 9 bytes, CRC8 verified (default)
+    DS18B20_READ_FAST = 1  // Up to the configuration register, then reset; no CRC
+} ds18b20_read_mode_t;
+
+/**
+ * State of one 1-Wire bus and the DS18B20 sensors found on it
+ *
+ * Every function takes the bus it operates on, so several buses can be driven
+ * side by side, e.g. to keep long cable runs on separate GPIOs.
+ */
+typedef struct {
+    onewire_bus_t onewire;                               // Bus backend state
+    uint8_t roms[DS18B20_MAX_DEVICES][DS18B20_ROM_SIZE]; // ROM codes in search order
+    uint8_t resolution[DS18B20_MAX_DEVICES];             // Resolution per sensor in bits
+    int count;                                           // Sensors found
+    ds18b20_read_mode_t read_mode;                       // Scratchpad read mode
+} ds18b20_bus_t;
+
+/**
+ * A bus transaction run one bus operation at a time
+ *
+ * Each call to ds18b20_step() issues a single reset pulse or byte, so a
+ * caller that yields between steps is never busy for longer than a reset
+ * slot, whatever the transaction. Start one with ds18b20_begin_conversion()
+ * or ds18b20_begin_read().
+ */
+typedef struct {
+    uint8_t tx[2 + DS18B20_ROM_SIZE];           // ROM command, ROM code, function command
+    uint8_t scratchpad[DS18B20_SCRATCHPAD_SIZE]; // Bytes read so far
+    uint8_t tx_len;                             // Bytes to write after the reset
+    uint8_t rx_len;                             // Scratchpad bytes to read, 0 for none
+    uint8_t step;                               // Bus operations done in this attempt
+    uint8_t attempt;                            // Retries after a CRC error so far
+    bool temperature;                           // Decode the scratchpad into centi_c
+    bool done;
+    int index;               // Sensor index, -1 for a broadcast
+    ds18b20_result_t result; // Outcome, once done
+    int32_t centi_c;         // Temperature in hundredths of a degree Celsius, once done
+} ds18b20_transaction_t;
+
+/**
+ * Initialize DS18B20 sensors on specified GPIO pin
+ *
+ * Enumerates every DS18B20 on the bus with SEARCH ROM, up to
+ * DS18B20_MAX_DEVICES. Sensors are addressed by their index in that list.
+ *
+ * @param bus Bus state to initialize
+ * @param gpio_pin GPIO pin number for 1-Wire bus
+ * @return DS18B20_OK if at least one sensor was found, error code otherwise
+ */
+ds18b20_result_t ds18b20_init(ds18b20_bus_t *bus, unsigned int gpio_pin);
+
+/**
+ * Initialize DS18B20 sensors on specified GPIO pin with a given 1-Wire backend
  *
+ * As ds18b20_init(), which uses ONEWIRE_DEFAULT_BACKEND.
+ *
+ * @param bus Bus state to initialize
  * @param gpio_pin GPIO pin number for 1-Wire bus
+ * @param backend 1-Wire backend, e.g. &onewire_pio_backend
+ * @return DS18B20_OK if at least one sensor was found, error code otherwise
+ */
+ds18b20_result_t ds18b20_init_backend(ds18b20_bus_t *bus, unsigned int gpio_pin,
+                                      const onewire_backend_t *backend);
+
+/**
+ * Get number of sensors found by ds18b20_init()
+ *
+ * @param bus Bus to operate on
+ * @return Number of sensors
+ */
+int ds18b20_device_count(const ds18b20_bus_t *bus);
+
+/**
+ * Format the ROM code of a sensor as a 16 character hex string
+ *
+ * @param bus Bus to operate on
+ * @param index Sensor index, 0 to ds18b20_device_count() - 1
+ * @param buf Buffer to store the string
+ * @param len Buffer size, at least DS18B20_ROM_SIZE * 2 + 1
+ * @return true if successful
+ */
+bool ds18b20_rom_string(const ds18b20_bus_t *bus, int index, char *buf, size_t len);
+
+/**
+ * Set conversion resolution of one sensor
+ *
+ * Writes the configuration register (WRITE SCRATCHPAD) and stores it in the
+ * sensor's EEPROM (COPY SCRATCHPAD); the EEPROM is only written when the
+ * setting changes. Conversion time halves with every bit removed, from
+ * 750 ms at 12 bits to 94 ms at 9 bits.
+ *
+ * @param bus Bus to operate on
+ * @param index Sensor index, 0 to ds18b20_device_count() - 1
+ * @param bits Resolution, DS18B20_RESOLUTION_MIN to DS18B20_RESOLUTION_MAX
+ * @return DS18B20_OK if successful, error code otherwise
+ */
+ds18b20_result_t ds18b20_set_resolution(ds18b20_bus_t *bus, int index, int bits);
+
+/**
+ * Get conversion resolution of one sensor
+ *
+ * @param bus Bus to operate on
+ * @param index Sensor index, 0 to ds18b20_device_count() - 1
+ * @return Resolution in bits, 0 if index is invalid
+ */
+int ds18b20_get_resolution(const ds18b20_bus_t *bus, int index);
+
+/**
+ * Start a temperature conversion (non-blocking)
+ *
+ * Broadcasts CONVERT_T to all sensors on the bus and returns immediately.
+ * Collect the results with ds18b20_read_device() once
+ * ds18b20_conversion_time_ms() has elapsed. Conversions on several buses can
+ * be started back to back and then run in parallel.
+ *
+ * @param bus Bus to operate on
  * @return DS18B20_OK if successful, error code otherwise
  */
-ds18b20_result_t ds18b20_init(unsigned int gpio_pin);
+ds18b20_result_t ds18b20_start_conversion(ds18b20_bus_t *bus);
 
 /**
- * Read temperature from DS18B20 sensor
+ * Select how scratchpads are read
+ *
+ * DS18B20_READ_FAST cuts a read from 72 to 40 read slots for low latency
+ * polling, at the cost of CRC protection. The fixed bits of the configuration
+ * register are still checked, so a bus held low is not taken for 0.00°C.
+ *
+ * @param bus Bus to operate on
+ * @param mode Read mode
+ */
+void ds18b20_set_read_mode(ds18b20_bus_t *bus, ds18b20_read_mode_t mode);
+
+/**
+ * Read the result of a conversion started with ds18b20_start_conversion()
+ * from one sensor
+ *
+ * In DS18B20_READ_FULL mode a scratchpad failing CRC8 is re-read up to
+ * DS18B20_READ_RETRIES times before DS18B20_ERROR_CRC is returned.
+ *
+ * @param bus Bus to operate on
+ * @param index Sensor index, 0 to ds18b20_device_count() - 1
+ * @param centi_c Pointer to store temperature in hundredths of a degree Celsius
+ * @return DS18B20_OK if successful, error code otherwise
+ */
+ds18b20_result_t ds18b20_read_device(ds18b20_bus_t *bus, int index, int32_t *centi_c);
+
+/**
+ * Read the result of a conversion started with ds18b20_start_conversion()
+ * from the first sensor
+ *
+ * @param bus Bus to operate on
+ * @param centi_c Pointer to store temperature in hundredths of a degree Celsius
+ * @return DS18B20_OK if successful, error code otherwise
+ */
+ds18b20_result_t ds18b20_read_result(ds18b20_bus_t *bus, int32_t *centi_c);
+
+/**
+ * Prepare a ds18b20_start_conversion() to be run with ds18b20_step()
+ *
+ * @param bus Bus to operate on
+ * @param txn Transaction to prepare
+ */
+void ds18b20_begin_conversion(ds18b20_bus_t *bus, ds18b20_transaction_t *txn);
+
+/**
+ * Prepare a ds18b20_read_device() to be run with ds18b20_step()
+ *
+ * @param bus Bus to operate on
+ * @param txn Transaction to prepare
+ * @param index Sensor index, 0 to ds18b20_device_count() - 1
+ */
+void ds18b20_begin_read(ds18b20_bus_t *bus, ds18b20_transaction_t *txn, int index);
+
+/**
+ * Issue the next bus operation of a transaction
+ *
+ * A reset pulse (under 1 ms) or 8 bit slots (under 0.6 ms) per call. Once
+ * this returns false, txn->result holds the outcome and, for a read,
+ * txn->centi_c the temperature.
+ *
+ * @param bus Bus the transaction was prepared for
+ * @param txn Transaction in progress
+ * @return true if more steps follow
+ */
+bool ds18b20_step(ds18b20_bus_t *bus, ds18b20_transaction_t *txn);
+
+/**
+ * Get the time a conversion needs before its result can be read
+ *
+ * Follows the highest resolution configured on the bus.
+ *
+ * @param bus Bus to operate on
+ * @return Conversion time in milliseconds
+ */
+uint32_t ds18b20_conversion_time_ms(const ds18b20_bus_t *bus);
+
+/**
+ * Read temperature from the first DS18B20 sensor (blocking)
+ *
+ * Starts a conversion and busy-waits for it to complete. Do not call this from
+ * an async_context worker; use ds18b20_start_conversion() and
+ * ds18b20_read_result() instead.
  *
- * @param temperature_c Pointer to store temperature in Celsius
+ * @param bus Bus to operate on
+ * @param centi_c Pointer to store temperature in hundredths of a degree Celsius
  * @return DS18B20_OK if successful, error code otherwise
  */
-ds18b20_result_t ds18b20_read_temperature(float *temperature_c);
+ds18b20_result_t ds18b20_read_temperature(ds18b20_bus_t *bus, int32_t *centi_c);
 
 /**
- * Convert Celsius to Fahrenheit
+ * Convert Celsius to Fahrenheit in fixed point
  *
- * @param celsius Temperature in Celsius
- * @return Temperature in Fahrenheit
+ * @param centi_c Temperature in hundredths of a degree Celsius
+ * @return Temperature in hundredths of a degree Fahrenheit
  */
-float ds18b20_celsius_to_fahrenheit(float celsius);
+int32_t ds18b20_celsius_to_fahrenheit(int32_t centi_c);
 
 /**
  * Get human-readable error string
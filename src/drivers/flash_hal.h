@@ -0,0 +1,93 @@
+/**
+ * Flash Hardware Abstraction Layer
+ * Sector erase, page program and read of the flash region reserved for the
+ * persistent log, and of one settings sector beside it, so both build and
+ * run without a board.
+ *
+ * Implementations are selected at link time:
+ * - flash_hal_pico.c: the last FLASH_LOG_SECTORS sectors of the QSPI flash,
+ *                     and the settings sector just below them
+ * - flash_hal_sim.c:  NOR flash model backed by a host file
+ *
+ * Offsets are relative to the start of the region or sector. Like the RP2040, erase
+ * works on whole sectors and program on whole pages; programming can only
+ * clear bits, so erased bytes read 0xff.
+ *
+ * Copyright (c) 2024 Peter Westlund
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef FLASH_HAL_H
+#define FLASH_HAL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FLASH_HAL_SECTOR_SIZE 4096
+#define FLASH_HAL_PAGE_SIZE 256
+
+/**
+ * Get the size of the region in bytes, a multiple of the sector size
+ */
+uint32_t flash_hal_size(void);
+
+/**
+ * Read bytes from the region
+ */
+void flash_hal_read(uint32_t offset, void *buf, size_t len);
+
+/**
+ * Erase one sector to 0xff
+ *
+ * @param offset Sector-aligned offset
+ * @return false if the flash could not be accessed
+ */
+bool flash_hal_erase(uint32_t offset);
+
+/**
+ * Program whole pages
+ *
+ * @param offset Page-aligned offset
+ * @param data Data to program; 0xff bytes leave the flash unchanged
+ * @param len Multiple of the page size
+ * @return false if the flash could not be accessed
+ */
+bool flash_hal_program(uint32_t offset, const void *data, size_t len);
+
+/**
+ * Check whether the settings sector is available
+ */
+bool flash_hal_settings_available(void);
+
+/**
+ * Read bytes from the settings sector
+ */
+void flash_hal_settings_read(uint32_t offset, void *buf, size_t len);
+
+/**
+ * Erase the settings sector to 0xff
+ *
+ * @return false if the flash could not be accessed
+ */
+bool flash_hal_settings_erase(void);
+
+/**
+ * Program whole pages of the settings sector
+ *
+ * @param offset Page-aligned offset
+ * @param data Data to program; 0xff bytes leave the flash unchanged
+ * @param len Multiple of the page size
+ * @return false if the flash could not be accessed
+ */
+bool flash_hal_settings_program(uint32_t offset, const void *data, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // FLASH_HAL_H
@@ -0,0 +1,104 @@
+/**
+ * Flash Hardware Abstraction Layer - RP2040 implementation
+ * The region is the last FLASH_LOG_SECTORS sectors of the QSPI flash, with the
+ * settings sector just below it. Erase
+ * and program stop execute-in-place, so they run through flash_safe_execute(),
+ * which parks the other core and disables interrupts for the duration.
+ *
+ * Copyright (c) 2024 Peter Westlund
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "flash_hal.h"
+#include "pico/stdlib.h"
+#include "pico/flash.h"
+#include "hardware/flash.h"
+#include <string.h>
+
+/* Sectors reserved at the end of flash for the log */
+#ifndef FLASH_LOG_SECTORS
+#define FLASH_LOG_SECTORS 32
+#endif
+
+/* How long to wait for the other core to park before giving up */
+#define FLASH_HAL_LOCKOUT_TIMEOUT_MS 100
+
+#define FLASH_HAL_REGION_OFFSET (PICO_FLASH_SIZE_BYTES - FLASH_LOG_SECTORS * FLASH_HAL_SECTOR_SIZE)
+#define FLASH_HAL_SETTINGS_OFFSET (FLASH_HAL_REGION_OFFSET - FLASH_HAL_SECTOR_SIZE)
+
+static_assert(FLASH_HAL_SECTOR_SIZE == FLASH_SECTOR_SIZE, "sector size mismatch");
+static_assert(FLASH_HAL_PAGE_SIZE == FLASH_PAGE_SIZE, "page size mismatch");
+
+/* End of the program image, from the linker script */
+extern char __flash_binary_end;
+
+typedef struct {
+    uint32_t offset; // From the start of flash
+    const void *data;
+    size_t len;
+} flash_hal_op_t;
+
+static void erase_op(void *param) {
+    const flash_hal_op_t *op = param;
+    flash_range_erase(op->offset, FLASH_SECTOR_SIZE);
+}
+
+static void program_op(void *param) {
+    const flash_hal_op_t *op = param;
+    flash_range_program(op->offset, op->data, op->len);
+}
+
+/**
+ * Check that the program image ends below a flash offset
+ */
+static bool image_below(uint32_t offset) {
+    return (uintptr_t) &__flash_binary_end - XIP_BASE <= offset;
+}
+
+static bool erase_sector(uint32_t offset) {
+    flash_hal_op_t op = {.offset = offset};
+    return flash_safe_execute(erase_op, &op, FLASH_HAL_LOCKOUT_TIMEOUT_MS) == PICO_OK;
+}
+
+static bool program_pages(uint32_t offset, const void *data, size_t len) {
+    flash_hal_op_t op = {.offset = offset, .data = data, .len = len};
+    return flash_safe_execute(program_op, &op, FLASH_HAL_LOCKOUT_TIMEOUT_MS) == PICO_OK;
+}
+
+uint32_t flash_hal_size(void) {
+    // Refuse the region if the program image has grown into it
+    if (!image_below(FLASH_HAL_REGION_OFFSET)) {
+        return 0;
+    }
+    return FLASH_LOG_SECTORS * FLASH_HAL_SECTOR_SIZE;
+}
+
+void flash_hal_read(uint32_t offset, void *buf, size_t len) {
+    // The region is memory mapped; the SDK flushes the XIP cache after erase and program
+    memcpy(buf, (const void *) (XIP_BASE + FLASH_HAL_REGION_OFFSET + offset), len);
+}
+
+bool flash_hal_erase(uint32_t offset) {
+    return erase_sector(FLASH_HAL_REGION_OFFSET + offset);
+}
+
+bool flash_hal_program(uint32_t offset, const void *data, size_t len) {
+    return program_pages(FLASH_HAL_REGION_OFFSET + offset, data, len);
+}
+
+bool flash_hal_settings_available(void) {
+    return image_below(FLASH_HAL_SETTINGS_OFFSET);
+}
+
+void flash_hal_settings_read(uint32_t offset, void *buf, size_t len) {
+    memcpy(buf, (const void *) (XIP_BASE + FLASH_HAL_SETTINGS_OFFSET + offset), len);
+}
+
+bool flash_hal_settings_erase(void) {
+    return flash_hal_settings_available() && erase_sector(FLASH_HAL_SETTINGS_OFFSET);
+}
+
+bool flash_hal_settings_program(uint32_t offset, const void *data, size_t len) {
+    return flash_hal_settings_available() &&
+           program_pages(FLASH_HAL_SETTINGS_OFFSET + offset, data, len);
+}
@@ -0,0 +1,189 @@
+/**
+ * Flash Hardware Abstraction Layer - simulated flash for host builds
+ * See flash_sim.h for the flash model.
+ *
+ * Copyright (c) 2024 Peter Westlund
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "flash_hal.h"
+#include "flash_sim.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+static uint8_t sim_flash[FLASH_SIM_MAX_SECTORS * FLASH_HAL_SECTOR_SIZE];
+static uint8_t sim_settings[FLASH_HAL_SECTOR_SIZE]; // Stored after the region in the file
+static uint32_t sim_sector_erases[FLASH_SIM_MAX_SECTORS];
+static uint32_t sim_sectors;
+static FILE *sim_file;
+
+static flash_sim_stats_t sim_stats;
+static bool sim_power_limited;
+static uint32_t sim_power_bytes; // Bytes left before power fails
+
+/**
+ * Write a changed range through to the backing file
+ *
+ * @param data Changed bytes
+ * @param file_offset Where they live in the file
+ */
+static void sim_sync(const uint8_t *data, size_t file_offset, size_t len) {
+    if (!sim_file) {
+        return;
+    }
+    fseek(sim_file, (long) file_offset, SEEK_SET);
+    fwrite(data, 1, len, sim_file);
+    fflush(sim_file);
+}
+
+static size_t settings_file_offset(void) {
+    return (size_t) sim_sectors * FLASH_HAL_SECTOR_SIZE;
+}
+
+/**
+ * Program bytes, stopping where a power cut falls
+ */
+static void sim_program(uint8_t *flash, const uint8_t *bytes, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        // 0xff leaves a byte unchanged, so only count bytes that program something
+        if (sim_power_limited && bytes[i] != 0xff) {
+            if (sim_power_bytes == 0) {
+                break;
+            }
+            sim_power_bytes--;
+        }
+        // Program only clears bits
+        uint8_t before = flash[i];
+        flash[i] = before & bytes[i];
+        if (flash[i] != before) {
+            sim_stats.bytes_programmed++;
+        }
+    }
+    sim_stats.page_programs += len / FLASH_HAL_PAGE_SIZE;
+}
+
+bool flash_sim_open(const char *path, uint32_t sectors) {
+    flash_sim_close();
+    if (sectors == 0 || sectors > FLASH_SIM_MAX_SECTORS) {
+        return false;
+    }
+
+    sim_sectors = sectors;
+    size_t size = (size_t) sectors * FLASH_HAL_SECTOR_SIZE;
+    memset(sim_flash, 0xff, size);
+    memset(sim_settings, 0xff, sizeof(sim_settings));
+    memset(sim_sector_erases, 0, sizeof(sim_sector_erases));
+    sim_stats = (flash_sim_stats_t){0};
+    sim_power_limited = false;
+
+    if (path) {
+        // Keep what an earlier run left in the file; anything beyond it reads erased
+        sim_file = fopen(path, "r+b");
+        if (sim_file) {
+            size_t got = fread(sim_flash, 1, size, sim_file);
+            got += fread(sim_settings, 1, sizeof(sim_settings), sim_file);
+            (void) got;
+        } else {
+            sim_file = fopen(path, "w+b");
+            if (!sim_file) {
+                return false;
+            }
+        }
+        sim_sync(sim_flash, 0, size);
+        sim_sync(sim_settings, settings_file_offset(), sizeof(sim_settings));
+    }
+    return true;
+}
+
+void flash_sim_close(void) {
+    if (sim_file) {
+        fclose(sim_file);
+        sim_file = NULL;
+    }
+}
+
+void flash_sim_cut_power_after(uint32_t bytes) {
+    sim_power_limited = true;
+    sim_power_bytes = bytes;
+}
+
+void flash_sim_restore_power(void) {
+    sim_power_limited = false;
+}
+
+void flash_sim_get_stats(flash_sim_stats_t *stats) {
+    *stats = sim_stats;
+    stats->min_sector_erases = UINT32_MAX;
+    stats->max_sector_erases = 0;
+    for (uint32_t i = 0; i < sim_sectors; i++) {
+        if (sim_sector_erases[i] < stats->min_sector_erases) {
+            stats->min_sector_erases = sim_sector_erases[i];
+        }
+        if (sim_sector_erases[i] > stats->max_sector_erases) {
+            stats->max_sector_erases = sim_sector_erases[i];
+        }
+    }
+}
+
+void flash_sim_reset_stats(void) {
+    sim_stats = (flash_sim_stats_t){0};
+}
+
+uint32_t flash_hal_size(void) {
+    return sim_sectors * FLASH_HAL_SECTOR_SIZE;
+}
+
+void flash_hal_read(uint32_t offset, void *buf, size_t len) {
+    assert(offset + len <= flash_hal_size());
+    memcpy(buf, &sim_flash[offset], len);
+    sim_stats.bytes_read += len;
+}
+
+bool flash_hal_erase(uint32_t offset) {
+    assert(offset % FLASH_HAL_SECTOR_SIZE == 0 && offset < flash_hal_size());
+    if (sim_power_limited) {
+        return true;
+    }
+    memset(&sim_flash[offset], 0xff, FLASH_HAL_SECTOR_SIZE);
+    sim_sector_erases[offset / FLASH_HAL_SECTOR_SIZE]++;
+    sim_stats.erases++;
+    sim_sync(&sim_flash[offset], offset, FLASH_HAL_SECTOR_SIZE);
+    return true;
+}
+
+bool flash_hal_program(uint32_t offset, const void *data, size_t len) {
+    assert(offset % FLASH_HAL_PAGE_SIZE == 0 && len % FLASH_HAL_PAGE_SIZE == 0);
+    assert(offset + len <= flash_hal_size());
+    sim_program(&sim_flash[offset], data, len);
+    sim_sync(&sim_flash[offset], offset, len);
+    return true;
+}
+
+bool flash_hal_settings_available(void) {
+    return sim_sectors > 0;
+}
+
+void flash_hal_settings_read(uint32_t offset, void *buf, size_t len) {
+    assert(offset + len <= sizeof(sim_settings));
+    memcpy(buf, &sim_settings[offset], len);
+    sim_stats.bytes_read += len;
+}
+
+bool flash_hal_settings_erase(void) {
+    if (sim_power_limited) {
+        return true;
+    }
+    memset(sim_settings, 0xff, sizeof(sim_settings));
+    sim_stats.erases++;
+    sim_sync(sim_settings, settings_file_offset(), sizeof(sim_settings));
+    return true;
+}
+
+bool flash_hal_settings_program(uint32_t offset, const void *data, size_t len) {
+    assert(offset % FLASH_HAL_PAGE_SIZE == 0 && len % FLASH_HAL_PAGE_SIZE == 0);
+    assert(offset + len <= sizeof(sim_settings));
+    sim_program(&sim_settings[offset], data, len);
+    sim_sync(&sim_settings[offset], settings_file_offset() + offset, len);
+    return true;
+}
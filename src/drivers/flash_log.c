@@ -0,0 +1,390 @@
+/**
+ * Flash Log Implementation
+ *
+ * Segment layout (one flash sector):
+ *   slot 0:    header  magic, sequence, record size, CRC16
+ *   slot 1..n: records state, reserved, CRC16 of payload, payload
+ *
+ * A slot is free while all its bytes read 0xff, so the used slots of a
+ * segment are always a prefix. Record states only ever clear bits:
+ * 0xff free, 0x7f written, 0x3f sent. Records are marked sent in order, so
+ * the sent records are a prefix of the log too; both prefixes are found by
+ * binary search at mount.
+ *
+ * Copyright (c) 2024 Peter Westlund
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "flash_log.h"
+#include <string.h>
+
+#define FLASH_LOG_MAGIC 0x474c4850 // "PHLG"
+
+#define RECORD_STATE_WRITTEN 0x7f
+#define RECORD_STATE_SENT 0x3f
+#define RECORD_SENT_BIT 0x40 // Cleared once the record has been sent
+
+typedef struct {
+    uint32_t magic;
+    uint32_t sequence;
+    uint16_t record_size;
+    uint16_t payload_version;
+    uint16_t reserved;
+    uint16_t crc;
+} flash_log_header_t;
+
+typedef struct {
+    uint8_t state;
+    uint8_t reserved;
+    uint16_t crc;
+    uint8_t payload[FLASH_LOG_PAYLOAD_SIZE];
+} flash_log_record_t;
+
+_Static_assert(sizeof(flash_log_header_t) == FLASH_LOG_RECORD_SIZE, "header must fill one slot");
+_Static_assert(sizeof(flash_log_record_t) == FLASH_LOG_RECORD_SIZE, "record must fill one slot");
+
+uint16_t flash_log_crc16(const uint8_t *data, size_t len) {
+    // Nibble table to keep the flash footprint small
+    static const uint16_t table[16] = {
+        0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50a5, 0x60c6, 0x70e7,
+        0x8108, 0x9129, 0xa14a, 0xb16b, 0xc18c, 0xd1ad, 0xe1ce, 0xf1ef,
+    };
+    uint16_t crc = 0xffff;
+    while (len--) {
+        crc = (uint16_t) (crc << 4) ^ table[(crc >> 12) ^ (*data >> 4)];
+        crc = (uint16_t) (crc << 4) ^ table[(crc >> 12) ^ (*data & 0x0f)];
+        data++;
+    }
+    return crc;
+}
+
+static uint32_t slot_offset(uint32_t segment, uint32_t slot) {
+    // Slot 0 is the header, so record slot n lives at n + 1
+    return segment * FLASH_HAL_SECTOR_SIZE + (slot + 1) * FLASH_LOG_RECORD_SIZE;
+}
+
+static uint32_t next_segment(const flash_log_t *log, uint32_t segment) {
+    return segment + 1 < log->segments ? segment + 1 : 0;
+}
+
+/**
+ * Segments from the tail up to and including the given one
+ */
+static uint32_t segment_distance(const flash_log_t *log, uint32_t segment) {
+    return (segment + log->segments - log->tail_segment) % log->segments;
+}
+
+static bool slot_is_free(uint32_t segment, uint32_t slot) {
+    uint8_t bytes[FLASH_LOG_RECORD_SIZE];
+    flash_hal_read(slot_offset(segment, slot), bytes, sizeof(bytes));
+    for (size_t i = 0; i < sizeof(bytes); i++) {
+        if (bytes[i] != 0xff) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool slot_is_sent(uint32_t segment, uint32_t slot) {
+    uint8_t state;
+    flash_hal_read(slot_offset(segment, slot), &state, 1);
+    return !(state & RECORD_SENT_BIT);
+}
+
+static bool read_header(uint32_t segment, flash_log_header_t *header) {
+    flash_hal_read(segment * FLASH_HAL_SECTOR_SIZE, header, sizeof(*header));
+    uint16_t crc = flash_log_crc16((const uint8_t *) header, offsetof(flash_log_header_t, crc));
+    return header->magic == FLASH_LOG_MAGIC && header->record_size == FLASH_LOG_RECORD_SIZE &&
+           header->payload_version == FLASH_LOG_PAYLOAD_VERSION && header->crc == crc;
+}
+
+/**
+ * Read a record, returning false if it is torn or corrupted
+ */
+static bool read_record(uint32_t segment, uint32_t slot, flash_log_record_t *record) {
+    flash_hal_read(slot_offset(segment, slot), record, sizeof(*record));
+    return (record->state & 0x80) == 0 &&
+           record->crc == flash_log_crc16(record->payload, sizeof(record->payload));
+}
+
+/**
+ * Program a slot-sized item at an offset, padding the rest of its page with 0xff
+ */
+static flash_log_result_t program_slot(uint32_t offset, const void *data, size_t len) {
+    uint8_t page[FLASH_HAL_PAGE_SIZE];
+    uint32_t page_offset = offset & ~(uint32_t) (FLASH_HAL_PAGE_SIZE - 1);
+    memset(page, 0xff, sizeof(page));
+    memcpy(&page[offset - page_offset], data, len);
+    if (!flash_hal_program(page_offset, page, sizeof(page))) {
+        return FLASH_LOG_ERROR_FLASH;
+    }
+
+    uint8_t check[FLASH_LOG_RECORD_SIZE];
+    flash_hal_read(offset, check, len);
+    return memcmp(check, data, len) == 0 ? FLASH_LOG_OK : FLASH_LOG_ERROR_VERIFY;
+}
+
+/**
+ * Erase a segment and give it a header with the next sequence number
+ */
+static flash_log_result_t open_segment(uint32_t segment, uint32_t sequence) {
+    if (!flash_hal_erase(segment * FLASH_HAL_SECTOR_SIZE)) {
+        return FLASH_LOG_ERROR_FLASH;
+    }
+    flash_log_header_t header = {
+        .magic = FLASH_LOG_MAGIC,
+        .sequence = sequence,
+        .record_size = FLASH_LOG_RECORD_SIZE,
+        .payload_version = FLASH_LOG_PAYLOAD_VERSION,
+        .reserved = 0xffff,
+    };
+    header.crc = flash_log_crc16((const uint8_t *) &header, offsetof(flash_log_header_t, crc));
+    return program_slot(segment * FLASH_HAL_SECTOR_SIZE, &header, sizeof(header));
+}
+
+/**
+ * Move the read position off the end of a full segment
+ */
+static void normalize_read(flash_log_t *log) {
+    if (log->read_slot == FLASH_LOG_RECORDS_PER_SEGMENT && log->read_segment != log->head_segment) {
+        log->read_segment = next_segment(log, log->read_segment);
+        log->read_slot = 0;
+    }
+}
+
+/**
+ * Start a new head segment, reusing the tail segment when the region is full
+ */
+static flash_log_result_t advance_head(flash_log_t *log) {
+    uint32_t segment = next_segment(log, log->head_segment);
+
+    if (segment == log->tail_segment) {
+        // Unsent records in the reused segment are lost
+        if (log->read_segment == segment) {
+            uint32_t lost = FLASH_LOG_RECORDS_PER_SEGMENT - log->read_slot;
+            log->dropped += lost;
+            log->unsent -= lost;
+            log->read_segment = next_segment(log, segment);
+            log->read_slot = 0;
+        }
+        log->tail_segment = next_segment(log, segment);
+    }
+
+    flash_log_result_t result = open_segment(segment, log->head_sequence + 1);
+    if (result != FLASH_LOG_OK) {
+        return result;
+    }
+    log->head_segment = segment;
+    log->head_sequence++;
+    log->head_slot = 0;
+    normalize_read(log);
+    return FLASH_LOG_OK;
+}
+
+flash_log_result_t flash_log_format(flash_log_t *log) {
+    memset(log, 0, sizeof(*log));
+    log->segments = flash_hal_size() / FLASH_HAL_SECTOR_SIZE;
+    if (log->segments < 2) {
+        return FLASH_LOG_ERROR_SIZE;
+    }
+
+    for (uint32_t segment = 1; segment < log->segments; segment++) {
+        if (!flash_hal_erase(segment * FLASH_HAL_SECTOR_SIZE)) {
+            return FLASH_LOG_ERROR_FLASH;
+        }
+    }
+    return open_segment(0, 0);
+}
+
+flash_log_result_t flash_log_mount(flash_log_t *log) {
+    memset(log, 0, sizeof(*log));
+    log->segments = flash_hal_size() / FLASH_HAL_SECTOR_SIZE;
+    if (log->segments < 2) {
+        return FLASH_LOG_ERROR_SIZE;
+    }
+
+    // The head is the valid segment with the highest sequence number
+    bool found = false;
+    for (uint32_t segment = 0; segment < log->segments; segment++) {
+        flash_log_header_t header;
+        if (read_header(segment, &header) &&
+            (!found || (int32_t) (header.sequence - log->head_sequence) > 0)) {
+            log->head_segment = segment;
+            log->head_sequence = header.sequence;
+            found = true;
+        }
+    }
+    if (!found) {
+        return flash_log_format(log);
+    }
+
+    // Walk back over segments whose sequence numbers continue the head's
+    log->tail_segment = log->head_segment;
+    for (uint32_t n = 1; n < log->segments; n++) {
+        uint32_t segment = (log->head_segment + log->segments - n) % log->segments;
+        flash_log_header_t header;
+        if (!read_header(segment, &header) || header.sequence != log->head_sequence - n) {
+            break;
+        }
+        log->tail_segment = segment;
+    }
+
+    // Used slots of the head segment are a prefix: find the first free one
+    uint32_t low = 0;
+    uint32_t high = FLASH_LOG_RECORDS_PER_SEGMENT;
+    while (low < high) {
+        uint32_t mid = (low + high) / 2;
+        if (slot_is_free(log->head_segment, mid)) {
+            high = mid;
+        } else {
+            low = mid + 1;
+        }
+    }
+    log->head_slot = low;
+
+    // Sent records are a prefix of the log: find the first unsent one
+    uint32_t segments = segment_distance(log, log->head_segment);
+    low = 0;
+    high = segments * FLASH_LOG_RECORDS_PER_SEGMENT + log->head_slot;
+    while (low < high) {
+        uint32_t mid = (low + high) / 2;
+        uint32_t segment = (log->tail_segment + mid / FLASH_LOG_RECORDS_PER_SEGMENT);
+        if (slot_is_sent(segment % log->segments, mid % FLASH_LOG_RECORDS_PER_SEGMENT)) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    uint32_t total = segments * FLASH_LOG_RECORDS_PER_SEGMENT + log->head_slot;
+    if (low == total) {
+        // Everything sent, read position is the head
+        log->read_segment = log->head_segment;
+        log->read_slot = log->head_slot;
+    } else {
+        log->read_segment = (log->tail_segment + low / FLASH_LOG_RECORDS_PER_SEGMENT);
+        log->read_segment %= log->segments;
+        log->read_slot = low % FLASH_LOG_RECORDS_PER_SEGMENT;
+    }
+    log->unsent = total - low;
+    return FLASH_LOG_OK;
+}
+
+flash_log_result_t flash_log_append(flash_log_t *log, const void *payload) {
+    if (log->segments < 2) {
+        return FLASH_LOG_ERROR_SIZE;
+    }
+    if (log->head_slot == FLASH_LOG_RECORDS_PER_SEGMENT) {
+        flash_log_result_t result = advance_head(log);
+        if (result != FLASH_LOG_OK) {
+            return result;
+        }
+    }
+
+    flash_log_record_t record = {.state = RECORD_STATE_WRITTEN, .reserved = 0xff};
+    memcpy(record.payload, payload, sizeof(record.payload));
+    record.crc = flash_log_crc16(record.payload, sizeof(record.payload));
+
+    // The slot is used even if programming fails, so never reuse it
+    uint32_t offset = slot_offset(log->head_segment, log->head_slot);
+    log->head_slot++;
+    log->unsent++;
+    return program_slot(offset, &record, sizeof(record));
+}
+
+size_t flash_log_peek(const flash_log_t *log, size_t skip, void *payloads, size_t max) {
+    uint8_t *out = payloads;
+    uint32_t segment = log->read_segment;
+    uint32_t slot = log->read_slot;
+    size_t n = 0;
+
+    for (uint32_t left = log->unsent; left > 0 && n < max; left--) {
+        if (slot == FLASH_LOG_RECORDS_PER_SEGMENT) {
+            segment = next_segment(log, segment);
+            slot = 0;
+        }
+        flash_log_record_t record;
+        if (read_record(segment, slot, &record)) {
+            if (skip > 0) {
+                skip--;
+            } else {
+                memcpy(&out[n * FLASH_LOG_PAYLOAD_SIZE], record.payload, FLASH_LOG_PAYLOAD_SIZE);
+                n++;
+            }
+        }
+        slot++;
+    }
+    return n;
+}
+
+flash_log_result_t flash_log_mark_sent(flash_log_t *log, size_t n) {
+    uint8_t page[FLASH_HAL_PAGE_SIZE];
+    int32_t page_offset = -1;
+    flash_log_result_t result = FLASH_LOG_OK;
+
+    // Clear the sent bit of each passed slot, one page program per page touched
+    while (log->unsent > 0) {
+        flash_log_record_t record;
+        bool valid = read_record(log->read_segment, log->read_slot, &record);
+        if (valid && n == 0) {
+            break;
+        }
+
+        uint32_t offset = slot_offset(log->read_segment, log->read_slot);
+        uint32_t this_page = offset & ~(uint32_t) (FLASH_HAL_PAGE_SIZE - 1);
+        if ((int32_t) this_page != page_offset) {
+            if (page_offset >= 0 && !flash_hal_program(page_offset, page, sizeof(page))) {
+                result = FLASH_LOG_ERROR_FLASH;
+            }
+            memset(page, 0xff, sizeof(page));
+            page_offset = (int32_t) this_page;
+        }
+        page[offset - this_page] = RECORD_STATE_SENT;
+
+        if (valid) {
+            n--;
+        }
+        log->read_slot++;
+        log->unsent--;
+        normalize_read(log);
+    }
+    if (page_offset >= 0 && !flash_hal_program(page_offset, page, sizeof(page))) {
+        result = FLASH_LOG_ERROR_FLASH;
+    }
+    return result;
+}
+
+bool flash_log_last(const flash_log_t *log, void *payload) {
+    uint32_t segment = log->head_segment;
+    uint32_t slot = log->head_slot;
+
+    while (true) {
+        if (slot == 0) {
+            if (segment == log->tail_segment) {
+                return false;
+            }
+            segment = (segment + log->segments - 1) % log->segments;
+            slot = FLASH_LOG_RECORDS_PER_SEGMENT;
+        }
+        slot--;
+        flash_log_record_t record;
+        if (read_record(segment, slot, &record)) {
+            memcpy(payload, record.payload, FLASH_LOG_PAYLOAD_SIZE);
+            return true;
+        }
+    }
+}
+
+const char *flash_log_error_string(flash_log_result_t result) {
+    switch (result) {
+        case FLASH_LOG_OK:
+            return "OK";
+        case FLASH_LOG_ERROR_SIZE:
+            return "Flash log region too small";
+        case FLASH_LOG_ERROR_FLASH:
+            return "Flash erase or program failed";
+        case FLASH_LOG_ERROR_VERIFY:
+            return "Flash verify failed";
+        default:
+            return "Unknown error";
+    }
+}
@@ -0,0 +1,136 @@
+/**
+ * Flash Log Header
+ * Append-only log of fixed-size records in a reserved flash region, kept
+ * across power loss and reboots.
+ *
+ * The region is split into sector-sized segments written round robin, so
+ * every sector is erased equally often. Each segment starts with a header
+ * holding a sequence number; records carry a CRC and a state byte that is
+ * programmed in place (bits only cleared) when the record has been sent.
+ * Mounting reads the segment headers and binary searches for the write head
+ * and the oldest unsent record, so it never scans the whole region.
+ *
+ * Copyright (c) 2024 Peter Westlund
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef FLASH_LOG_H
+#define FLASH_LOG_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "flash_hal.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Record layout: state, reserved, CRC16, payload
+#define FLASH_LOG_RECORD_SIZE 16
+#define FLASH_LOG_PAYLOAD_SIZE 12
+
+// Bump when the meaning of the payload bytes changes; a log written with another is formatted
+#define FLASH_LOG_PAYLOAD_VERSION 1
+
+// The first record slot of each segment holds the segment header
+#define FLASH_LOG_RECORDS_PER_SEGMENT (FLASH_HAL_SECTOR_SIZE / FLASH_LOG_RECORD_SIZE - 1)
+
+/**
+ * Error codes
+ */
+typedef enum {
+    FLASH_LOG_OK = 0,
+    FLASH_LOG_ERROR_SIZE = -1,  // Region missing or smaller than two segments
+    FLASH_LOG_ERROR_FLASH = -2, // Erase or program failed
+    FLASH_LOG_ERROR_VERIFY = -3 // Data read back differs from what was written
+} flash_log_result_t;
+
+/**
+ * Log state, all derived from flash by flash_log_mount()
+ */
+typedef struct {
+    uint32_t segments;       // Segments in the region
+    uint32_t tail_segment;   // Oldest segment
+    uint32_t head_segment;   // Segment being appended to
+    uint32_t head_sequence;  // Sequence number of the head segment
+    uint32_t head_slot;      // Next free record slot in the head segment
+    uint32_t read_segment;   // Segment of the oldest unsent record
+    uint32_t read_slot;      // Slot of the oldest unsent record
+    uint32_t unsent;         // Record slots not yet marked sent, torn ones included
+    uint32_t dropped;        // Unsent records lost when their segment was reused
+} flash_log_t;
+
+/**
+ * Find the write head and the oldest unsent record, formatting a blank or foreign region
+ *
+ * @param log Log state to fill in
+ * @return FLASH_LOG_OK on success
+ */
+flash_log_result_t flash_log_mount(flash_log_t *log);
+
+/**
+ * Erase the whole region and start an empty log
+ */
+flash_log_result_t flash_log_format(flash_log_t *log);
+
+/**
+ * Append a record, reusing the oldest segment when the region is full
+ *
+ * @param log Mounted log
+ * @param payload FLASH_LOG_PAYLOAD_SIZE bytes
+ * @return FLASH_LOG_OK once the record is in flash
+ */
+flash_log_result_t flash_log_append(flash_log_t *log, const void *payload);
+
+/**
+ * Read the oldest unsent records without marking them
+ * Records with a bad CRC, e.g. torn by a power cut, are skipped.
+ *
+ * @param log Mounted log
+ * @param skip Number of valid records to pass over first, e.g. ones sent but not yet acknowledged
+ * @param payloads Output, max * FLASH_LOG_PAYLOAD_SIZE bytes
+ * @param max Maximum number of records
+ * @return Number of records read
+ */
+size_t flash_log_peek(const flash_log_t *log, size_t skip, void *payloads, size_t max);
+
+/**
+ * Mark the oldest unsent records as sent, including any skipped by flash_log_peek()
+ *
+ * @param log Mounted log
+ * @param n Number of valid records to mark, as returned by flash_log_peek()
+ */
+flash_log_result_t flash_log_mark_sent(flash_log_t *log, size_t n);
+
+/**
+ * Read the newest valid record, e.g. to carry a boot counter across reboots
+ *
+ * @param log Mounted log
+ * @param payload Output, FLASH_LOG_PAYLOAD_SIZE bytes
+ * @return false if the log holds no valid record
+ */
+bool flash_log_last(const flash_log_t *log, void *payload);
+
+/**
+ * Get the number of records not yet marked sent
+ */
+static inline uint32_t flash_log_unsent(const flash_log_t *log) {
+    return log->unsent;
+}
+
+/**
+ * Get error string for result code
+ */
+const char *flash_log_error_string(flash_log_result_t result);
+
+/**
+ * CRC-16/CCITT-FALSE, as used for log records
+ */
+uint16_t flash_log_crc16(const uint8_t *data, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // FLASH_LOG_H
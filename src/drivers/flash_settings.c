@@ -0,0 +1,113 @@
+/**
+ * Flash Settings Implementation
+ *
+ * Copyright (c) 2024 Peter Westlund
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "flash_settings.h"
+#include "flash_hal.h"
+#include "flash_log.h"
+#include <string.h>
+
+#define FLASH_SETTINGS_MAGIC 0x5347 // "SG"
+#define FLASH_SETTINGS_SLOTS (FLASH_HAL_SECTOR_SIZE / FLASH_SETTINGS_RECORD_SIZE)
+
+typedef struct {
+    uint16_t magic;
+    uint16_t crc;
+    uint8_t settings[FLASH_SETTINGS_SIZE];
+} flash_settings_record_t;
+
+_Static_assert(sizeof(flash_settings_record_t) == FLASH_SETTINGS_RECORD_SIZE,
+               "record must fill one slot");
+
+static bool record_is_blank(const flash_settings_record_t *record) {
+    const uint8_t *bytes = (const uint8_t *) record;
+    for (size_t i = 0; i < sizeof(*record); i++) {
+        if (bytes[i] != 0xff) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool record_is_valid(const flash_settings_record_t *record) {
+    return record->magic == FLASH_SETTINGS_MAGIC &&
+           record->crc == flash_log_crc16(record->settings, sizeof(record->settings));
+}
+
+/**
+ * Find the newest valid record and the slot after the last written one
+ *
+ * @param newest Set to the newest valid record, if any
+ * @param next_slot Set to the first slot after the last written one
+ * @return false if there is no valid record
+ */
+static bool scan(flash_settings_record_t *newest, uint32_t *next_slot) {
+    bool found = false;
+    *next_slot = 0;
+    for (uint32_t slot = 0; slot < FLASH_SETTINGS_SLOTS; slot++) {
+        flash_settings_record_t record;
+        flash_hal_settings_read(slot * FLASH_SETTINGS_RECORD_SIZE, &record, sizeof(record));
+        if (record_is_blank(&record)) {
+            continue;
+        }
+        // Torn records still take their slot
+        *next_slot = slot + 1;
+        if (record_is_valid(&record)) {
+            *newest = record;
+            found = true;
+        }
+    }
+    return found;
+}
+
+bool flash_settings_load(void *settings) {
+    if (!flash_hal_settings_available()) {
+        return false;
+    }
+    flash_settings_record_t newest;
+    uint32_t next_slot;
+    if (!scan(&newest, &next_slot)) {
+        return false;
+    }
+    memcpy(settings, newest.settings, sizeof(newest.settings));
+    return true;
+}
+
+bool flash_settings_save(const void *settings) {
+    if (!flash_hal_settings_available()) {
+        return false;
+    }
+    flash_settings_record_t newest;
+    uint32_t next_slot;
+    bool found = scan(&newest, &next_slot);
+    if (found && memcmp(newest.settings, settings, sizeof(newest.settings)) == 0) {
+        return true;
+    }
+    if (next_slot == FLASH_SETTINGS_SLOTS) {
+        if (!flash_hal_settings_erase()) {
+            return false;
+        }
+        next_slot = 0;
+    }
+
+    flash_settings_record_t record = {.magic = FLASH_SETTINGS_MAGIC};
+    memcpy(record.settings, settings, sizeof(record.settings));
+    record.crc = flash_log_crc16(record.settings, sizeof(record.settings));
+
+    // Program the page holding the slot, leaving the rest of it 0xff
+    uint8_t page[FLASH_HAL_PAGE_SIZE];
+    uint32_t offset = next_slot * FLASH_SETTINGS_RECORD_SIZE;
+    uint32_t page_offset = offset & ~(uint32_t) (FLASH_HAL_PAGE_SIZE - 1);
+    memset(page, 0xff, sizeof(page));
+    memcpy(&page[offset - page_offset], &record, sizeof(record));
+    if (!flash_hal_settings_program(page_offset, page, sizeof(page))) {
+        return false;
+    }
+
+    flash_settings_record_t check;
+    flash_hal_settings_read(offset, &check, sizeof(check));
+    return memcmp(&check, &record, sizeof(record)) == 0;
+}
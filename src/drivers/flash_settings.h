@@ -0,0 +1,47 @@
+/**
+ * Flash Settings Header
+ * A small block of settings kept in the settings sector across reboots.
+ * Every save appends a record after the previous one; the newest record with
+ * a valid CRC wins, and the sector is only erased once all 256 record slots
+ * are used.
+ *
+ * Copyright (c) 2024 Peter Westlund
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef FLASH_SETTINGS_H
+#define FLASH_SETTINGS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Record layout: magic, CRC16, settings
+#define FLASH_SETTINGS_RECORD_SIZE 16
+#define FLASH_SETTINGS_SIZE 12
+
+/**
+ * Load the newest saved settings
+ *
+ * @param settings Output, FLASH_SETTINGS_SIZE bytes
+ * @return false if nothing valid has been saved
+ */
+bool flash_settings_load(void *settings);
+
+/**
+ * Save settings, unless they equal the newest saved ones
+ *
+ * @param settings FLASH_SETTINGS_SIZE bytes
+ * @return false if the flash could not be written
+ */
+bool flash_settings_save(const void *settings);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // FLASH_SETTINGS_H
@@ -0,0 +1,82 @@
+/**
+ * Simulated flash for host builds
+ * Implements flash_hal.h on top of a NOR flash model kept in a host file, so
+ * the persistent log runs unmodified on a Linux host and survives "reboots"
+ * between runs.
+ *
+ * Like real NOR flash, program can only clear bits and erase works on whole
+ * sectors. Every operation is counted per sector, so wear and write
+ * amplification can be measured, and power can be cut partway through a
+ * program to test recovery from torn writes.
+ *
+ * Copyright (c) 2024 Peter Westlund
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef FLASH_SIM_H
+#define FLASH_SIM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Largest simulated region
+#define FLASH_SIM_MAX_SECTORS 256
+
+/**
+ * Operation counters since the last flash_sim_reset_stats()
+ */
+typedef struct {
+    uint32_t erases;          // Sector erases
+    uint32_t page_programs;   // Page program operations
+    uint64_t bytes_programmed; // Bytes changed by program operations
+    uint64_t bytes_read;
+    uint32_t min_sector_erases; // Lowest erase count of any sector
+    uint32_t max_sector_erases; // Highest erase count of any sector
+} flash_sim_stats_t;
+
+/**
+ * Open or create the backing file and make it the simulated region
+ * A new file starts fully erased. The settings sector follows the region in the file.
+ *
+ * @param path Backing file, or NULL to keep the flash in memory only
+ * @param sectors Region size in sectors
+ * @return false if the file cannot be used or the size is out of range
+ */
+bool flash_sim_open(const char *path, uint32_t sectors);
+
+/**
+ * Close the backing file; the contents stay in the file
+ */
+void flash_sim_close(void);
+
+/**
+ * Make program operations stop after this many more non-0xff bytes, as if power failed
+ * Further erases and programs are ignored until flash_sim_restore_power().
+ */
+void flash_sim_cut_power_after(uint32_t bytes);
+
+/**
+ * Accept erases and programs again
+ */
+void flash_sim_restore_power(void);
+
+/**
+ * Get the operation counters
+ */
+void flash_sim_get_stats(flash_sim_stats_t *stats);
+
+/**
+ * Clear the operation counters, keeping the per-sector erase counts
+ */
+void flash_sim_reset_stats(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // FLASH_SIM_H
@@ -0,0 +1,34 @@
+/**
+ * 1-Wire Bus Layer - backend selection and accounting
+ * Shared by all backends
+ *
+ * Copyright (c) 2024 Peter Westlund
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "onewire.h"
+
+bool onewire_init(onewire_bus_t *bus, unsigned int gpio_pin) {
+    return onewire_init_backend(bus, gpio_pin, &ONEWIRE_DEFAULT_BACKEND);
+}
+
+bool onewire_init_backend(onewire_bus_t *bus, unsigned int gpio_pin,
+                          const onewire_backend_t *backend) {
+    *bus = (onewire_bus_t){.backend = backend, .gpio = gpio_pin};
+    return backend->init(bus);
+}
+
+void onewire_deinit(onewire_bus_t *bus) {
+    if (bus->backend && bus->backend->deinit) {
+        bus->backend->deinit(bus);
+    }
+    bus->backend = NULL;
+}
+
+void onewire_get_stats(const onewire_bus_t *bus, onewire_stats_t *stats) {
+    *stats = bus->stats;
+}
+
+void onewire_reset_stats(onewire_bus_t *bus) {
+    bus->stats = (onewire_stats_t){0};
+}
@@ -0,0 +1,192 @@
+/**
+ * 1-Wire Bus Layer for Raspberry Pi Pico
+ * Low level bus operations used by the DS18B20 driver
+ *
+ * Two backends implement this interface, chosen per bus when it is
+ * initialized; ONEWIRE_DEFAULT_BACKEND is set by the build:
+ * - onewire_gpio.c: bit-banged slots with interrupts disabled per slot, on
+ *                   top of onewire_hal.h so it also runs against the simulator
+ * - onewire_pio.c:  PIO state machine generating the slots in hardware
+ * Both can be linked into one image, e.g. to benchmark them side by side.
+ *
+ * Copyright (c) 2024 Peter Westlund
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef ONEWIRE_H
+#define ONEWIRE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Bus time accounting, accumulated since init or the last onewire_reset_stats()
+ */
+typedef struct {
+    uint32_t slots;          // Reset pulses and bit slots issued
+    uint32_t cpu_us;         // Time the CPU spent inside bus operations
+    uint32_t irq_off_us;     // Total time with interrupts disabled
+    uint32_t irq_off_max_us; // Longest single interrupts-off window
+} onewire_stats_t;
+
+typedef struct onewire_bus onewire_bus_t;
+
+/**
+ * Bus operations of one backend
+ */
+typedef struct {
+    const char *name;
+    bool (*init)(onewire_bus_t *bus); // Claim bus->gpio; bus is zeroed apart from gpio
+    void (*deinit)(onewire_bus_t *bus); // Release what init claimed, may be NULL
+    bool (*reset)(onewire_bus_t *bus);
+    void (*write_bit)(onewire_bus_t *bus, bool bit);
+    bool (*read_bit)(onewire_bus_t *bus);
+    void (*write_bytes)(onewire_bus_t *bus, const uint8_t *data, size_t len);
+    void (*read_bytes)(onewire_bus_t *bus, uint8_t *data, size_t len);
+} onewire_backend_t;
+
+/* Bit-banged backend, onewire_gpio.c */
+extern const onewire_backend_t onewire_gpio_backend;
+
+/* PIO backend, onewire_pio.c; not available in host builds */
+extern const onewire_backend_t onewire_pio_backend;
+
+/* Backend used by onewire_init() */
+#ifndef ONEWIRE_DEFAULT_BACKEND
+#define ONEWIRE_DEFAULT_BACKEND onewire_gpio_backend
+#endif
+
+/**
+ * State of one 1-Wire bus
+ * Each bus has its own instance; the driver keeps no per-bus globals.
+ */
+struct onewire_bus {
+    const onewire_backend_t *backend;
+    unsigned int gpio;     // Data pin
+    uint8_t pio_index;     // PIO backend: PIO block (0 or 1)
+    uint8_t sm;            // PIO backend: state machine
+    uint8_t offset;        // PIO backend: program offset
+    onewire_stats_t stats; // Bus time accounting
+};
+
+/**
+ * Initialize a 1-Wire bus on specified GPIO pin with the default backend
+ *
+ * @param bus Bus state to initialize
+ * @param gpio_pin GPIO pin number for 1-Wire bus
+ * @return true if the backend could claim the pin
+ */
+bool onewire_init(onewire_bus_t *bus, unsigned int gpio_pin);
+
+/**
+ * Initialize a 1-Wire bus on specified GPIO pin with a given backend
+ *
+ * @param bus Bus state to initialize
+ * @param gpio_pin GPIO pin number for 1-Wire bus
+ * @param backend Backend to drive the bus with
+ * @return true if the backend could claim the pin
+ */
+bool onewire_init_backend(onewire_bus_t *bus, unsigned int gpio_pin,
+                          const onewire_backend_t *backend);
+
+/**
+ * Release a bus, e.g. to drive its pin with another backend
+ *
+ * @param bus Bus to release
+ */
+void onewire_deinit(onewire_bus_t *bus);
+
+/**
+ * Send reset pulse and check for presence
+ *
+ * @return true if at least one device answered with a presence pulse
+ */
+static inline bool onewire_reset(onewire_bus_t *bus) {
+    return bus->backend->reset(bus);
+}
+
+/**
+ * Write a single bit
+ */
+static inline void onewire_write_bit(onewire_bus_t *bus, bool bit) {
+    bus->backend->write_bit(bus, bit);
+}
+
+/**
+ * Read a single bit
+ */
+static inline bool onewire_read_bit(onewire_bus_t *bus) {
+    return bus->backend->read_bit(bus);
+}
+
+/**
+ * Write bytes, LSB first
+ */
+static inline void onewire_write_bytes(onewire_bus_t *bus, const uint8_t *data, size_t len) {
+    bus->backend->write_bytes(bus, data, len);
+}
+
+/**
+ * Read bytes, LSB first
+ */
+static inline void onewire_read_bytes(onewire_bus_t *bus, uint8_t *data, size_t len) {
+    bus->backend->read_bytes(bus, data, len);
+}
+
+/**
+ * Write a byte
+ */
+static inline void onewire_write_byte(onewire_bus_t *bus, uint8_t byte) {
+    onewire_write_bytes(bus, &byte, 1);
+}
+
+/**
+ * Read a byte
+ */
+static inline uint8_t onewire_read_byte(onewire_bus_t *bus) {
+    uint8_t byte;
+    onewire_read_bytes(bus, &byte, 1);
+    return byte;
+}
+
+/**
+ * Calculate Dallas/Maxim CRC8 (ROM codes, DS18B20 scratchpad)
+ *
+ * Running the CRC over data including its trailing CRC byte yields 0.
+ *
+ * @param data Data to checksum
+ * @param len Number of bytes
+ * @return CRC8 value
+ */
+uint8_t onewire_crc8(const uint8_t *data, size_t len);
+
+/**
+ * Get name of the backend driving a bus ("gpio" or "pio")
+ */
+static inline const char *onewire_backend_name(const onewire_bus_t *bus) {
+    return bus->backend->name;
+}
+
+/**
+ * Get bus time accounting
+ *
+ * @param bus Bus to query
+ * @param stats Pointer to store the counters
+ */
+void onewire_get_stats(const onewire_bus_t *bus, onewire_stats_t *stats);
+
+/**
+ * Clear bus time accounting
+ */
+void onewire_reset_stats(onewire_bus_t *bus);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // ONEWIRE_H
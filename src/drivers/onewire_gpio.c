@@ -0,0 +1,158 @@
+/**
+ * 1-Wire Bus Layer - bit-banged GPIO backend
+ * Written in pure C for maximum compatibility and timing precision
+ *
+ * Copyright (c) 2024 Peter Westlund
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "onewire.h"
+#include "onewire_hal.h"
+
+// Timing constants (microseconds) - conservative values for reliability
+#define ONEWIRE_RESET_PULSE 500   // Reset pulse duration
+#define ONEWIRE_PRESENCE_WAIT 70  // Wait for presence pulse
+#define ONEWIRE_PRESENCE_READ 240 // Presence detection window
+#define ONEWIRE_WRITE_1_LOW 6     // Write 1: low time
+#define ONEWIRE_WRITE_1_HIGH 64   // Write 1: high time
+#define ONEWIRE_WRITE_0_LOW 60    // Write 0: low time
+#define ONEWIRE_WRITE_0_HIGH 10   // Write 0: high time
+#define ONEWIRE_READ_LOW 6        // Read: initial low time
+#define ONEWIRE_READ_SAMPLE 9     // Read: sample timing
+#define ONEWIRE_READ_HIGH 55      // Read: remaining high time
+
+/**
+ * Account for one slot that ran with interrupts disabled since start_us
+ */
+static inline void onewire_account_slot(onewire_bus_t *bus, uint32_t start_us) {
+    uint32_t elapsed = onewire_hal_time_us() - start_us;
+    bus->stats.slots++;
+    bus->stats.cpu_us += elapsed;
+    bus->stats.irq_off_us += elapsed;
+    if (elapsed > bus->stats.irq_off_max_us) {
+        bus->stats.irq_off_max_us = elapsed;
+    }
+}
+
+/**
+ * Initialize 1-Wire bus
+ */
+static bool onewire_gpio_init(onewire_bus_t *bus) {
+    // Initialize GPIO with pull-up
+    onewire_hal_pin_init(bus->gpio);
+
+    return true;
+}
+
+/**
+ * Send reset pulse and check for presence
+ */
+static bool onewire_gpio_reset(onewire_bus_t *bus) {
+    uint32_t start_us = onewire_hal_time_us();
+    uint32_t ints = onewire_hal_irq_disable();
+
+    // Reset pulse
+    onewire_hal_drive_low(bus->gpio);
+    onewire_hal_delay_us(ONEWIRE_RESET_PULSE);
+
+    // Release and wait for presence
+    onewire_hal_release(bus->gpio);
+    onewire_hal_delay_us(ONEWIRE_PRESENCE_WAIT);
+
+    // Check for presence pulse
+    bool presence = !onewire_hal_sample(bus->gpio);
+
+    // Wait for presence to end
+    onewire_hal_delay_us(ONEWIRE_PRESENCE_READ);
+
+    onewire_hal_irq_restore(ints);
+    onewire_account_slot(bus, start_us);
+
+    return presence;
+}
+
+/**
+ * Write a single bit
+ */
+static void onewire_gpio_write_bit(onewire_bus_t *bus, bool bit) {
+    uint32_t start_us = onewire_hal_time_us();
+    uint32_t ints = onewire_hal_irq_disable();
+
+    if (bit) {
+        // Write 1: short low pulse
+        onewire_hal_drive_low(bus->gpio);
+        onewire_hal_delay_us(ONEWIRE_WRITE_1_LOW);
+        onewire_hal_release(bus->gpio);
+        onewire_hal_delay_us(ONEWIRE_WRITE_1_HIGH);
+    } else {
+        // Write 0: long low pulse
+        onewire_hal_drive_low(bus->gpio);
+        onewire_hal_delay_us(ONEWIRE_WRITE_0_LOW);
+        onewire_hal_release(bus->gpio);
+        onewire_hal_delay_us(ONEWIRE_WRITE_0_HIGH);
+    }
+
+    onewire_hal_irq_restore(ints);
+    onewire_account_slot(bus, start_us);
+}
+
+/**
+ * Read a single bit
+ */
+static bool onewire_gpio_read_bit(onewire_bus_t *bus) {
+    uint32_t start_us = onewire_hal_time_us();
+    uint32_t ints = onewire_hal_irq_disable();
+
+    // Start read slot
+    onewire_hal_drive_low(bus->gpio);
+    onewire_hal_delay_us(ONEWIRE_READ_LOW);
+
+    // Release and sample
+    onewire_hal_release(bus->gpio);
+    onewire_hal_delay_us(ONEWIRE_READ_SAMPLE);
+    bool bit = onewire_hal_sample(bus->gpio);
+
+    // Complete read slot
+    onewire_hal_delay_us(ONEWIRE_READ_HIGH);
+
+    onewire_hal_irq_restore(ints);
+    onewire_account_slot(bus, start_us);
+
+    return bit;
+}
+
+/**
+ * Write bytes
+ */
+static void onewire_gpio_write_bytes(onewire_bus_t *bus, const uint8_t *data, size_t len) {
+    for (size_t n = 0; n < len; n++) {
+        for (int i = 0; i < 8; i++) {
+            onewire_gpio_write_bit(bus, data[n] & (1 << i));
+        }
+    }
+}
+
+/**
+ * Read bytes
+ */
+static void onewire_gpio_read_bytes(onewire_bus_t *bus, uint8_t *data, size_t len) {
+    for (size_t n = 0; n < len; n++) {
+        uint8_t byte = 0;
+        for (int i = 0; i < 8; i++) {
+            if (onewire_gpio_read_bit(bus)) {
+                byte |= (1 << i);
+            }
+        }
+        data[n] = byte;
+    }
+}
+
+const onewire_backend_t onewire_gpio_backend = {
+    .name = "gpio",
+    .init = onewire_gpio_init,
+    .reset = onewire_gpio_reset,
+    .write_bit = onewire_gpio_write_bit,
+    .read_bit = onewire_gpio_read_bit,
+    .write_bytes = onewire_gpio_write_bytes,
+    .read_bytes = onewire_gpio_read_bytes,
+};
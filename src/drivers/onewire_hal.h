@@ -0,0 +1,72 @@
+/**
+ * 1-Wire Hardware Abstraction Layer
+ * Line and timing primitives used by the bit-banged 1-Wire backend and the
+ * DS18B20 driver, so both build and run without a board.
+ *
+ * Implementations are selected at link time:
+ * - onewire_hal_pico.c: GPIO, timer and interrupt control of the RP2040
+ * - onewire_hal_sim.c:  simulated bus with DS18B20 devices in virtual time
+ *
+ * Copyright (c) 2024 Peter Westlund
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef ONEWIRE_HAL_H
+#define ONEWIRE_HAL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Configure a pin as released bus line with pull-up
+ */
+void onewire_hal_pin_init(unsigned int gpio);
+
+/**
+ * Pull the bus line low
+ */
+void onewire_hal_drive_low(unsigned int gpio);
+
+/**
+ * Release the bus line to the pull-up
+ */
+void onewire_hal_release(unsigned int gpio);
+
+/**
+ * Sample the bus line level
+ *
+ * @return true if the line is high
+ */
+bool onewire_hal_sample(unsigned int gpio);
+
+/**
+ * Busy-wait for a number of microseconds
+ */
+void onewire_hal_delay_us(uint32_t us);
+
+/**
+ * Get a free-running microsecond timestamp
+ */
+uint32_t onewire_hal_time_us(void);
+
+/**
+ * Disable interrupts for a timing-critical slot
+ *
+ * @return State to pass to onewire_hal_irq_restore()
+ */
+uint32_t onewire_hal_irq_disable(void);
+
+/**
+ * Restore interrupts disabled by onewire_hal_irq_disable()
+ */
+void onewire_hal_irq_restore(uint32_t state);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // ONEWIRE_HAL_H
@@ -0,0 +1,47 @@
+/**
+ * 1-Wire Hardware Abstraction Layer - RP2040 implementation
+ *
+ * Copyright (c) 2024 Peter Westlund
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "onewire_hal.h"
+#include "pico/stdlib.h"
+#include "hardware/gpio.h"
+#include "hardware/sync.h"
+#include "pico/time.h"
+
+void onewire_hal_pin_init(unsigned int gpio) {
+    gpio_init(gpio);
+    gpio_set_dir(gpio, GPIO_IN);
+    gpio_pull_up(gpio);
+}
+
+void onewire_hal_drive_low(unsigned int gpio) {
+    gpio_set_dir(gpio, GPIO_OUT);
+    gpio_put(gpio, 0);
+}
+
+void onewire_hal_release(unsigned int gpio) {
+    gpio_set_dir(gpio, GPIO_IN);
+}
+
+bool onewire_hal_sample(unsigned int gpio) {
+    return gpio_get(gpio);
+}
+
+void onewire_hal_delay_us(uint32_t us) {
+    busy_wait_us_32(us);
+}
+
+uint32_t onewire_hal_time_us(void) {
+    return time_us_32();
+}
+
+uint32_t onewire_hal_irq_disable(void) {
+    return save_and_disable_interrupts();
+}
+
+void onewire_hal_irq_restore(uint32_t state) {
+    restore_interrupts(state);
+}
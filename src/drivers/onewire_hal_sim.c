@@ -0,0 +1,449 @@
+/**
+ * 1-Wire Hardware Abstraction Layer - simulated bus for host builds
+ * See onewire_sim.h for the device model.
+ *
+ * Copyright (c) 2024 Peter Westlund
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "onewire_hal.h"
+#include "onewire_sim.h"
+#include "onewire.h"
+#include <string.h>
+
+// Bus timing as seen by the devices (microseconds)
+#define SIM_RESET_MIN_US 480       // Shortest low time recognised as reset
+#define SIM_WRITE_0_MIN_US 15      // Low time beyond which a slot writes 0
+#define SIM_PRESENCE_DELAY_US 30   // Presence pulse starts after the reset ends
+#define SIM_PRESENCE_US 120        // Presence pulse length
+#define SIM_READ_HOLD_US 30        // Devices hold a 0 this long after the falling edge
+#define SIM_SLOT_US 60             // Slot length, for error injection
+
+// DS18B20 commands
+#define SIM_CMD_SEARCH_ROM 0xF0
+#define SIM_CMD_READ_ROM 0x33
+#define SIM_CMD_MATCH_ROM 0x55
+#define SIM_CMD_SKIP_ROM 0xCC
+#define SIM_CMD_CONVERT_T 0x44
+#define SIM_CMD_READ_SCRATCHPAD 0xBE
+#define SIM_CMD_WRITE_SCRATCHPAD 0x4E
+#define SIM_CMD_COPY_SCRATCHPAD 0x48
+
+#define SIM_DS18B20_FAMILY 0x28
+#define SIM_MAX_GPIO 32
+
+/**
+ * Protocol state of a device between two slots
+ */
+typedef enum {
+    SIM_IDLE,         // Waiting for a reset
+    SIM_ROM_COMMAND,  // Receiving a ROM command
+    SIM_SEARCH,       // SEARCH ROM: bit, complement, direction per ROM bit
+    SIM_MATCH,        // MATCH ROM: receiving the ROM code
+    SIM_FUNCTION,     // Selected, receiving a function command
+    SIM_TRANSMIT,     // Sending buf, then ones
+    SIM_RECEIVE,      // Receiving WRITE SCRATCHPAD data into buf
+    SIM_CONVERTING,   // Read slots return 0 until the conversion is done
+} sim_state_t;
+
+typedef struct {
+    unsigned int gpio;
+    uint8_t rom[8];
+    uint8_t scratchpad[9];
+    uint8_t eeprom[3]; // TH, TL, configuration
+    float temperature_c;
+    bool converting;
+    uint64_t conversion_done_us;
+
+    sim_state_t state;
+    int bit;     // Bit position within the current state
+    int len;     // Bytes to send or receive in buf
+    uint8_t buf[9];
+} sim_device_t;
+
+typedef struct {
+    bool low;              // Master is driving the line low
+    uint64_t fall_us;      // Start of the current low period
+    bool slot_low;         // A device pulls the line low during this slot
+    uint64_t presence_start_us;
+    uint64_t presence_end_us;
+} sim_line_t;
+
+static sim_device_t sim_devices[ONEWIRE_SIM_MAX_DEVICES];
+static int sim_device_count;
+static sim_line_t sim_lines[SIM_MAX_GPIO];
+static uint64_t sim_now_us;
+
+static double sim_error_rate;
+static uint32_t sim_rng_state = 1;
+static uint32_t sim_errors;
+
+/**
+ * xorshift32, deterministic for a given seed
+ */
+static uint32_t sim_random(void) {
+    uint32_t x = sim_rng_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    sim_rng_state = x;
+    return x;
+}
+
+static bool sim_bit(const uint8_t *data, int bit) {
+    return (data[bit / 8] >> (bit % 8)) & 1;
+}
+
+static int sim_resolution(const sim_device_t *dev) {
+    return 9 + ((dev->scratchpad[4] >> 5) & 3);
+}
+
+static uint32_t sim_conversion_us(const sim_device_t *dev) {
+    return 750000u >> (12 - sim_resolution(dev));
+}
+
+/**
+ * Latch a finished conversion into the temperature register
+ * The bits below the resolution are left as measured, as the datasheet
+ * declares them undefined.
+ */
+static void sim_update_conversion(sim_device_t *dev) {
+    if (!dev->converting || sim_now_us < dev->conversion_done_us) {
+        return;
+    }
+    dev->converting = false;
+
+    float scaled = dev->temperature_c * 16.0f;
+    int16_t raw = (int16_t) (scaled < 0 ? scaled - 0.5f : scaled + 0.5f);
+    dev->scratchpad[0] = (uint8_t) raw;
+    dev->scratchpad[1] = (uint8_t) ((uint16_t) raw >> 8);
+    dev->scratchpad[8] = onewire_crc8(dev->scratchpad, 8);
+}
+
+static void sim_transmit(sim_device_t *dev, const uint8_t *data, int len) {
+    memcpy(dev->buf, data, len);
+    dev->len = len;
+    dev->bit = 0;
+    dev->state = SIM_TRANSMIT;
+}
+
+/**
+ * Level a device drives during the slot starting now (true = released)
+ */
+static bool sim_device_output(sim_device_t *dev) {
+    switch (dev->state) {
+        case SIM_SEARCH: {
+            int rom_bit = dev->bit / 3;
+            bool value = sim_bit(dev->rom, rom_bit);
+            switch (dev->bit % 3) {
+                case 0:
+                    return value;
+                case 1:
+                    return !value;
+                default:
+                    return true;
+            }
+        }
+        case SIM_TRANSMIT:
+            return dev->bit >= dev->len * 8 || sim_bit(dev->buf, dev->bit);
+        case SIM_CONVERTING:
+            sim_update_conversion(dev);
+            return !dev->converting;
+        default:
+            return true;
+    }
+}
+
+/**
+ * Act on a completed function command byte
+ */
+static void sim_function_command(sim_device_t *dev, uint8_t command) {
+    if (dev->rom[0] != SIM_DS18B20_FAMILY) {
+        dev->state = SIM_IDLE;
+        return;
+    }
+
+    switch (command) {
+        case SIM_CMD_CONVERT_T:
+            dev->converting = true;
+            dev->conversion_done_us = sim_now_us + sim_conversion_us(dev);
+            dev->state = SIM_CONVERTING;
+            break;
+        case SIM_CMD_READ_SCRATCHPAD:
+            sim_update_conversion(dev);
+            sim_transmit(dev, dev->scratchpad, sizeof(dev->scratchpad));
+            break;
+        case SIM_CMD_WRITE_SCRATCHPAD:
+            dev->state = SIM_RECEIVE;
+            dev->len = 3;
+            dev->bit = 0;
+            break;
+        case SIM_CMD_COPY_SCRATCHPAD:
+            memcpy(dev->eeprom, &dev->scratchpad[2], sizeof(dev->eeprom));
+            dev->state = SIM_IDLE;
+            break;
+        default:
+            dev->state = SIM_IDLE;
+            break;
+    }
+}
+
+/**
+ * Receive one bit into buf; returns true once len bytes are complete
+ */
+static bool sim_receive_bit(sim_device_t *dev, bool bit) {
+    if (dev->bit == 0) {
+        memset(dev->buf, 0, sizeof(dev->buf));
+    }
+    if (bit) {
+        dev->buf[dev->bit / 8] |= 1 << (dev->bit % 8);
+    }
+    dev->bit++;
+    return dev->bit == dev->len * 8;
+}
+
+/**
+ * Advance a device's state machine by one completed slot
+ */
+static void sim_device_slot(sim_device_t *dev, bool master_bit) {
+    switch (dev->state) {
+        case SIM_ROM_COMMAND:
+            if (!sim_receive_bit(dev, master_bit)) {
+                break;
+            }
+            dev->bit = 0;
+            switch (dev->buf[0]) {
+                case SIM_CMD_SEARCH_ROM:
+                    dev->state = SIM_SEARCH;
+                    break;
+                case SIM_CMD_MATCH_ROM:
+                    dev->state = SIM_MATCH;
+                    dev->len = sizeof(dev->rom);
+                    break;
+                case SIM_CMD_SKIP_ROM:
+                    dev->state = SIM_FUNCTION;
+                    dev->len = 1;
+                    break;
+                case SIM_CMD_READ_ROM:
+                    sim_transmit(dev, dev->rom, sizeof(dev->rom));
+                    break;
+                default:
+                    dev->state = SIM_IDLE;
+                    break;
+            }
+            break;
+
+        case SIM_SEARCH:
+            if (dev->bit % 3 == 2 && master_bit != sim_bit(dev->rom, dev->bit / 3)) {
+                // Master took the other branch
+                dev->state = SIM_IDLE;
+                break;
+            }
+            if (++dev->bit == 64 * 3) {
+                dev->state = SIM_FUNCTION;
+                dev->bit = 0;
+                dev->len = 1;
+            }
+            break;
+
+        case SIM_MATCH:
+            if (master_bit != sim_bit(dev->rom, dev->bit)) {
+                dev->state = SIM_IDLE;
+                break;
+            }
+            if (sim_receive_bit(dev, master_bit)) {
+                dev->state = SIM_FUNCTION;
+                dev->bit = 0;
+                dev->len = 1;
+            }
+            break;
+
+        case SIM_FUNCTION:
+            if (sim_receive_bit(dev, master_bit)) {
+                sim_function_command(dev, dev->buf[0]);
+            }
+            break;
+
+        case SIM_RECEIVE:
+            if (sim_receive_bit(dev, master_bit)) {
+                memcpy(&dev->scratchpad[2], dev->buf, 3);
+                // Configuration register bits 0-4 read as 1, bit 7 as 0
+                dev->scratchpad[4] = (dev->scratchpad[4] & 0x60) | 0x1F;
+                dev->scratchpad[8] = onewire_crc8(dev->scratchpad, 8);
+                dev->state = SIM_IDLE;
+            }
+            break;
+
+        case SIM_TRANSMIT:
+            if (dev->bit < dev->len * 8) {
+                dev->bit++;
+            }
+            break;
+
+        default:
+            break;
+    }
+}
+
+/**
+ * Master released the line: decode the low period as reset or slot
+ */
+static void sim_line_released(unsigned int gpio, sim_line_t *line) {
+    uint64_t low_us = sim_now_us - line->fall_us;
+
+    if (low_us >= SIM_RESET_MIN_US) {
+        bool present = false;
+        for (int i = 0; i < sim_device_count; i++) {
+            sim_device_t *dev = &sim_devices[i];
+            if (dev->gpio == gpio) {
+                sim_update_conversion(dev);
+                dev->state = SIM_ROM_COMMAND;
+                dev->bit = 0;
+                dev->len = 1;
+                present = true;
+            }
+        }
+        if (present) {
+            line->presence_start_us = sim_now_us + SIM_PRESENCE_DELAY_US;
+            line->presence_end_us = line->presence_start_us + SIM_PRESENCE_US;
+        }
+        return;
+    }
+
+    bool master_bit = low_us < SIM_WRITE_0_MIN_US;
+    for (int i = 0; i < sim_device_count; i++) {
+        if (sim_devices[i].gpio == gpio) {
+            sim_device_slot(&sim_devices[i], master_bit);
+        }
+    }
+}
+
+void onewire_sim_reset(void) {
+    memset(sim_devices, 0, sizeof(sim_devices));
+    memset(sim_lines, 0, sizeof(sim_lines));
+    sim_device_count = 0;
+    sim_now_us = 0;
+    sim_error_rate = 0;
+    sim_rng_state = 1;
+    sim_errors = 0;
+}
+
+int onewire_sim_add_device(unsigned int gpio, uint8_t family, uint64_t serial) {
+    if (sim_device_count >= ONEWIRE_SIM_MAX_DEVICES || gpio >= SIM_MAX_GPIO) {
+        return -1;
+    }
+
+    sim_device_t *dev = &sim_devices[sim_device_count];
+    memset(dev, 0, sizeof(*dev));
+    dev->gpio = gpio;
+    dev->rom[0] = family;
+    for (int i = 0; i < 6; i++) {
+        dev->rom[1 + i] = (uint8_t) (serial >> (8 * i));
+    }
+    dev->rom[7] = onewire_crc8(dev->rom, 7);
+
+    // Power-on state: 85°C in the temperature register, 12-bit default in EEPROM
+    const uint8_t power_on[9] = {0x50, 0x05, 0x4B, 0x46, 0x7F, 0xFF, 0x0C, 0x10, 0x00};
+    memcpy(dev->scratchpad, power_on, sizeof(power_on));
+    memcpy(dev->eeprom, &power_on[2], sizeof(dev->eeprom));
+    dev->scratchpad[8] = onewire_crc8(dev->scratchpad, 8);
+    dev->temperature_c = 20.0f;
+    dev->state = SIM_IDLE;
+
+    return sim_device_count++;
+}
+
+void onewire_sim_get_rom(int device, uint8_t rom[8]) {
+    memcpy(rom, sim_devices[device].rom, sizeof(sim_devices[device].rom));
+}
+
+void onewire_sim_set_temperature(int device, float celsius) {
+    sim_devices[device].temperature_c = celsius;
+}
+
+int onewire_sim_get_eeprom_resolution(int device) {
+    return 9 + ((sim_devices[device].eeprom[2] >> 5) & 3);
+}
+
+void onewire_sim_set_read_error_rate(double probability, uint32_t seed) {
+    sim_error_rate = probability;
+    sim_rng_state = seed ? seed : 1;
+}
+
+uint32_t onewire_sim_injected_errors(void) {
+    return sim_errors;
+}
+
+uint64_t onewire_sim_time_us(void) {
+    return sim_now_us;
+}
+
+void onewire_hal_pin_init(unsigned int gpio) {
+    if (gpio < SIM_MAX_GPIO) {
+        sim_lines[gpio] = (sim_line_t){0};
+    }
+}
+
+void onewire_hal_drive_low(unsigned int gpio) {
+    sim_line_t *line = &sim_lines[gpio % SIM_MAX_GPIO];
+    if (line->low) {
+        return;
+    }
+    line->low = true;
+    line->fall_us = sim_now_us;
+
+    // Devices decide what to put on the line at the falling edge
+    line->slot_low = false;
+    for (int i = 0; i < sim_device_count; i++) {
+        if (sim_devices[i].gpio == gpio && !sim_device_output(&sim_devices[i])) {
+            line->slot_low = true;
+        }
+    }
+}
+
+void onewire_hal_release(unsigned int gpio) {
+    sim_line_t *line = &sim_lines[gpio % SIM_MAX_GPIO];
+    if (!line->low) {
+        return;
+    }
+    line->low = false;
+    sim_line_released(gpio, line);
+}
+
+bool onewire_hal_sample(unsigned int gpio) {
+    sim_line_t *line = &sim_lines[gpio % SIM_MAX_GPIO];
+    if (line->low) {
+        return false;
+    }
+    if (sim_now_us >= line->presence_start_us && sim_now_us < line->presence_end_us) {
+        return false;
+    }
+
+    uint64_t since_fall = sim_now_us - line->fall_us;
+    if (since_fall >= SIM_SLOT_US) {
+        return true;
+    }
+
+    bool level = !(line->slot_low && since_fall < SIM_READ_HOLD_US);
+    if (sim_error_rate > 0 && sim_random() < sim_error_rate * 4294967296.0) {
+        sim_errors++;
+        level = !level;
+    }
+    return level;
+}
+
+void onewire_hal_delay_us(uint32_t us) {
+    sim_now_us += us;
+}
+
+uint32_t onewire_hal_time_us(void) {
+    return (uint32_t) sim_now_us;
+}
+
+uint32_t onewire_hal_irq_disable(void) {
+    return 0;
+}
+
+void onewire_hal_irq_restore(uint32_t state) {
+    (void) state;
+}
@@ -0,0 +1,205 @@
+/**
+ * 1-Wire Bus Layer - PIO backend
+ * Slots are generated by a PIO state machine (see onewire.pio); the CPU only
+ * feeds and drains the FIFOs, with interrupts left enabled throughout.
+ *
+ * Copyright (c) 2024 Peter Westlund
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "onewire.h"
+#include "pico/stdlib.h"
+#include "hardware/gpio.h"
+#include "hardware/pio.h"
+#include "hardware/clocks.h"
+#include "onewire.pio.h"
+
+// Program offset per PIO block, -1 until loaded; the program is shared by all buses on a block
+static int onewire_program_offset[NUM_PIOS];
+static bool onewire_program_offset_valid = false;
+
+/**
+ * Set autopull/autopush thresholds (1 for single bits, 8 for bytes)
+ * Only called while the state machine is stalled waiting for data.
+ */
+static void onewire_set_bits_per_word(onewire_bus_t *bus, uint bits) {
+    io_rw_32 *shiftctrl = &pio_get_instance(bus->pio_index)->sm[bus->sm].shiftctrl;
+    *shiftctrl = (*shiftctrl & ~(PIO_SM0_SHIFTCTRL_PULL_THRESH_BITS |
+                                 PIO_SM0_SHIFTCTRL_PUSH_THRESH_BITS)) |
+                 ((bits & 0x1f) << PIO_SM0_SHIFTCTRL_PULL_THRESH_LSB) |
+                 ((bits & 0x1f) << PIO_SM0_SHIFTCTRL_PUSH_THRESH_LSB);
+}
+
+/**
+ * Wait until the state machine has finished the current slot and is idle
+ */
+static void onewire_wait_idle(onewire_bus_t *bus) {
+    PIO pio = pio_get_instance(bus->pio_index);
+    uint32_t stall_mask = 1u << (PIO_FDEBUG_TXSTALL_LSB + bus->sm);
+    pio->fdebug = stall_mask;
+    while (!(pio->fdebug & stall_mask)) {
+        tight_loop_contents();
+    }
+}
+
+/**
+ * Shift words through the state machine, one word per slot group
+ * Each word written produces exactly one word in the RX FIFO.
+ */
+static void onewire_transfer(onewire_bus_t *bus, const uint8_t *tx, uint8_t *rx, size_t len,
+                             uint shift) {
+    PIO pio = pio_get_instance(bus->pio_index);
+    uint32_t start_us = time_us_32();
+    size_t sent = 0;
+    size_t received = 0;
+
+    while (received < len) {
+        if (sent < len && !pio_sm_is_tx_fifo_full(pio, bus->sm)) {
+            pio_sm_put(pio, bus->sm, tx ? tx[sent] : 0xff);
+            sent++;
+        }
+        if (!pio_sm_is_rx_fifo_empty(pio, bus->sm)) {
+            uint8_t value = pio_sm_get(pio, bus->sm) >> shift;
+            if (rx) {
+                rx[received] = value;
+            }
+            received++;
+        }
+    }
+
+    bus->stats.slots += len * (shift == 24 ? 8 : 1);
+    bus->stats.cpu_us += time_us_32() - start_us;
+}
+
+/**
+ * Initialize 1-Wire bus on the first PIO block with a free state machine
+ */
+static bool onewire_pio_init(onewire_bus_t *bus) {
+    unsigned int gpio_pin = bus->gpio;
+    if (!onewire_program_offset_valid) {
+        for (uint i = 0; i < NUM_PIOS; i++) {
+            onewire_program_offset[i] = -1;
+        }
+        onewire_program_offset_valid = true;
+    }
+
+    PIO pio = NULL;
+    int sm = -1;
+    for (uint i = 0; i < NUM_PIOS && sm < 0; i++) {
+        pio = pio_get_instance(i);
+        if (onewire_program_offset[i] < 0) {
+            if (!pio_can_add_program(pio, &onewire_program)) {
+                continue;
+            }
+            onewire_program_offset[i] = pio_add_program(pio, &onewire_program);
+        }
+        sm = pio_claim_unused_sm(pio, false);
+        bus->pio_index = i;
+    }
+    if (sm < 0) {
+        return false;
+    }
+    bus->sm = (uint8_t) sm;
+    bus->offset = (uint8_t) onewire_program_offset[bus->pio_index];
+
+    // Output value stays 0; side-set toggles the direction to pull the bus low
+    pio_gpio_init(pio, gpio_pin);
+    gpio_pull_up(gpio_pin);
+    pio_sm_set_pins_with_mask(pio, bus->sm, 0, 1u << gpio_pin);
+    pio_sm_set_pindirs_with_mask(pio, bus->sm, 0, 1u << gpio_pin);
+
+    pio_sm_config c = onewire_program_get_default_config(bus->offset);
+    sm_config_set_in_pins(&c, gpio_pin);
+    sm_config_set_sideset_pins(&c, gpio_pin);
+    sm_config_set_out_shift(&c, true, true, 8);
+    sm_config_set_in_shift(&c, true, true, 8);
+    sm_config_set_clkdiv(&c, (float) clock_get_hz(clk_sys) / 1000000.0f);
+
+    pio_sm_init(pio, bus->sm, bus->offset + onewire_offset_bit_loop, &c);
+    pio_sm_set_enabled(pio, bus->sm, true);
+
+    return true;
+}
+
+/**
+ * Stop the state machine and hand the pin back; the program stays loaded for later buses
+ */
+static void onewire_pio_deinit(onewire_bus_t *bus) {
+    PIO pio = pio_get_instance(bus->pio_index);
+    pio_sm_set_enabled(pio, bus->sm, false);
+    pio_sm_unclaim(pio, bus->sm);
+    gpio_init(bus->gpio);
+    gpio_pull_up(bus->gpio);
+}
+
+/**
+ * Send reset pulse and check for presence
+ */
+static bool onewire_pio_reset(onewire_bus_t *bus) {
+    PIO pio = pio_get_instance(bus->pio_index);
+    uint32_t start_us = time_us_32();
+
+    onewire_wait_idle(bus);
+    pio_sm_exec(pio, bus->sm, pio_encode_jmp(bus->offset + onewire_offset_reset_bus));
+
+    // Presence sample arrives in bit 31; the bus is pulled low when present
+    bool presence = !(pio_sm_get_blocking(pio, bus->sm) >> 31);
+
+    // Let the recovery period finish before the next slot is queued
+    onewire_wait_idle(bus);
+
+    bus->stats.slots++;
+    bus->stats.cpu_us += time_us_32() - start_us;
+
+    return presence;
+}
+
+/**
+ * Write a single bit
+ */
+static void onewire_pio_write_bit(onewire_bus_t *bus, bool bit) {
+    uint8_t value = bit ? 1 : 0;
+    onewire_wait_idle(bus);
+    onewire_set_bits_per_word(bus, 1);
+    onewire_transfer(bus, &value, NULL, 1, 31);
+    onewire_wait_idle(bus);
+    onewire_set_bits_per_word(bus, 8);
+}
+
+/**
+ * Read a single bit
+ */
+static bool onewire_pio_read_bit(onewire_bus_t *bus) {
+    uint8_t value;
+    onewire_wait_idle(bus);
+    onewire_set_bits_per_word(bus, 1);
+    onewire_transfer(bus, NULL, &value, 1, 31);
+    onewire_wait_idle(bus);
+    onewire_set_bits_per_word(bus, 8);
+    return value & 1;
+}
+
+/**
+ * Write bytes
+ */
+static void onewire_pio_write_bytes(onewire_bus_t *bus, const uint8_t *data, size_t len) {
+    onewire_transfer(bus, data, NULL, len, 24);
+}
+
+/**
+ * Read bytes
+ */
+static void onewire_pio_read_bytes(onewire_bus_t *bus, uint8_t *data, size_t len) {
+    onewire_transfer(bus, NULL, data, len, 24);
+}
+
+const onewire_backend_t onewire_pio_backend = {
+    .name = "pio",
+    .init = onewire_pio_init,
+    .deinit = onewire_pio_deinit,
+    .reset = onewire_pio_reset,
+    .write_bit = onewire_pio_write_bit,
+    .read_bit = onewire_pio_read_bit,
+    .write_bytes = onewire_pio_write_bytes,
+    .read_bytes = onewire_pio_read_bytes,
+};
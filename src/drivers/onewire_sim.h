@@ -0,0 +1,84 @@
+/**
+ * Simulated 1-Wire bus for host builds
+ * Implements onewire_hal.h on top of a model of DS18B20 devices, so the
+ * bit-banged backend and the DS18B20 driver run unmodified on a Linux host.
+ *
+ * The model follows the bus line slot by slot in virtual time: delays advance
+ * a simulated clock instead of sleeping, so bus time per reading can be
+ * measured exactly and conversion waits cost nothing. Devices answer reset
+ * with a presence pulse and implement SEARCH/MATCH/SKIP/READ ROM, CONVERT T,
+ * READ/WRITE/COPY SCRATCHPAD with the datasheet conversion times.
+ *
+ * Copyright (c) 2024 Peter Westlund
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef ONEWIRE_SIM_H
+#define ONEWIRE_SIM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Maximum number of simulated devices across all buses
+#define ONEWIRE_SIM_MAX_DEVICES 32
+
+/**
+ * Remove all devices, clear error injection and restart the clock at zero
+ */
+void onewire_sim_reset(void);
+
+/**
+ * Attach a device to the bus on a GPIO pin
+ * The ROM code is built from the family code and serial number with a valid CRC.
+ * Devices of any family answer ROM commands; only family 0x28 answers DS18B20
+ * function commands.
+ *
+ * @param gpio Bus the device is attached to
+ * @param family Family code (0x28 for DS18B20)
+ * @param serial 48-bit serial number
+ * @return Device handle, or -1 if the device table is full
+ */
+int onewire_sim_add_device(unsigned int gpio, uint8_t family, uint64_t serial);
+
+/**
+ * Get the ROM code of a simulated device
+ */
+void onewire_sim_get_rom(int device, uint8_t rom[8]);
+
+/**
+ * Set the temperature a device measures at its next conversion
+ */
+void onewire_sim_set_temperature(int device, float celsius);
+
+/**
+ * Get the resolution stored in a device's EEPROM (9-12 bits)
+ */
+int onewire_sim_get_eeprom_resolution(int device);
+
+/**
+ * Flip bits read by the master with the given probability
+ *
+ * @param probability Chance per read slot, 0 to disable
+ * @param seed Seed for the deterministic error pattern
+ */
+void onewire_sim_set_read_error_rate(double probability, uint32_t seed);
+
+/**
+ * Get the number of read slots corrupted so far
+ */
+uint32_t onewire_sim_injected_errors(void);
+
+/**
+ * Get the simulated time in microseconds since onewire_sim_reset()
+ */
+uint64_t onewire_sim_time_us(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // ONEWIRE_SIM_H
@@ -9,7 +9,10 @@
 #include <string.h>
 #include "pico/stdlib.h"
 #include "pico/cyw43_arch.h"
+#include "hardware/structs/systick.h"
 #include "ds18b20.h"
+#include "onewire.h"
+#include "fixed_format.h"
 
 // DS18B20 GPIO pin - configurable via CMake DS18B20_GPIO_PIN
 #ifndef DS18B20_GPIO_PIN
@@ -17,6 +20,140 @@
 #endif
 #define DS18B20_GPIO DS18B20_GPIO_PIN
 
+// DS18B20 resolution - configurable via CMake DS18B20_RESOLUTION
+#ifndef DS18B20_RESOLUTION
+#define DS18B20_RESOLUTION 12
+#endif
+
+static ds18b20_bus_t ds18b20_bus;
+
+// Raw readings used to compare the float and fixed-point temperature paths
+#define BENCH_SAMPLES 64
+
+// Readings per 1-Wire backend in the backend comparison
+#define BENCH_READINGS 8
+
+/**
+ * Count core clock cycles with SysTick (24-bit down-counter)
+ */
+static inline uint32_t cycles_now(void) {
+    return systick_hw->cvr;
+}
+
+static inline uint32_t cycles_since(uint32_t start) {
+    return (start - systick_hw->cvr) & 0x00FFFFFF;
+}
+
+/**
+ * Benchmark raw reading to payload text: soft-float and %.2f versus centi-degrees
+ * and fixed_format_centi(). Reports cycles per sample for each path.
+ */
+static void benchmark_temperature_paths(void) {
+    int16_t raws[BENCH_SAMPLES];
+    for (int i = 0; i < BENCH_SAMPLES; i++) {
+        raws[i] = (int16_t) (-880 + i * 29); // -55°C upwards in 1.8125°C steps
+    }
+    char buf[FIXED_FORMAT_CENTI_LEN];
+    volatile char sink = 0;
+
+    systick_hw->rvr = 0x00FFFFFF;
+    systick_hw->cvr = 0;
+    systick_hw->csr = 0x5; // Enable, processor clock
+
+    uint32_t start = cycles_now();
+    for (int i = 0; i < BENCH_SAMPLES; i++) {
+        float temperature_c = raws[i] / 16.0f;
+        snprintf(buf, sizeof(buf), "%.2f", temperature_c);
+        sink ^= buf[0];
+    }
+    uint32_t float_cycles = cycles_since(start);
+
+    start = cycles_now();
+    for (int i = 0; i < BENCH_SAMPLES; i++) {
+        int32_t scaled = raws[i] * 25;
+        int32_t centi_c = (scaled >= 0 ? scaled + 2 : scaled - 2) / 4;
+        fixed_format_centi(centi_c, buf, sizeof(buf));
+        sink ^= buf[0];
+    }
+    uint32_t fixed_cycles = cycles_since(start);
+
+    printf("Temperature path: float %lu cycles/sample, fixed-point %lu cycles/sample\n",
+           (unsigned long) (float_cycles / BENCH_SAMPLES),
+           (unsigned long) (fixed_cycles / BENCH_SAMPLES));
+    (void) sink;
+}
+
+/**
+ * Totals of one backend over BENCH_READINGS readings
+ */
+typedef struct {
+    int ok;
+    int32_t last_centi_c;
+    onewire_stats_t stats; // Summed, apart from irq_off_max_us
+} backend_bench_t;
+
+/**
+ * Take BENCH_READINGS readings of the first probe with one backend, then release the pin
+ */
+static bool benchmark_backend(const onewire_backend_t *backend, backend_bench_t *bench) {
+    static ds18b20_bus_t bus;
+    *bench = (backend_bench_t){0};
+    if (ds18b20_init_backend(&bus, DS18B20_GPIO, backend) != DS18B20_OK) {
+        onewire_deinit(&bus.onewire);
+        return false;
+    }
+    for (int i = 0; i < BENCH_READINGS; i++) {
+        onewire_stats_t stats;
+        onewire_reset_stats(&bus.onewire);
+        ds18b20_result_t result = ds18b20_start_conversion(&bus);
+        if (result == DS18B20_OK) {
+            busy_wait_us(ds18b20_conversion_time_ms(&bus) * 1000);
+            result = ds18b20_read_result(&bus, &bench->last_centi_c);
+        }
+        onewire_get_stats(&bus.onewire, &stats);
+        bench->ok += result == DS18B20_OK;
+        bench->stats.slots += stats.slots;
+        bench->stats.cpu_us += stats.cpu_us;
+        bench->stats.irq_off_us += stats.irq_off_us;
+        if (stats.irq_off_max_us > bench->stats.irq_off_max_us) {
+            bench->stats.irq_off_max_us = stats.irq_off_max_us;
+        }
+    }
+    onewire_deinit(&bus.onewire);
+    return true;
+}
+
+/**
+ * Compare the GPIO and PIO backends on the same probe in one image
+ * Reports bus time per reading and checks both read the same temperature.
+ */
+static void benchmark_backends(void) {
+    const onewire_backend_t *backends[] = {&onewire_gpio_backend, &onewire_pio_backend};
+    backend_bench_t bench[2];
+
+    printf("Backend comparison, %d readings each:\n", BENCH_READINGS);
+    for (int b = 0; b < 2; b++) {
+        if (!benchmark_backend(backends[b], &bench[b])) {
+            printf("  %-4s: no probe found\n", backends[b]->name);
+            return;
+        }
+        char celsius[FIXED_FORMAT_CENTI_LEN];
+        fixed_format_centi(bench[b].last_centi_c, celsius, sizeof(celsius));
+        printf("  %-4s: %d/%d ok, %s°C, per reading %lu slots, CPU %lu us, "
+               "IRQ-off %lu us (max %lu us)\n",
+               backends[b]->name, bench[b].ok, BENCH_READINGS, celsius,
+               (unsigned long) (bench[b].stats.slots / BENCH_READINGS),
+               (unsigned long) (bench[b].stats.cpu_us / BENCH_READINGS),
+               (unsigned long) (bench[b].stats.irq_off_us / BENCH_READINGS),
+               (unsigned long) bench[b].stats.irq_off_max_us);
+    }
+    // Readings a few seconds apart may differ by a step or two
+    int32_t difference = bench[0].last_centi_c - bench[1].last_centi_c;
+    if (bench[0].ok == 0 || bench[1].ok == 0 || difference > 25 || difference < -25) {
+        printf("  Warning: backends disagree\n");
+    }
+}
+
 int main() {
     // Initialize all
     stdio_init_all();
@@ -31,11 +168,15 @@ int main() {
 
     printf("DS18B20 Temperature Sensor Test\n");
     printf("================================\n");
-    printf("GPIO Pin: %d\n\n", DS18B20_GPIO);
+    printf("GPIO Pin: %d\n", DS18B20_GPIO);
+    printf("1-Wire backend: %s\n\n", ONEWIRE_DEFAULT_BACKEND.name);
+
+    benchmark_backends();
+    printf("\n");
 
     // Initialize DS18B20 sensor
     printf("Initializing DS18B20 sensor...\n");
-    ds18b20_result_t result = ds18b20_init(DS18B20_GPIO);
+    ds18b20_result_t result = ds18b20_init(&ds18b20_bus, DS18B20_GPIO);
 
     if (result != DS18B20_OK) {
         printf("Failed to initialize DS18B20: %s\n", ds18b20_error_string(result));
@@ -46,7 +187,18 @@ int main() {
         return 1;
     }
 
-    printf("DS18B20 sensor initialized successfully!\n\n");
+    printf("DS18B20 sensor initialized successfully!\n");
+    for (int i = 0; i < ds18b20_device_count(&ds18b20_bus); i++) {
+        char rom[DS18B20_ROM_SIZE * 2 + 1];
+        ds18b20_rom_string(&ds18b20_bus, i, rom, sizeof(rom));
+        if (ds18b20_set_resolution(&ds18b20_bus, i, DS18B20_RESOLUTION) != DS18B20_OK) {
+            printf("Probe %d: failed to set %d-bit resolution\n", i, DS18B20_RESOLUTION);
+        }
+        printf("Probe %d: ROM %s, %d-bit\n", i, rom, ds18b20_get_resolution(&ds18b20_bus, i));
+    }
+    printf("Conversion time: %lu ms\n", (unsigned long) ds18b20_conversion_time_ms(&ds18b20_bus));
+    benchmark_temperature_paths();
+    printf("\n");
 
     printf("Starting temperature readings...\n");
     printf("Temperature readings (Ctrl+C to stop):\n");
@@ -63,24 +215,40 @@ int main() {
         cyw43_arch_gpio_put(CYW43_WL_GPIO_LED_PIN, led_state);
         led_state = !led_state;
 
-        // Read temperature
-        float temperature_c;
-        result = ds18b20_read_temperature(&temperature_c);
+        // Read temperature, accounting bus time separately from the conversion wait
+        int32_t temperature_c;
+        onewire_stats_t bus_stats;
+        onewire_reset_stats(&ds18b20_bus.onewire);
+        result = ds18b20_start_conversion(&ds18b20_bus);
+        if (result == DS18B20_OK) {
+            busy_wait_us(ds18b20_conversion_time_ms(&ds18b20_bus) * 1000);
+            result = ds18b20_read_result(&ds18b20_bus, &temperature_c);
+        }
+        onewire_get_stats(&ds18b20_bus.onewire, &bus_stats);
 
         // Calculate elapsed time
         int64_t elapsed_us = absolute_time_diff_us(start_time, get_absolute_time());
         int elapsed_seconds = elapsed_us / 1000000;
 
         if (result == DS18B20_OK) {
-            float temperature_f = ds18b20_celsius_to_fahrenheit(temperature_c);
+            char celsius[FIXED_FORMAT_CENTI_LEN];
+            char fahrenheit[FIXED_FORMAT_CENTI_LEN];
+            fixed_format_centi(temperature_c, celsius, sizeof(celsius));
+            fixed_format_centi(ds18b20_celsius_to_fahrenheit(temperature_c), fahrenheit,
+                               sizeof(fahrenheit));
+
+            printf("%02d:%02d\t\t%s°C\t\t\t%s°F\t\tOK\n", elapsed_seconds / 60,
+                   elapsed_seconds % 60, celsius, fahrenheit);
 
-            printf("%02d:%02d\t\t%.2f°C\t\t\t%.2f°F\t\tOK\n", elapsed_seconds / 60,
-                   elapsed_seconds % 60, temperature_c, temperature_f);
+            printf("\t\tBus: %lu slots, CPU %lu us, IRQ-off %lu us (max %lu us)\n",
+                   (unsigned long) bus_stats.slots, (unsigned long) bus_stats.cpu_us,
+                   (unsigned long) bus_stats.irq_off_us, (unsigned long) bus_stats.irq_off_max_us);
 
             reading_count++;
 
             // Validate temperature range
-            if (temperature_c < -55.0f || temperature_c > 125.0f) {
+            if (temperature_c < DS18B20_TEMP_MIN_CENTI_C ||
+                temperature_c > DS18B20_TEMP_MAX_CENTI_C) {
                 printf("Warning: Temperature out of range!\n");
             }
         } else {
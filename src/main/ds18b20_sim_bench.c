@@ -0,0 +1,378 @@
+/**
+ * DS18B20 Simulator Benchmark
+ * Runs the DS18B20 driver and bit-banged 1-Wire backend against the simulated
+ * bus on a Linux host, checks the results and reports bus time per reading.
+ * Built by host/CMakeLists.txt; exits non-zero if any check fails.
+ *
+ * Copyright (c) 2024 Peter Westlund
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "ds18b20.h"
+#include "onewire.h"
+#include "onewire_hal.h"
+#include "onewire_sim.h"
+#include "host_test.h"
+
+#define BENCH_GPIO 2
+#define BENCH_PROBES 5
+#define BENCH_READINGS 200
+
+/**
+ * Bit-at-a-time Dallas/Maxim CRC8, as in Maxim AN27, to check the lookup table against
+ */
+static uint8_t crc8_bitwise(const uint8_t *data, size_t len) {
+    uint8_t crc = 0;
+    while (len--) {
+        uint8_t byte = *data++;
+        for (int bit = 0; bit < 8; bit++) {
+            uint8_t mix = (crc ^ byte) & 0x01;
+            crc >>= 1;
+            if (mix) {
+                crc ^= 0x8C;
+            }
+            byte >>= 1;
+        }
+    }
+    return crc;
+}
+
+/**
+ * CRC8 against fixed vectors
+ * The simulator computes its CRC bytes with onewire_crc8() too, so the bus tests
+ * alone would still pass with a corrupted table.
+ */
+static void test_crc_vectors(void) {
+    static const struct {
+        const char *name;
+        uint8_t data[8];
+        size_t len;
+        uint8_t crc;
+    } vectors[] = {
+        // Maxim AN27 worked example: family 02, serial 00 00 00 01 B8 1C
+        {"AN27 ROM", {0x02, 0x1C, 0xB8, 0x01, 0x00, 0x00, 0x00}, 7, 0xA2},
+        // DS18B20 power-on scratchpad, +85°C
+        {"power-on scratchpad", {0x50, 0x05, 0x4B, 0x46, 0x7F, 0xFF, 0x0C, 0x10}, 8, 0x1C},
+        // DS18B20 scratchpad at +25.0625°C
+        {"+25.0625°C scratchpad", {0x91, 0x01, 0x4B, 0x46, 0x7F, 0xFF, 0x0F, 0x10}, 8, 0x25},
+    };
+
+    for (size_t i = 0; i < sizeof(vectors) / sizeof(vectors[0]); i++) {
+        uint8_t crc = onewire_crc8(vectors[i].data, vectors[i].len);
+        CHECK(crc == vectors[i].crc, "%s: CRC 0x%02X, expected 0x%02X", vectors[i].name, crc,
+              vectors[i].crc);
+        // A block followed by its CRC byte checks to zero
+        uint8_t block[9];
+        memcpy(block, vectors[i].data, vectors[i].len);
+        block[vectors[i].len] = vectors[i].crc;
+        CHECK(onewire_crc8(block, vectors[i].len + 1) == 0, "%s: CRC over block not zero",
+              vectors[i].name);
+    }
+
+    // Every table entry, and a two-byte sequence through each
+    int mismatches = 0;
+    for (int value = 0; value < 256; value++) {
+        uint8_t data[2] = {(uint8_t) value, (uint8_t) (value * 37 + 11)};
+        mismatches += onewire_crc8(data, 1) != crc8_bitwise(data, 1);
+        mismatches += onewire_crc8(data, 2) != crc8_bitwise(data, 2);
+    }
+    CHECK(mismatches == 0, "CRC table disagrees with bitwise CRC on %d inputs", mismatches);
+    printf("CRC8: %zu fixed vectors, 256 table entries against bitwise\n",
+           sizeof(vectors) / sizeof(vectors[0]));
+}
+
+/**
+ * Temperature a probe reports at the given resolution, in hundredths of a degree
+ */
+static int32_t expected_temperature(float celsius, int bits) {
+    float scaled = celsius * 16.0f;
+    int raw = (int) (scaled < 0 ? scaled - 0.5f : scaled + 0.5f);
+    raw &= ~((1 << (12 - bits)) - 1);
+    return (raw * 25 + (raw < 0 ? -2 : 2)) / 4;
+}
+
+/**
+ * Attach probes with distinct temperatures, plus one device of another family
+ */
+static void setup_bus(unsigned int gpio, int probes, int *devices) {
+    for (int i = 0; i < probes; i++) {
+        devices[i] = onewire_sim_add_device(gpio, 0x28, 0x1000 + i * 0x35 + gpio);
+        onewire_sim_set_temperature(devices[i], -10.3f + i * 7.77f);
+    }
+    onewire_sim_add_device(gpio, 0x10, 0xBEEF);
+}
+
+/**
+ * Find the simulated device behind a probe index
+ */
+static int find_device(const ds18b20_bus_t *bus, const int *devices, int count, int index) {
+    for (int i = 0; i < count; i++) {
+        uint8_t rom[DS18B20_ROM_SIZE];
+        onewire_sim_get_rom(devices[i], rom);
+        if (memcmp(rom, bus->roms[index], DS18B20_ROM_SIZE) == 0) {
+            return devices[i];
+        }
+    }
+    return -1;
+}
+
+static void test_enumeration(void) {
+    ds18b20_bus_t bus;
+    int devices[BENCH_PROBES];
+
+    onewire_sim_reset();
+    setup_bus(BENCH_GPIO, BENCH_PROBES, devices);
+    CHECK(ds18b20_init(&bus, BENCH_GPIO) == DS18B20_OK, "init");
+    CHECK(ds18b20_device_count(&bus) == BENCH_PROBES, "found %d of %d probes",
+          ds18b20_device_count(&bus), BENCH_PROBES);
+    for (int i = 0; i < ds18b20_device_count(&bus); i++) {
+        CHECK(find_device(&bus, devices, BENCH_PROBES, i) >= 0, "probe %d has unknown ROM", i);
+    }
+
+    // An empty bus reports no device
+    CHECK(ds18b20_init(&bus, BENCH_GPIO + 1) == DS18B20_ERROR_NO_DEVICE, "empty bus");
+}
+
+/**
+ * A probe at exactly 0°C sends all-zero temperature bytes, as a bus held low would
+ */
+static void test_freezing(void) {
+    static const ds18b20_read_mode_t modes[] = {DS18B20_READ_FULL, DS18B20_READ_FAST};
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+        ds18b20_bus_t bus;
+        onewire_sim_reset();
+        int device = onewire_sim_add_device(BENCH_GPIO, 0x28, 0x1000);
+        onewire_sim_set_temperature(device, 0.0f);
+        ds18b20_init(&bus, BENCH_GPIO);
+        ds18b20_set_read_mode(&bus, modes[m]);
+
+        CHECK(ds18b20_start_conversion(&bus) == DS18B20_OK, "start conversion");
+        onewire_hal_delay_us(ds18b20_conversion_time_ms(&bus) * 1000);
+        int32_t centi_c = -1;
+        ds18b20_result_t result = ds18b20_read_device(&bus, 0, &centi_c);
+        CHECK(result == DS18B20_OK && centi_c == 0, "%s read at 0°C: %s, %ld",
+              modes[m] == DS18B20_READ_FAST ? "fast" : "full", ds18b20_error_string(result),
+              (long) centi_c);
+    }
+}
+
+/**
+ * Read all probes at one resolution and mode, returning bus time per reading
+ */
+static void bench_resolution(int bits, ds18b20_read_mode_t mode) {
+    ds18b20_bus_t bus;
+    int devices[BENCH_PROBES];
+
+    onewire_sim_reset();
+    setup_bus(BENCH_GPIO, BENCH_PROBES, devices);
+    ds18b20_init(&bus, BENCH_GPIO);
+    ds18b20_set_read_mode(&bus, mode);
+    for (int i = 0; i < ds18b20_device_count(&bus); i++) {
+        CHECK(ds18b20_set_resolution(&bus, i, bits) == DS18B20_OK, "set %d-bit", bits);
+        int device = find_device(&bus, devices, BENCH_PROBES, i);
+        CHECK(onewire_sim_get_eeprom_resolution(device) == bits, "%d-bit not stored", bits);
+    }
+
+    onewire_stats_t stats;
+    uint64_t start_us = onewire_sim_time_us();
+    onewire_reset_stats(&bus.onewire);
+    int readings = 0;
+    for (int cycle = 0; cycle < BENCH_READINGS / BENCH_PROBES; cycle++) {
+        CHECK(ds18b20_start_conversion(&bus) == DS18B20_OK, "start conversion");
+        onewire_hal_delay_us(ds18b20_conversion_time_ms(&bus) * 1000);
+        for (int i = 0; i < ds18b20_device_count(&bus); i++) {
+            int32_t centi_c;
+            ds18b20_result_t result = ds18b20_read_device(&bus, i, &centi_c);
+            int device = find_device(&bus, devices, BENCH_PROBES, i);
+            int32_t expected =
+                expected_temperature(-10.3f + (device % (BENCH_PROBES + 1)) * 7.77f, bits);
+            CHECK(result == DS18B20_OK && centi_c == expected,
+                  "%d-bit probe %d: %s, %ld instead of %ld", bits, i,
+                  ds18b20_error_string(result), (long) centi_c, (long) expected);
+            readings++;
+        }
+    }
+    onewire_get_stats(&bus.onewire, &stats);
+
+    uint64_t elapsed_us = onewire_sim_time_us() - start_us;
+    printf("%2d-bit  %-4s  %6lu us  %5lu slots  %7.1f ms\n", bits,
+           mode == DS18B20_READ_FAST ? "fast" : "full", (unsigned long) (stats.cpu_us / readings),
+           (unsigned long) (stats.slots / readings),
+           elapsed_us / 1000.0 / (BENCH_READINGS / BENCH_PROBES));
+}
+
+/**
+ * Read through injected bit errors; full reads must never return a wrong value
+ */
+static void test_bit_errors(double rate) {
+    ds18b20_bus_t bus;
+    int devices[BENCH_PROBES];
+
+    onewire_sim_reset();
+    setup_bus(BENCH_GPIO, BENCH_PROBES, devices);
+    ds18b20_init(&bus, BENCH_GPIO);
+    onewire_sim_set_read_error_rate(rate, 12345);
+
+    int ok = 0;
+    int rejected = 0;
+    int wrong = 0;
+    for (int cycle = 0; cycle < BENCH_READINGS / BENCH_PROBES; cycle++) {
+        if (ds18b20_start_conversion(&bus) != DS18B20_OK) {
+            rejected += ds18b20_device_count(&bus);
+            continue;
+        }
+        onewire_hal_delay_us(ds18b20_conversion_time_ms(&bus) * 1000);
+        for (int i = 0; i < ds18b20_device_count(&bus); i++) {
+            int32_t centi_c;
+            int device = find_device(&bus, devices, BENCH_PROBES, i);
+            int32_t expected = expected_temperature(
+                -10.3f + (device % (BENCH_PROBES + 1)) * 7.77f, ds18b20_get_resolution(&bus, i));
+            if (ds18b20_read_device(&bus, i, &centi_c) != DS18B20_OK) {
+                rejected++;
+            } else if (centi_c != expected) {
+                wrong++;
+            } else {
+                ok++;
+            }
+        }
+    }
+
+    printf("BER %.0e: %lu flipped bits, %d ok, %d rejected, %d wrong\n", rate,
+           (unsigned long) onewire_sim_injected_errors(), ok, rejected, wrong);
+    CHECK(wrong == 0, "%d corrupted readings passed validation", wrong);
+}
+
+/**
+ * Two buses converting in parallel
+ */
+static void test_multiple_buses(void) {
+    ds18b20_bus_t buses[2];
+    int devices[2][BENCH_PROBES];
+
+    onewire_sim_reset();
+    for (int b = 0; b < 2; b++) {
+        setup_bus(BENCH_GPIO + b, BENCH_PROBES, devices[b]);
+        CHECK(ds18b20_init(&buses[b], BENCH_GPIO + b) == DS18B20_OK, "init bus %d", b);
+        CHECK(ds18b20_device_count(&buses[b]) == BENCH_PROBES, "bus %d count", b);
+    }
+    for (int b = 0; b < 2; b++) {
+        ds18b20_start_conversion(&buses[b]);
+    }
+    onewire_hal_delay_us(ds18b20_conversion_time_ms(&buses[0]) * 1000);
+    for (int b = 0; b < 2; b++) {
+        for (int i = 0; i < ds18b20_device_count(&buses[b]); i++) {
+            int32_t centi_c;
+            CHECK(ds18b20_read_device(&buses[b], i, &centi_c) == DS18B20_OK,
+                  "bus %d probe %d", b, i);
+        }
+    }
+}
+
+/**
+ * Run a transaction one ds18b20_step() per call, as the sensor worker does,
+ * tracking the longest call in simulated time
+ */
+static void run_stepped(ds18b20_bus_t *bus, ds18b20_transaction_t *txn, uint64_t *longest_us,
+                        int *calls) {
+    bool more;
+    do {
+        uint64_t start_us = onewire_sim_time_us();
+        more = ds18b20_step(bus, txn);
+        uint64_t span_us = onewire_sim_time_us() - start_us;
+        if (span_us > *longest_us) {
+            *longest_us = span_us;
+        }
+        (*calls)++;
+    } while (more);
+}
+
+/**
+ * A full acquisition cycle over two buses in steps: no call may hold the
+ * sensor context longer than one 1-Wire slot, the longest being a reset
+ */
+static void test_stepped_cycle(double error_rate) {
+    ds18b20_bus_t buses[2];
+    int devices[2][BENCH_PROBES];
+
+    onewire_sim_reset();
+    for (int b = 0; b < 2; b++) {
+        setup_bus(BENCH_GPIO + b, BENCH_PROBES, devices[b]);
+        ds18b20_init(&buses[b], BENCH_GPIO + b);
+    }
+    uint64_t start_us = onewire_sim_time_us();
+    onewire_reset(&buses[0].onewire);
+    uint64_t slot_us = onewire_sim_time_us() - start_us;
+    onewire_sim_set_read_error_rate(error_rate, 4242);
+
+    uint64_t longest_us = 0;
+    int calls = 0;
+    int failed = 0;
+    ds18b20_transaction_t txn;
+    for (int b = 0; b < 2; b++) {
+        ds18b20_begin_conversion(&buses[b], &txn);
+        run_stepped(&buses[b], &txn, &longest_us, &calls);
+        CHECK(txn.result == DS18B20_OK, "bus %d stepped conversion: %s", b,
+              ds18b20_error_string(txn.result));
+    }
+    onewire_hal_delay_us(ds18b20_conversion_time_ms(&buses[0]) * 1000);
+    for (int b = 0; b < 2; b++) {
+        for (int i = 0; i < ds18b20_device_count(&buses[b]); i++) {
+            ds18b20_begin_read(&buses[b], &txn, i);
+            run_stepped(&buses[b], &txn, &longest_us, &calls);
+            int device = find_device(&buses[b], devices[b], BENCH_PROBES, i);
+            int32_t expected =
+                expected_temperature(-10.3f + (device % (BENCH_PROBES + 1)) * 7.77f,
+                                     ds18b20_get_resolution(&buses[b], i));
+            if (txn.result != DS18B20_OK) {
+                failed++;
+            } else {
+                CHECK(txn.centi_c == expected, "bus %d probe %d stepped read: %ld instead of %ld",
+                      b, i, (long) txn.centi_c, (long) expected);
+            }
+        }
+    }
+
+    // The same read as one blocking call, for comparison
+    int32_t centi_c;
+    start_us = onewire_sim_time_us();
+    ds18b20_read_device(&buses[0], 0, &centi_c);
+    uint64_t blocking_us = onewire_sim_time_us() - start_us;
+
+    printf("BER %.0e: %d calls, longest %lu us, reset slot %lu us, blocking read %lu us, "
+           "%d failed\n",
+           error_rate, calls, (unsigned long) longest_us, (unsigned long) slot_us,
+           (unsigned long) blocking_us, failed);
+    CHECK(longest_us <= slot_us, "a step held the bus %lu us, longer than a %lu us slot",
+          (unsigned long) longest_us, (unsigned long) slot_us);
+    CHECK(error_rate > 0 || failed == 0, "%d stepped reads failed without bit errors", failed);
+}
+
+int main(void) {
+    printf("DS18B20 simulator benchmark (%s backend)\n", ONEWIRE_DEFAULT_BACKEND.name);
+    printf("==========================================\n");
+
+    test_crc_vectors();
+    test_enumeration();
+    test_multiple_buses();
+    test_freezing();
+
+    printf("\nBus time per reading, %d probes:\n", BENCH_PROBES);
+    printf("res     mode  bus time  slots        cycle\n");
+    for (int bits = DS18B20_RESOLUTION_MIN; bits <= DS18B20_RESOLUTION_MAX; bits++) {
+        bench_resolution(bits, DS18B20_READ_FULL);
+        bench_resolution(bits, DS18B20_READ_FAST);
+    }
+
+    printf("\nStepped acquisition, 2 buses of %d probes:\n", BENCH_PROBES);
+    test_stepped_cycle(0);
+    test_stepped_cycle(1e-3);
+
+    printf("\nInjected read errors:\n");
+    test_bit_errors(1e-4);
+    test_bit_errors(1e-3);
+
+    printf("\n");
+    return host_test_summary();
+}
@@ -0,0 +1,373 @@
+/**
+ * Flash Log Simulator Benchmark
+ * Runs the persistent sample log and settings against the simulated NOR flash
+ * on a Linux host, checks recovery across remounts and torn writes, and
+ * reports write amplification, wear spread and mount cost.
+ * Built by host/CMakeLists.txt; exits non-zero if any check fails.
+ *
+ * Copyright (c) 2024 Peter Westlund
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "flash_log.h"
+#include "flash_settings.h"
+#include "flash_sim.h"
+#include "host_test.h"
+
+#define BENCH_SECTORS 16
+#define BENCH_FILE "flash_log_sim.bin"
+
+/**
+ * Payload carrying a running number, so order and loss can be checked
+ */
+static void make_payload(uint32_t n, uint8_t *payload) {
+    memset(payload, 0, FLASH_LOG_PAYLOAD_SIZE);
+    memcpy(payload, &n, sizeof(n));
+    payload[FLASH_LOG_PAYLOAD_SIZE - 1] = (uint8_t) (n * 7);
+}
+
+static uint32_t payload_number(const uint8_t *payload) {
+    uint32_t n;
+    memcpy(&n, payload, sizeof(n));
+    return n;
+}
+
+/**
+ * Append a range of numbered records
+ */
+static void append_range(flash_log_t *log, uint32_t first, uint32_t count) {
+    uint8_t payload[FLASH_LOG_PAYLOAD_SIZE];
+    for (uint32_t n = first; n < first + count; n++) {
+        make_payload(n, payload);
+        flash_log_result_t result = flash_log_append(log, payload);
+        CHECK(result == FLASH_LOG_OK, "append %lu: %s", (unsigned long) n,
+              flash_log_error_string(result));
+    }
+}
+
+/**
+ * Drain the log in batches, checking the records come out in order from the given number
+ *
+ * @return Number of records drained
+ */
+static uint32_t drain(flash_log_t *log, uint32_t expected_first) {
+    uint8_t payloads[16 * FLASH_LOG_PAYLOAD_SIZE];
+    uint32_t expected = expected_first;
+    uint32_t drained = 0;
+    size_t n;
+    while ((n = flash_log_peek(log, 0, payloads, 16)) > 0) {
+        for (size_t i = 0; i < n; i++) {
+            uint32_t got = payload_number(&payloads[i * FLASH_LOG_PAYLOAD_SIZE]);
+            CHECK(got == expected, "drained %lu, expected %lu", (unsigned long) got,
+                  (unsigned long) expected);
+            expected = got + 1;
+        }
+        CHECK(flash_log_mark_sent(log, n) == FLASH_LOG_OK, "mark sent");
+        drained += n;
+    }
+    CHECK(flash_log_unsent(log) == 0, "%lu records left after drain",
+          (unsigned long) flash_log_unsent(log));
+    return drained;
+}
+
+/**
+ * Mount again and check the recovered state matches the one in RAM
+ */
+static void check_remount(const flash_log_t *log) {
+    flash_log_t mounted;
+    CHECK(flash_log_mount(&mounted) == FLASH_LOG_OK, "remount");
+    CHECK(mounted.head_segment == log->head_segment && mounted.head_slot == log->head_slot,
+          "head %lu/%lu, expected %lu/%lu", (unsigned long) mounted.head_segment,
+          (unsigned long) mounted.head_slot, (unsigned long) log->head_segment,
+          (unsigned long) log->head_slot);
+    CHECK(mounted.tail_segment == log->tail_segment, "tail %lu, expected %lu",
+          (unsigned long) mounted.tail_segment, (unsigned long) log->tail_segment);
+    CHECK(mounted.unsent == log->unsent, "unsent %lu, expected %lu",
+          (unsigned long) mounted.unsent, (unsigned long) log->unsent);
+}
+
+static void test_blank_and_foreign(void) {
+    flash_log_t log;
+
+    flash_sim_open(NULL, BENCH_SECTORS);
+    CHECK(flash_log_mount(&log) == FLASH_LOG_OK, "mount blank region");
+    CHECK(flash_log_unsent(&log) == 0, "blank region has records");
+    uint8_t payload[FLASH_LOG_PAYLOAD_SIZE];
+    CHECK(!flash_log_last(&log, payload), "blank region has a last record");
+
+    // Garbage that is not a log gets formatted away
+    flash_sim_open(NULL, BENCH_SECTORS);
+    uint8_t junk[FLASH_HAL_PAGE_SIZE];
+    for (size_t i = 0; i < sizeof(junk); i++) {
+        junk[i] = (uint8_t) (i * 37 + 11);
+    }
+    for (uint32_t s = 0; s < BENCH_SECTORS; s++) {
+        flash_hal_program(s * FLASH_HAL_SECTOR_SIZE, junk, sizeof(junk));
+    }
+    CHECK(flash_log_mount(&log) == FLASH_LOG_OK, "mount foreign region");
+    CHECK(flash_log_unsent(&log) == 0, "foreign region has records");
+
+    // A log whose payloads have another layout gets formatted away rather than misread
+    append_range(&log, 0, 3);
+    for (uint32_t s = 0; s < BENCH_SECTORS; s++) {
+        // Header: magic, sequence, record size, payload version, reserved, CRC16
+        uint8_t page[FLASH_HAL_PAGE_SIZE];
+        flash_hal_read(s * FLASH_HAL_SECTOR_SIZE, page, sizeof(page));
+        uint16_t version = FLASH_LOG_PAYLOAD_VERSION + 1;
+        memcpy(&page[10], &version, sizeof(version));
+        uint16_t crc = flash_log_crc16(page, 14);
+        memcpy(&page[14], &crc, sizeof(crc));
+        flash_hal_erase(s * FLASH_HAL_SECTOR_SIZE);
+        flash_hal_program(s * FLASH_HAL_SECTOR_SIZE, page, sizeof(page));
+    }
+    CHECK(flash_log_mount(&log) == FLASH_LOG_OK, "mount other payload version");
+    CHECK(flash_log_unsent(&log) == 0, "records of another payload version kept");
+    append_range(&log, 0, 3);
+    check_remount(&log);
+    CHECK(flash_log_last(&log, payload) && payload_number(payload) == 2, "last record");
+}
+
+/**
+ * Interleave appends, partial drains and remounts across several segments
+ */
+static void test_remount(void) {
+    flash_log_t log;
+
+    flash_sim_open(NULL, BENCH_SECTORS);
+    flash_log_mount(&log);
+    uint32_t next = 0;
+    uint32_t sent = 0;
+    for (int round = 0; round < 20; round++) {
+        append_range(&log, next, 97);
+        next += 97;
+        check_remount(&log);
+
+        uint8_t payloads[40 * FLASH_LOG_PAYLOAD_SIZE];
+        size_t n = flash_log_peek(&log, 0, payloads, 40);
+        CHECK(n == 40 && payload_number(payloads) == sent, "peek after round %d", round);
+        // The next batch, while the first is still awaiting its acknowledgement
+        uint8_t next_batch[40 * FLASH_LOG_PAYLOAD_SIZE];
+        size_t skipped = flash_log_peek(&log, n, next_batch, 40);
+        CHECK(skipped == 40 && payload_number(next_batch) == sent + 40,
+              "peek past unacknowledged after round %d", round);
+        flash_log_mark_sent(&log, n);
+        sent += n;
+        check_remount(&log);
+    }
+
+    flash_log_t mounted;
+    flash_log_mount(&mounted);
+    CHECK(drain(&mounted, sent) == next - sent, "records lost across remounts");
+    check_remount(&mounted);
+}
+
+/**
+ * Fill the region several times over; the oldest unsent records are dropped
+ */
+static void test_wrap(void) {
+    flash_log_t log;
+    uint32_t capacity = (BENCH_SECTORS - 1) * FLASH_LOG_RECORDS_PER_SEGMENT;
+
+    flash_sim_open(NULL, BENCH_SECTORS);
+    flash_log_mount(&log);
+    uint32_t total = capacity * 3 + 123;
+    append_range(&log, 0, total);
+    check_remount(&log);
+    CHECK(log.dropped + log.unsent == total, "dropped %lu + unsent %lu != %lu",
+          (unsigned long) log.dropped, (unsigned long) log.unsent, (unsigned long) total);
+    CHECK(log.unsent >= capacity, "only %lu of %lu records kept", (unsigned long) log.unsent,
+          (unsigned long) capacity);
+    drain(&log, total - log.unsent);
+    check_remount(&log);
+}
+
+/**
+ * Cut power partway through appends; the torn record is skipped, the rest survive
+ */
+static void test_torn_writes(void) {
+    int recovered = 0;
+    for (uint32_t cut = 0; cut <= FLASH_LOG_RECORD_SIZE; cut++) {
+        flash_log_t log;
+        flash_sim_open(NULL, BENCH_SECTORS);
+        flash_log_mount(&log);
+        append_range(&log, 0, 10);
+
+        uint8_t payload[FLASH_LOG_PAYLOAD_SIZE];
+        make_payload(10, payload);
+        flash_sim_cut_power_after(cut);
+        flash_log_append(&log, payload);
+        flash_sim_restore_power();
+
+        flash_log_t mounted;
+        CHECK(flash_log_mount(&mounted) == FLASH_LOG_OK, "mount after cut at %lu",
+              (unsigned long) cut);
+        append_range(&mounted, 11, 5);
+        uint8_t payloads[32 * FLASH_LOG_PAYLOAD_SIZE];
+        size_t n = flash_log_peek(&mounted, 0, payloads, 32);
+        CHECK(n == 15 || n == 16, "cut at %lu: %lu records", (unsigned long) cut,
+              (unsigned long) n);
+        for (size_t i = 0, expected = 0; i < n; i++, expected++) {
+            if (expected == 10 && payload_number(&payloads[i * FLASH_LOG_PAYLOAD_SIZE]) == 11) {
+                expected++;
+            }
+            CHECK(payload_number(&payloads[i * FLASH_LOG_PAYLOAD_SIZE]) == expected,
+                  "cut at %lu: record %lu out of order", (unsigned long) cut, (unsigned long) i);
+        }
+        recovered += n == 16;
+
+        flash_log_mark_sent(&mounted, n);
+        check_remount(&mounted);
+        CHECK(flash_log_unsent(&mounted) == 0, "cut at %lu: torn record left unsent",
+              (unsigned long) cut);
+    }
+    printf("Torn appends: %d of %d cut points kept the record\n", recovered,
+           FLASH_LOG_RECORD_SIZE + 1);
+}
+
+/**
+ * The log survives closing and reopening its backing file
+ */
+static void test_backing_file(void) {
+    flash_log_t log;
+    remove(BENCH_FILE);
+    CHECK(flash_sim_open(BENCH_FILE, BENCH_SECTORS), "open " BENCH_FILE);
+    flash_log_mount(&log);
+    append_range(&log, 0, 300);
+    flash_log_mark_sent(&log, 100);
+    flash_sim_close();
+
+    CHECK(flash_sim_open(BENCH_FILE, BENCH_SECTORS), "reopen " BENCH_FILE);
+    flash_log_mount(&log);
+    CHECK(drain(&log, 100) == 200, "records lost across reopen");
+    flash_sim_close();
+    remove(BENCH_FILE);
+}
+
+/**
+ * Settings survive reopening, wrap around the sector and skip torn saves
+ */
+static void test_settings(void) {
+    uint8_t settings[FLASH_SETTINGS_SIZE];
+    uint8_t loaded[FLASH_SETTINGS_SIZE];
+
+    remove(BENCH_FILE);
+    flash_sim_open(BENCH_FILE, BENCH_SECTORS);
+    CHECK(!flash_settings_load(loaded), "blank sector has settings");
+
+    // Several times round the sector, so it is erased and reused
+    flash_sim_reset_stats();
+    uint32_t saves = 3 * FLASH_HAL_SECTOR_SIZE / FLASH_SETTINGS_RECORD_SIZE + 7;
+    for (uint32_t n = 1; n <= saves; n++) {
+        memset(settings, 0, sizeof(settings));
+        memcpy(settings, &n, sizeof(n));
+        CHECK(flash_settings_save(settings), "save %lu", (unsigned long) n);
+        CHECK(flash_settings_load(loaded) && memcmp(loaded, settings, sizeof(settings)) == 0,
+              "load after save %lu", (unsigned long) n);
+    }
+    flash_sim_stats_t stats;
+    flash_sim_get_stats(&stats);
+    CHECK(stats.erases == 3, "%lu settings erases", (unsigned long) stats.erases);
+
+    // Saving unchanged settings writes nothing
+    flash_sim_reset_stats();
+    flash_settings_save(settings);
+    flash_sim_get_stats(&stats);
+    CHECK(stats.page_programs == 0, "unchanged settings saved again");
+
+    flash_sim_close();
+    flash_sim_open(BENCH_FILE, BENCH_SECTORS);
+    CHECK(flash_settings_load(loaded) && memcmp(loaded, settings, sizeof(settings)) == 0,
+          "settings lost across reopen");
+
+    // A torn save leaves the previous settings in place
+    uint8_t next[FLASH_SETTINGS_SIZE];
+    memset(next, 0x5a, sizeof(next));
+    for (uint32_t cut = 0; cut < FLASH_SETTINGS_RECORD_SIZE; cut++) {
+        flash_sim_cut_power_after(cut);
+        flash_settings_save(next);
+        flash_sim_restore_power();
+        CHECK(flash_settings_load(loaded), "no settings after cut at %lu", (unsigned long) cut);
+        CHECK(memcmp(loaded, settings, sizeof(settings)) == 0 ||
+                  memcmp(loaded, next, sizeof(next)) == 0,
+              "settings corrupted by cut at %lu", (unsigned long) cut);
+    }
+    CHECK(flash_settings_save(next) && flash_settings_load(loaded) &&
+              memcmp(loaded, next, sizeof(next)) == 0,
+          "save after torn saves");
+    flash_sim_close();
+    remove(BENCH_FILE);
+}
+
+/**
+ * Write amplification and wear for logging and draining, in batches of the given size
+ */
+static void bench_amplification(uint32_t batch) {
+    flash_log_t log;
+    uint32_t records = BENCH_SECTORS * FLASH_LOG_RECORDS_PER_SEGMENT * 10;
+
+    flash_sim_open(NULL, BENCH_SECTORS);
+    flash_log_mount(&log);
+    flash_sim_reset_stats();
+
+    uint8_t payloads[64 * FLASH_LOG_PAYLOAD_SIZE];
+    for (uint32_t n = 0; n < records; n += batch) {
+        append_range(&log, n, batch);
+        size_t got = flash_log_peek(&log, 0, payloads, batch);
+        flash_log_mark_sent(&log, got);
+    }
+
+    flash_sim_stats_t stats;
+    flash_sim_get_stats(&stats);
+    printf("%5lu  %10.2f  %8.2f  %11.3f  %5lu-%lu\n", (unsigned long) batch,
+           (double) stats.bytes_programmed / ((double) records * FLASH_LOG_PAYLOAD_SIZE),
+           (double) stats.page_programs / records, stats.erases * 1000.0 / records,
+           (unsigned long) stats.min_sector_erases, (unsigned long) stats.max_sector_erases);
+    CHECK(stats.max_sector_erases - stats.min_sector_erases <= 1, "uneven wear");
+}
+
+/**
+ * Flash reads needed to mount a full log, against the region size
+ */
+static void bench_mount(void) {
+    flash_log_t log;
+
+    flash_sim_open(NULL, BENCH_SECTORS);
+    flash_log_mount(&log);
+    append_range(&log, 0, BENCH_SECTORS * FLASH_LOG_RECORDS_PER_SEGMENT * 2 + 77);
+    flash_log_mark_sent(&log, 1000);
+
+    flash_sim_stats_t stats;
+    flash_sim_reset_stats();
+    flash_log_mount(&log);
+    flash_sim_get_stats(&stats);
+    printf("Mount read %lu of %lu bytes\n", (unsigned long) stats.bytes_read,
+           (unsigned long) flash_hal_size());
+    CHECK(stats.bytes_read < flash_hal_size() / 16, "mount read too much");
+}
+
+int main(void) {
+    printf("Flash log simulator benchmark\n");
+    printf("=============================\n");
+
+    test_blank_and_foreign();
+    test_remount();
+    test_wrap();
+    test_torn_writes();
+    test_backing_file();
+    test_settings();
+
+    printf("\nWrite amplification, %d sectors, %d-byte payloads:\n", BENCH_SECTORS,
+           FLASH_LOG_PAYLOAD_SIZE);
+    printf("batch  bytes/byte  pages/rec  erases/1000  wear\n");
+    bench_amplification(1);
+    bench_amplification(8);
+    bench_amplification(64);
+
+    printf("\n");
+    bench_mount();
+
+    printf("\n");
+    return host_test_summary();
+}
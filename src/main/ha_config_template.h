@@ -0,0 +1,57 @@
+/**
+ * Home Assistant Discovery Config Template
+ * The discovery config as a payload template, shared by the sensor and its
+ * host test. The includer defines HA_DEVICE_NAME, HA_DEVICE_MODEL,
+ * HA_DEVICE_MANUFACTURER and HA_EXPIRE_AFTER_S before expanding
+ * HA_SENSOR_CONFIG_TEMPLATE, which joins them in at compile time.
+ *
+ * Copyright (c) 2024 Peter Westlund
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef HA_CONFIG_TEMPLATE_H
+#define HA_CONFIG_TEMPLATE_H
+
+#include "payload_template.h"
+
+#define HA_STRINGIFY(x) #x
+#define HA_XSTRINGIFY(x) HA_STRINGIFY(x)
+
+/* Runtime fields of the discovery config template */
+#define HA_FIELD_NAME 1
+#define HA_FIELD_DEVICE_CLASS 2 // The whole device_class member with its comma, or ""
+#define HA_FIELD_STATE_TOPIC 3
+#define HA_FIELD_AVAILABILITY_TOPIC 4
+#define HA_FIELD_UNIT 5
+#define HA_FIELD_VALUE_KEY 6
+#define HA_FIELD_DEVICE_ID 7
+#define HA_FIELD_OBJECT_ID 8
+#define HA_FIELD_COUNT 9
+
+_Static_assert(HA_FIELD_COUNT - 1 <= PAYLOAD_TEMPLATE_MAX_FIELD, "too many template fields");
+
+/* Discovery config with the device constants joined in at compile time */
+#define HA_SENSOR_CONFIG_TEMPLATE                                                                \
+    "{"                                                                                         \
+    "\"name\":\"" PAYLOAD_TEMPLATE_FIELD(HA_FIELD_NAME) "\","                                   \
+    PAYLOAD_TEMPLATE_FIELD(HA_FIELD_DEVICE_CLASS)                                               \
+    "\"state_topic\":\"" PAYLOAD_TEMPLATE_FIELD(HA_FIELD_STATE_TOPIC) "\","                     \
+    "\"availability_topic\":\"" PAYLOAD_TEMPLATE_FIELD(HA_FIELD_AVAILABILITY_TOPIC) "\","       \
+    "\"payload_available\":\"online\","                                                         \
+    "\"payload_not_available\":\"offline\","                                                    \
+    "\"unit_of_measurement\":\"" PAYLOAD_TEMPLATE_FIELD(HA_FIELD_UNIT) "\","                    \
+    "\"value_template\":\"{{ value_json." PAYLOAD_TEMPLATE_FIELD(HA_FIELD_VALUE_KEY) " }}\","   \
+    "\"unique_id\":\"" PAYLOAD_TEMPLATE_FIELD(HA_FIELD_DEVICE_ID) "_"                           \
+    PAYLOAD_TEMPLATE_FIELD(HA_FIELD_OBJECT_ID) "\","                                            \
+    "\"device\":{"                                                                              \
+    "\"identifiers\":[\"" PAYLOAD_TEMPLATE_FIELD(HA_FIELD_DEVICE_ID) "\"],"                     \
+    "\"name\":\"" HA_DEVICE_NAME "\","                                                          \
+    "\"model\":\"" HA_DEVICE_MODEL "\","                                                        \
+    "\"manufacturer\":\"" HA_DEVICE_MANUFACTURER "\","                                          \
+    "\"sw_version\":\"1.0\""                                                                    \
+    "},"                                                                                        \
+    "\"expire_after\":" HA_XSTRINGIFY(HA_EXPIRE_AFTER_S)                                        \
+    "}"
+
+#endif // HA_CONFIG_TEMPLATE_H
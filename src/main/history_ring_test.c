@@ -0,0 +1,202 @@
+/**
+ * History Ring Test
+ * Pushes 5000 readings through the delta-encoded history ring with random
+ * peeks and drops in between, and checks every reading that comes out
+ * against a plain copy: eviction of the oldest readings when the ring is
+ * full, negative and extreme value deltas, times going backwards, offsets
+ * wrapping around the buffer and the decoder state after each drop.
+ * Built by host/CMakeLists.txt; exits non-zero if any check fails.
+ *
+ * Usage: history_ring_test [readings] [seed]
+ *
+ * Copyright (c) 2024 Peter Westlund
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "history_ring.h"
+#include "host_test.h"
+
+#define MAX_READINGS 100000
+#define MAX_PEEK 64
+
+/* Every reading pushed, with the time the ring is expected to return */
+static history_sample_t pushed[MAX_READINGS];
+static uint32_t pushed_count = 0;
+static uint32_t removed_count = 0; // Oldest readings evicted or dropped
+
+/* Decoder state the ring should hold as of the oldest reading left */
+static uint64_t head_time_ms = 0;
+static int32_t head_values[HISTORY_RING_SOURCES];
+
+static bool same_sample(const history_sample_t *a, const history_sample_t *b) {
+    return a->time_ms == b->time_ms && a->value == b->value && a->source == b->source;
+}
+
+/**
+ * Account for the oldest n readings leaving the ring
+ */
+static void remove_oldest(uint32_t n) {
+    for (; n > 0; n--) {
+        const history_sample_t *sample = &pushed[removed_count++];
+        head_time_ms = sample->time_ms;
+        head_values[sample->source] = sample->value;
+    }
+}
+
+static void check_head(const history_ring_t *ring, uint32_t step) {
+    CHECK(ring->head_time_ms == head_time_ms, "step %u: head time %llu, expected %llu", step,
+          (unsigned long long) ring->head_time_ms, (unsigned long long) head_time_ms);
+    CHECK(memcmp(ring->head_values, head_values, sizeof(head_values)) == 0,
+          "step %u: head values not rebased", step);
+}
+
+/**
+ * Next reading of a random walk, with the awkward cases mixed in
+ */
+static history_sample_t next_sample(void) {
+    static uint64_t time_ms = 0;
+    static int32_t values[HISTORY_RING_SOURCES];
+
+    history_sample_t sample;
+    // Mostly a few sources, now and then the highest id
+    sample.source = rng_below(16) == 0 ? HISTORY_RING_SOURCES - 1 : (uint8_t) rng_below(4);
+
+    switch (rng_below(16)) {
+        case 0: {
+            uint64_t back = rng_below(5000); // Out of order, e.g. stamped on another core
+            time_ms -= back < time_ms ? back : time_ms;
+            break;
+        }
+        case 1:
+            time_ms += (uint64_t) rng() << 8; // Long gap, a multi-byte delta
+            break;
+        default:
+            time_ms += rng_below(70000);
+            break;
+    }
+    sample.time_ms = time_ms;
+
+    int32_t *value = &values[sample.source];
+    switch (rng_below(32)) {
+        case 0:
+            *value = INT32_MIN; // Deltas that wrap in 32 bits
+            break;
+        case 1:
+            *value = INT32_MAX;
+            break;
+        case 2:
+            *value = -(int32_t) rng_below(100000); // Large negative jump
+            break;
+        default:
+            *value += (int32_t) rng_below(201) - 100; // Small steps either way
+            break;
+    }
+    sample.value = *value;
+    return sample;
+}
+
+/**
+ * Push one reading and check what the ring evicted to make room
+ */
+static void push(history_ring_t *ring, uint32_t step) {
+    history_sample_t sample = next_sample();
+    uint32_t dropped_before = ring->dropped;
+    CHECK(history_ring_push(ring, &sample), "step %u: push refused", step);
+
+    // The ring clamps times before the newest stored reading to it
+    if (pushed_count > 0 && sample.time_ms < pushed[pushed_count - 1].time_ms) {
+        sample.time_ms = pushed[pushed_count - 1].time_ms;
+    }
+    pushed[pushed_count++] = sample;
+    remove_oldest(ring->dropped - dropped_before);
+
+    CHECK(ring->used <= HISTORY_RING_SIZE, "step %u: %zu bytes used", step, ring->used);
+    CHECK(history_ring_count(ring) == pushed_count - removed_count,
+          "step %u: %u readings stored, expected %u", step, history_ring_count(ring),
+          pushed_count - removed_count);
+}
+
+/**
+ * Peek a random batch, possibly past some readings, and compare it with the copy
+ */
+static void peek(const history_ring_t *ring, uint32_t step) {
+    history_sample_t samples[MAX_PEEK];
+    uint32_t stored = pushed_count - removed_count;
+    size_t skip = rng_below(4) == 0 ? rng_below(2 * MAX_PEEK) : 0;
+    size_t max = 1 + rng_below(MAX_PEEK);
+    size_t n = history_ring_peek(ring, skip, samples, max);
+
+    size_t left = skip < stored ? stored - skip : 0;
+    CHECK(n == (left < max ? left : max), "step %u: peeked %zu of %zu past %zu", step, n, left,
+          skip);
+    for (size_t i = 0; i < n; i++) {
+        const history_sample_t *expected = &pushed[removed_count + skip + i];
+        if (!same_sample(&samples[i], expected)) {
+            CHECK(false, "step %u: reading %zu is %u/%llu/%ld, expected %u/%llu/%ld", step,
+                  (size_t) removed_count + skip + i, samples[i].source,
+                  (unsigned long long) samples[i].time_ms, (long) samples[i].value,
+                  expected->source, (unsigned long long) expected->time_ms,
+                  (long) expected->value);
+            break;
+        }
+    }
+}
+
+static void drop(history_ring_t *ring, uint32_t step) {
+    uint32_t stored = pushed_count - removed_count;
+    uint32_t n = rng_below(MAX_PEEK);
+    history_ring_drop(ring, n);
+    remove_oldest(n < stored ? n : stored);
+    check_head(ring, step);
+}
+
+int main(int argc, char **argv) {
+    unsigned long readings = argc > 1 ? strtoul(argv[1], NULL, 0) : 5000;
+    unsigned long long seed = argc > 2 ? strtoull(argv[2], NULL, 0) : 0x5eed;
+    rng_seed(seed);
+    if (readings > MAX_READINGS) {
+        readings = MAX_READINGS;
+    }
+
+    static history_ring_t ring;
+    history_ring_init(&ring);
+
+    history_sample_t bad = {.source = HISTORY_RING_SOURCES};
+    CHECK(!history_ring_push(&ring, &bad), "source out of range accepted");
+    CHECK(history_ring_count(&ring) == 0 && ring.used == 0, "refused reading stored");
+
+    uint32_t wraps = 0;
+    for (uint32_t step = 0; step < readings; step++) {
+        size_t start = ring.start;
+        push(&ring, step);
+        // Only consume now and then, so the ring fills and evicts as during an outage
+        if (rng_below(8) == 0) {
+            peek(&ring, step);
+        }
+        if (rng_below(128) == 0) {
+            drop(&ring, step);
+        }
+        wraps += ring.start < start;
+        if (host_test_bailed()) {
+            break;
+        }
+    }
+
+    // Drain what is left, as a replay after reconnecting would
+    uint32_t evicted = ring.dropped;
+    while (history_ring_count(&ring) > 0 && !host_test_bailed()) {
+        peek(&ring, readings);
+        drop(&ring, readings);
+    }
+    CHECK(removed_count == pushed_count, "%u readings lost", pushed_count - removed_count);
+    CHECK(ring.used == 0, "%zu bytes left in an empty ring", ring.used);
+
+    printf("%lu readings, seed 0x%llx: %u evicted, buffer wrapped %u times\n", readings, seed,
+           evicted, wraps);
+    CHECK(evicted > 0, "ring never filled");
+    CHECK(wraps > 0, "buffer never wrapped");
+    return host_test_summary();
+}
@@ -0,0 +1,75 @@
+/**
+ * Host Test Helpers
+ * The check macro, failure count, seeded generator and summary shared by the
+ * host tests and benches built by host/CMakeLists.txt. Each program includes
+ * this once and ends main() with host_test_summary(), so ctest sees a
+ * non-zero exit status whenever a check failed.
+ *
+ * Copyright (c) 2024 Peter Westlund
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef HOST_TEST_H
+#define HOST_TEST_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* Failures after which long runs stop, as the rest is usually the same fault again */
+#define HOST_TEST_MAX_FAILURES 20
+
+static int failures = 0;
+
+#define CHECK(cond, ...)                  \
+    do {                                  \
+        if (!(cond)) {                    \
+            printf("FAIL: " __VA_ARGS__); \
+            printf("\n");                 \
+            failures++;                   \
+        }                                 \
+    } while (0)
+
+/**
+ * Check whether a long run should stop early
+ */
+static inline bool host_test_bailed(void) {
+    return failures > HOST_TEST_MAX_FAILURES;
+}
+
+static uint64_t rng_state = 1;
+
+/**
+ * Seed the generator; printing the seed lets a failing run be replayed
+ */
+static inline void rng_seed(uint64_t seed) {
+    rng_state = seed ? seed : 1;
+}
+
+/* xorshift64* */
+static inline uint32_t rng(void) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return (uint32_t) ((rng_state * 2685821657736338717ull) >> 32);
+}
+
+static inline uint32_t rng_below(uint32_t n) {
+    return n ? rng() % n : 0;
+}
+
+/**
+ * Print the outcome
+ *
+ * @return Exit status for main(), non-zero if any check failed
+ */
+static inline int host_test_summary(void) {
+    if (failures) {
+        printf("%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("All checks passed\n");
+    return 0;
+}
+
+#endif // HOST_TEST_H
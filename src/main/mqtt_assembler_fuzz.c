@@ -0,0 +1,248 @@
+/**
+ * MQTT Message Assembler Fuzz Test
+ * Feeds the assembler random publishes split into random fragment sequences,
+ * including abandoned messages, fragments beyond or short of the announced
+ * length, stray fragments and overlong topics, and checks every message is
+ * either dispatched intact or dropped whole. Fragments are handed over in
+ * buffers of their exact size, so building with -fsanitize=address also
+ * catches any read past a fragment.
+ * Built by host/CMakeLists.txt; exits non-zero if any check fails.
+ *
+ * Usage: mqtt_assembler_fuzz [iterations] [seed]
+ *
+ * Copyright (c) 2024 Peter Westlund
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mqtt_assembler.h"
+#include "host_test.h"
+
+#define MAX_PAYLOAD (MQTT_ASSEMBLER_BUF_LEN * 2)
+#define MAX_FRAGMENTS 8
+
+/* What the dispatch callback saw */
+static struct {
+    int calls;
+    char topic[MQTT_ASSEMBLER_TOPIC_LEN];
+    uint8_t data[MAX_PAYLOAD];
+    size_t len;
+    bool zero_copy; // Payload was the fragment being fed
+} seen;
+
+static const uint8_t *fed_fragment;
+
+static void on_message(void *arg, const mqtt_message_t *message) {
+    (void) arg;
+    seen.calls++;
+    snprintf(seen.topic, sizeof(seen.topic), "%s", message->topic);
+    seen.len = message->len;
+    seen.zero_copy = message->data == fed_fragment;
+    if (message->len > 0 && message->len <= sizeof(seen.data)) {
+        memcpy(seen.data, message->data, message->len);
+    }
+}
+
+/**
+ * Hand a fragment to the assembler from a heap copy of exactly its size
+ */
+static void feed(mqtt_assembler_t *assembler, const uint8_t *data, size_t len, bool last) {
+    uint8_t *copy = len ? malloc(len) : NULL;
+    if (len) {
+        memcpy(copy, data, len);
+    }
+    fed_fragment = copy;
+    mqtt_assembler_data(assembler, copy, len, last);
+    fed_fragment = NULL;
+    free(copy);
+}
+
+typedef enum {
+    CASE_NORMAL,    // Fragments add up to the announced length
+    CASE_ABANDONED, // Last fragment never comes, the next publish starts
+    CASE_LONG,      // More bytes than announced
+    CASE_SHORT,     // Last fragment before the announced length
+    CASE_COUNT
+} fuzz_case_t;
+
+/**
+ * Run one random publish and check its outcome
+ */
+static void fuzz_one(mqtt_assembler_t *assembler, uint32_t iteration) {
+    static uint8_t payload[MAX_PAYLOAD + 16];
+    char topic[MQTT_ASSEMBLER_TOPIC_LEN + 16];
+
+    // Mostly short topics, now and then one that does not fit
+    size_t topic_len = rng_below(8) == 0 ? rng_below(sizeof(topic) - 1) : 1 + rng_below(24);
+    for (size_t i = 0; i < topic_len; i++) {
+        topic[i] = (char) ('a' + rng_below(26));
+    }
+    topic[topic_len] = '\0';
+
+    // Payload lengths cluster around the buffer size, where the edge cases are
+    size_t total;
+    switch (rng_below(4)) {
+        case 0:
+            total = rng_below(8);
+            break;
+        case 1:
+            total = MQTT_ASSEMBLER_BUF_LEN - 4 + rng_below(9);
+            break;
+        default:
+            total = rng_below(MAX_PAYLOAD + 1);
+            break;
+    }
+    for (size_t i = 0; i < sizeof(payload); i++) {
+        payload[i] = (uint8_t) rng();
+    }
+
+    fuzz_case_t fuzz_case = rng_below(4) ? CASE_NORMAL : (fuzz_case_t) rng_below(CASE_COUNT);
+    size_t sent_len = total;
+    if (fuzz_case == CASE_LONG) {
+        sent_len = total + 1 + rng_below(16);
+    } else if (fuzz_case == CASE_SHORT) {
+        if (total == 0) {
+            fuzz_case = CASE_NORMAL;
+        } else {
+            sent_len = rng_below((uint32_t) total);
+        }
+    }
+
+    // Split into fragments at random points, empty fragments included
+    size_t cuts[MAX_FRAGMENTS + 1];
+    size_t fragments = 1 + rng_below(MAX_FRAGMENTS);
+    cuts[0] = 0;
+    for (size_t i = 1; i < fragments; i++) {
+        cuts[i] = rng_below((uint32_t) sent_len + 1);
+    }
+    cuts[fragments] = sent_len;
+    for (size_t i = 1; i < fragments; i++) {
+        for (size_t j = i; j > 1 && cuts[j - 1] > cuts[j]; j--) {
+            size_t t = cuts[j];
+            cuts[j] = cuts[j - 1];
+            cuts[j - 1] = t;
+        }
+    }
+
+    // Now and then a stray fragment with no publish start, which must be ignored
+    if (rng_below(16) == 0 && !assembler->active) {
+        mqtt_assembler_stats_t before = assembler->stats;
+        feed(assembler, payload, rng_below(32), rng_below(2));
+        CHECK(memcmp(&before, &assembler->stats, sizeof(before)) == 0,
+              "iteration %u: stray fragment counted", iteration);
+    }
+
+    mqtt_assembler_stats_t before = assembler->stats;
+    seen.calls = 0;
+    mqtt_assembler_begin(assembler, topic, total);
+    size_t sent_fragments = fuzz_case == CASE_ABANDONED ? rng_below((uint32_t) fragments)
+                                                        : fragments;
+    for (size_t i = 0; i < sent_fragments; i++) {
+        bool last = i == fragments - 1;
+        feed(assembler, &payload[cuts[i]], cuts[i + 1] - cuts[i], last);
+    }
+    if (fuzz_case == CASE_ABANDONED) {
+        // Only the next publish start tells the assembler the message is gone
+        mqtt_assembler_begin(assembler, "next", 0);
+        feed(assembler, NULL, 0, true);
+        CHECK(seen.calls == 1 && strcmp(seen.topic, "next") == 0,
+              "iteration %u: publish after an abandoned one not dispatched", iteration);
+        CHECK(assembler->stats.dropped == before.dropped + 1,
+              "iteration %u: abandoned message not counted as dropped", iteration);
+        return;
+    }
+
+    bool topic_fits = topic_len < MQTT_ASSEMBLER_TOPIC_LEN;
+    // The whole payload in the last fragment, after nothing but empty ones
+    bool direct = cuts[fragments - 1] == 0 && fuzz_case == CASE_NORMAL;
+    bool expected = topic_fits && fuzz_case == CASE_NORMAL &&
+                    (direct || total <= MQTT_ASSEMBLER_BUF_LEN);
+    if (!expected) {
+        CHECK(seen.calls == 0, "iteration %u: bad message dispatched (case %d, total %zu)",
+              iteration, fuzz_case, total);
+        CHECK(assembler->stats.dropped == before.dropped + 1,
+              "iteration %u: bad message not counted as dropped", iteration);
+        return;
+    }
+    CHECK(seen.calls == 1, "iteration %u: %d dispatches (total %zu, %zu fragments)", iteration,
+          seen.calls, total, fragments);
+    CHECK(strcmp(seen.topic, topic) == 0, "iteration %u: topic mismatch", iteration);
+    CHECK(seen.len == total && memcmp(seen.data, payload, total) == 0,
+          "iteration %u: payload mismatch (%zu of %zu bytes)", iteration, seen.len, total);
+    if (direct) {
+        CHECK(seen.zero_copy, "iteration %u: single fragment was copied", iteration);
+        CHECK(assembler->stats.direct == before.direct + 1, "iteration %u: not counted direct",
+              iteration);
+    } else {
+        CHECK(assembler->stats.assembled == before.assembled + 1,
+              "iteration %u: not counted assembled", iteration);
+    }
+}
+
+/**
+ * Fixed cases that the random ones might take long to hit
+ */
+static void test_edges(void) {
+    static mqtt_assembler_t assembler;
+    mqtt_assembler_init(&assembler, on_message, NULL);
+    uint8_t payload[MQTT_ASSEMBLER_BUF_LEN + 1];
+    memset(payload, 'x', sizeof(payload));
+
+    // Exactly a buffer, in two fragments
+    seen.calls = 0;
+    mqtt_assembler_begin(&assembler, "/print", MQTT_ASSEMBLER_BUF_LEN);
+    feed(&assembler, payload, 1, false);
+    feed(&assembler, payload, MQTT_ASSEMBLER_BUF_LEN - 1, true);
+    CHECK(seen.calls == 1 && seen.len == MQTT_ASSEMBLER_BUF_LEN, "full buffer not assembled");
+
+    // One byte over, in two fragments
+    seen.calls = 0;
+    mqtt_assembler_begin(&assembler, "/print", sizeof(payload));
+    feed(&assembler, payload, 1, false);
+    feed(&assembler, payload, sizeof(payload) - 1, true);
+    CHECK(seen.calls == 0 && assembler.stats.dropped == 1, "oversized message not dropped");
+
+    // The same in one fragment goes out without a buffer
+    seen.calls = 0;
+    mqtt_assembler_begin(&assembler, "/print", sizeof(payload));
+    feed(&assembler, payload, sizeof(payload), true);
+    CHECK(seen.calls == 1 && seen.len == sizeof(payload), "large single fragment dropped");
+
+    // Empty payload
+    seen.calls = 0;
+    mqtt_assembler_begin(&assembler, "/ping", 0);
+    mqtt_assembler_data(&assembler, NULL, 0, true);
+    CHECK(seen.calls == 1 && seen.len == 0, "empty message not dispatched");
+
+    // Every buffer is free again
+    for (int i = 0; i < MQTT_ASSEMBLER_BUFFERS; i++) {
+        CHECK(!assembler.buffer_used[i], "buffer %d still in use", i);
+    }
+}
+
+int main(int argc, char **argv) {
+    unsigned long iterations = argc > 1 ? strtoul(argv[1], NULL, 0) : 200000;
+    unsigned long long seed = argc > 2 ? strtoull(argv[2], NULL, 0) : 0x5eed;
+    rng_seed(seed);
+
+    test_edges();
+
+    static mqtt_assembler_t assembler;
+    mqtt_assembler_init(&assembler, on_message, NULL);
+    for (unsigned long i = 0; i < iterations; i++) {
+        fuzz_one(&assembler, (uint32_t) i);
+        if (host_test_bailed()) {
+            break;
+        }
+    }
+    for (int i = 0; i < MQTT_ASSEMBLER_BUFFERS; i++) {
+        CHECK(!assembler.buffer_used[i], "buffer %d leaked", i);
+    }
+
+    printf("%lu iterations, seed 0x%llx: %lu direct, %lu assembled, %lu dropped\n", iterations,
+           seed, (unsigned long) assembler.stats.direct, (unsigned long) assembler.stats.assembled,
+           (unsigned long) assembler.stats.dropped);
+    return host_test_summary();
+}
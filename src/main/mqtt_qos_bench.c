@@ -0,0 +1,346 @@
+/**
+ * MQTT QoS Benchmark
+ * Publishes state-sized messages to a broker at QoS 0 and QoS 1 the way the
+ * sensor does, and reports throughput and publish-to-delivery latency.
+ * QoS 1 publishes are limited to MQTT_REQ_MAX_IN_FLIGHT unacknowledged
+ * messages, like the lwIP client; QoS 0 publishes complete once written.
+ * The benchmark subscribes to its own topic, so latency is the time until the
+ * broker delivers a message back.
+ *
+ * Usage: mqtt_qos_bench [host] [port] [messages]
+ * Built by host/CMakeLists.txt; needs a running broker, e.g. a local mosquitto.
+ *
+ * Copyright (c) 2024 Peter Westlund
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "host_test.h"
+
+/* Matches src/config/lwipopts.h */
+#define MQTT_REQ_MAX_IN_FLIGHT 5
+
+#define BENCH_MAX_MESSAGES 100000
+#define BENCH_TIMEOUT_MS 10000
+
+#define MQTT_CONNECT 0x10
+#define MQTT_CONNACK 0x20
+#define MQTT_PUBLISH 0x30
+#define MQTT_PUBACK 0x40
+#define MQTT_SUBSCRIBE 0x82
+#define MQTT_SUBACK 0x90
+
+typedef struct {
+    int fd;
+    uint8_t buf[4096];
+    size_t used;
+} bench_conn_t;
+
+typedef struct {
+    uint64_t sent_us[BENCH_MAX_MESSAGES];
+    uint64_t latency_us[BENCH_MAX_MESSAGES];
+    uint32_t delivered;
+    uint32_t acked;
+    uint32_t in_flight;
+} bench_run_t;
+
+static bench_run_t run;
+static char bench_topic[64];
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + (uint64_t) ts.tv_nsec / 1000;
+}
+
+static bool send_all(int fd, const uint8_t *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, data, len, 0);
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        len -= (size_t) n;
+    }
+    return true;
+}
+
+/**
+ * Send a packet with a fixed header, encoding the remaining length
+ */
+static bool send_packet(int fd, uint8_t type, const uint8_t *body, size_t len) {
+    uint8_t packet[512];
+    size_t pos = 0;
+    packet[pos++] = type;
+    size_t remaining = len;
+    do {
+        uint8_t byte = remaining % 128;
+        remaining /= 128;
+        packet[pos++] = byte | (remaining ? 0x80 : 0);
+    } while (remaining);
+    if (pos + len > sizeof(packet)) {
+        return false;
+    }
+    memcpy(&packet[pos], body, len);
+    return send_all(fd, packet, pos + len);
+}
+
+static size_t put_string(uint8_t *buf, const char *str) {
+    size_t len = strlen(str);
+    buf[0] = (uint8_t) (len >> 8);
+    buf[1] = (uint8_t) len;
+    memcpy(&buf[2], str, len);
+    return len + 2;
+}
+
+/**
+ * Take one complete packet from the connection buffer
+ *
+ * @return Packet length including the header, 0 if incomplete
+ */
+static size_t next_packet(bench_conn_t *conn, uint8_t *type, const uint8_t **body,
+                          size_t *body_len) {
+    size_t remaining = 0;
+    size_t pos = 1;
+    for (int shift = 0; pos < conn->used; shift += 7) {
+        uint8_t byte = conn->buf[pos++];
+        remaining |= (size_t) (byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            if (pos + remaining > conn->used) {
+                return 0;
+            }
+            *type = conn->buf[0];
+            *body = &conn->buf[pos];
+            *body_len = remaining;
+            return pos + remaining;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Handle PUBACKs and delivered messages, waiting up to timeout_ms for data
+ *
+ * @return false if the connection failed
+ */
+static bool process_input(bench_conn_t *conn, int timeout_ms) {
+    struct pollfd pfd = {.fd = conn->fd, .events = POLLIN};
+    if (poll(&pfd, 1, timeout_ms) <= 0) {
+        return true;
+    }
+    ssize_t n = recv(conn->fd, &conn->buf[conn->used], sizeof(conn->buf) - conn->used, 0);
+    if (n <= 0) {
+        return false;
+    }
+    conn->used += (size_t) n;
+
+    uint8_t type;
+    const uint8_t *body;
+    size_t body_len;
+    size_t len;
+    while ((len = next_packet(conn, &type, &body, &body_len)) > 0) {
+        uint64_t t = now_us();
+        if ((type & 0xf0) == MQTT_PUBACK) {
+            run.acked++;
+            run.in_flight--;
+        } else if ((type & 0xf0) == MQTT_PUBLISH && body_len >= 2) {
+            // Payload starts with the message index as {"seq":<n>
+            size_t topic_len = (size_t) body[0] << 8 | body[1];
+            size_t offset = 2 + topic_len + ((type & 0x06) ? 2 : 0);
+            if (offset < body_len) {
+                char payload[64];
+                size_t payload_len = body_len - offset;
+                if (payload_len >= sizeof(payload)) {
+                    payload_len = sizeof(payload) - 1;
+                }
+                memcpy(payload, &body[offset], payload_len);
+                payload[payload_len] = '\0';
+                unsigned long seq;
+                if (sscanf(payload, "{\"seq\":%lu", &seq) == 1 && seq < BENCH_MAX_MESSAGES &&
+                    run.latency_us[seq] == 0) {
+                    run.latency_us[seq] = t - run.sent_us[seq] + 1;
+                    run.delivered++;
+                }
+            }
+        }
+        memmove(conn->buf, &conn->buf[len], conn->used - len);
+        conn->used -= len;
+    }
+    return true;
+}
+
+/**
+ * Wait for a packet of the given type during the handshake
+ */
+static bool expect_packet(bench_conn_t *conn, uint8_t expected) {
+    uint64_t deadline = now_us() + BENCH_TIMEOUT_MS * 1000ull;
+    while (now_us() < deadline) {
+        uint8_t type;
+        const uint8_t *body;
+        size_t body_len;
+        size_t len = next_packet(conn, &type, &body, &body_len);
+        if (len > 0) {
+            memmove(conn->buf, &conn->buf[len], conn->used - len);
+            conn->used -= len;
+            return (type & 0xf0) == expected;
+        }
+        struct pollfd pfd = {.fd = conn->fd, .events = POLLIN};
+        if (poll(&pfd, 1, 100) > 0) {
+            ssize_t n = recv(conn->fd, &conn->buf[conn->used], sizeof(conn->buf) - conn->used, 0);
+            if (n <= 0) {
+                return false;
+            }
+            conn->used += (size_t) n;
+        }
+    }
+    return false;
+}
+
+static bool bench_connect(bench_conn_t *conn, const char *host, const char *port) {
+    struct addrinfo hints = {.ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM};
+    struct addrinfo *addr;
+    if (getaddrinfo(host, port, &hints, &addr) != 0) {
+        return false;
+    }
+    conn->fd = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+    conn->used = 0;
+    bool ok = conn->fd >= 0 && connect(conn->fd, addr->ai_addr, addr->ai_addrlen) == 0;
+    freeaddrinfo(addr);
+    if (!ok) {
+        return false;
+    }
+    int one = 1;
+    setsockopt(conn->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    // CONNECT: MQTT 3.1.1, clean session, 30 s keep-alive
+    uint8_t body[128];
+    size_t len = put_string(body, "MQTT");
+    body[len++] = 4;
+    body[len++] = 0x02;
+    body[len++] = 0;
+    body[len++] = 30;
+    char client_id[32];
+    snprintf(client_id, sizeof(client_id), "qosbench%d", (int) getpid());
+    len += put_string(&body[len], client_id);
+    if (!send_packet(conn->fd, MQTT_CONNECT, body, len) || !expect_packet(conn, MQTT_CONNACK)) {
+        return false;
+    }
+
+    // SUBSCRIBE to our own topic at QoS 0, so deliveries need no acknowledgement
+    len = 0;
+    body[len++] = 0;
+    body[len++] = 1;
+    len += put_string(&body[len], bench_topic);
+    body[len++] = 0;
+    return send_packet(conn->fd, MQTT_SUBSCRIBE, body, len) && expect_packet(conn, MQTT_SUBACK);
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *) a;
+    uint64_t y = *(const uint64_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * Publish messages at one QoS and report the results
+ */
+static bool bench_qos(bench_conn_t *conn, int qos, uint32_t messages) {
+    memset(&run, 0, sizeof(run));
+    uint64_t start_us = now_us();
+    uint16_t packet_id = 1;
+
+    for (uint32_t i = 0; i < messages; i++) {
+        // Like lwIP, a QoS 1 publish needs a free request slot until its PUBACK
+        while (qos > 0 && run.in_flight >= MQTT_REQ_MAX_IN_FLIGHT) {
+            if (!process_input(conn, BENCH_TIMEOUT_MS)) {
+                return false;
+            }
+        }
+
+        uint8_t body[160];
+        size_t len = put_string(body, bench_topic);
+        if (qos > 0) {
+            body[len++] = (uint8_t) (packet_id >> 8);
+            body[len++] = (uint8_t) packet_id;
+            packet_id = packet_id == 0xffff ? 1 : packet_id + 1;
+        }
+        len += (size_t) snprintf((char *) &body[len], sizeof(body) - len,
+                                 "{\"seq\":%lu,\"temperature\":21.50}", (unsigned long) i);
+        run.sent_us[i] = now_us();
+        if (!send_packet(conn->fd, (uint8_t) (MQTT_PUBLISH | (qos << 1)), body, len)) {
+            return false;
+        }
+        if (qos > 0) {
+            run.in_flight++;
+        }
+        if (!process_input(conn, 0)) {
+            return false;
+        }
+    }
+
+    uint64_t deadline = now_us() + BENCH_TIMEOUT_MS * 1000ull;
+    while ((run.delivered < messages || run.in_flight > 0) && now_us() < deadline) {
+        if (!process_input(conn, 100)) {
+            return false;
+        }
+    }
+    uint64_t elapsed_us = now_us() - start_us;
+
+    uint64_t latencies[BENCH_MAX_MESSAGES];
+    uint32_t n = 0;
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < messages; i++) {
+        if (run.latency_us[i]) {
+            latencies[n++] = run.latency_us[i];
+            total += run.latency_us[i];
+        }
+    }
+    qsort(latencies, n, sizeof(latencies[0]), compare_u64);
+
+    printf("QoS %d  %6lu  %8.1f  %9.0f  %7.0f  %7.0f  %7.0f  %6lu\n", qos, (unsigned long) n,
+           elapsed_us / 1000.0, n * 1e6 / (double) elapsed_us, n ? (double) total / n : 0.0,
+           n ? (double) latencies[n / 2] : 0.0, n ? (double) latencies[n * 99 / 100] : 0.0,
+           (unsigned long) run.acked);
+    return n == messages;
+}
+
+int main(int argc, char **argv) {
+    const char *host = argc > 1 ? argv[1] : "127.0.0.1";
+    const char *port = argc > 2 ? argv[2] : "1883";
+    uint32_t messages = argc > 3 ? (uint32_t) strtoul(argv[3], NULL, 10) : 2000;
+    if (messages == 0 || messages > BENCH_MAX_MESSAGES) {
+        fprintf(stderr, "messages must be 1-%d\n", BENCH_MAX_MESSAGES);
+        return 2;
+    }
+    snprintf(bench_topic, sizeof(bench_topic), "pico/qosbench%d/state", (int) getpid());
+
+    printf("MQTT QoS benchmark against %s:%s\n", host, port);
+    printf("=========================================\n");
+    bench_conn_t conn;
+    if (!bench_connect(&conn, host, port)) {
+        fprintf(stderr, "Cannot connect to broker at %s:%s\n", host, port);
+        return 2;
+    }
+
+    printf("%d QoS 1 publishes in flight at most\n", MQTT_REQ_MAX_IN_FLIGHT);
+    printf("       msgs        ms      msg/s  mean us   p50 us   p99 us  pubacks\n");
+    CHECK(bench_qos(&conn, 0, messages), "QoS 0 messages not delivered");
+    CHECK(bench_qos(&conn, 1, messages), "QoS 1 messages not delivered");
+    close(conn.fd);
+
+    printf("\n");
+    return host_test_summary();
+}
@@ -0,0 +1,212 @@
+/**
+ * Payload Template Test
+ * Renders the Home Assistant discovery config template with the sensor's
+ * own entities and with random field strings, and checks every payload is
+ * byte-identical to the snprintf() output it replaced, that the length
+ * matches what is written and that nothing is written past it. Also covers
+ * placeholders at either end, next to each other, repeated and unused.
+ * Built by host/CMakeLists.txt; exits non-zero if any check fails.
+ *
+ * Usage: payload_template_test [configs] [seed]
+ *
+ * Copyright (c) 2024 Peter Westlund
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "payload_template.h"
+#include "host_test.h"
+
+/* The sensor's defaults */
+#define HA_DEVICE_NAME "Pico W Sensor"
+#define HA_DEVICE_MODEL "Raspberry Pi Pico W"
+#define HA_DEVICE_MANUFACTURER "Raspberry Pi Foundation"
+#define HA_EXPIRE_AFTER_S 300
+#include "ha_config_template.h"
+
+#define MAX_FIELD_LEN 80
+#define CONFIG_LEN 2048
+#define GUARD_LEN 16
+
+static const char ha_sensor_config_template[] = HA_SENSOR_CONFIG_TEMPLATE;
+
+/**
+ * The discovery config as sensor.c formatted it before the template
+ */
+static int format_reference(const char *const *fields, char *out, size_t size) {
+    return snprintf(out, size,
+                    "{"
+                    "\"name\":\"%s\","
+                    "%s"
+                    "\"state_topic\":\"%s\","
+                    "\"availability_topic\":\"%s\","
+                    "\"payload_available\":\"online\","
+                    "\"payload_not_available\":\"offline\","
+                    "\"unit_of_measurement\":\"%s\","
+                    "\"value_template\":\"{{ value_json.%s }}\","
+                    "\"unique_id\":\"%s_%s\","
+                    "\"device\":{"
+                    "\"identifiers\":[\"%s\"],"
+                    "\"name\":\"%s\","
+                    "\"model\":\"%s\","
+                    "\"manufacturer\":\"%s\","
+                    "\"sw_version\":\"1.0\""
+                    "},"
+                    "\"expire_after\":%d"
+                    "}",
+                    fields[HA_FIELD_NAME], fields[HA_FIELD_DEVICE_CLASS],
+                    fields[HA_FIELD_STATE_TOPIC], fields[HA_FIELD_AVAILABILITY_TOPIC],
+                    fields[HA_FIELD_UNIT], fields[HA_FIELD_VALUE_KEY],
+                    fields[HA_FIELD_DEVICE_ID], fields[HA_FIELD_OBJECT_ID],
+                    fields[HA_FIELD_DEVICE_ID], HA_DEVICE_NAME, HA_DEVICE_MODEL,
+                    HA_DEVICE_MANUFACTURER, HA_EXPIRE_AFTER_S);
+}
+
+/**
+ * Render a template into a guarded buffer and compare it with the expected text
+ */
+static void check_render(const char *label, const char *tmpl, const char *const *fields,
+                         const char *expected) {
+    static char out[CONFIG_LEN + GUARD_LEN];
+    size_t expected_len = strlen(expected);
+    size_t len = payload_template_length(tmpl, fields);
+    CHECK(len == expected_len, "%s: length %zu, expected %zu", label, len, expected_len);
+    if (len != expected_len || len > CONFIG_LEN) {
+        return;
+    }
+
+    memset(out, 0xa5, sizeof(out));
+    size_t written = payload_template_render(tmpl, fields, out);
+    CHECK(written == len, "%s: wrote %zu bytes, length said %zu", label, written, len);
+    if (memcmp(out, expected, expected_len) != 0) {
+        size_t at = 0;
+        while (out[at] == expected[at]) {
+            at++;
+        }
+        CHECK(false, "%s: differs at byte %zu: %.40s", label, at, &out[at]);
+    }
+    for (size_t i = len; i < len + GUARD_LEN; i++) {
+        if ((uint8_t) out[i] != 0xa5) {
+            CHECK(false, "%s: byte %zu written past the payload", label, i);
+            break;
+        }
+    }
+}
+
+static void check_config(const char *label, const char *const *fields) {
+    static char expected[CONFIG_LEN];
+    int len = format_reference(fields, expected, sizeof(expected));
+    CHECK(len > 0 && len < (int) sizeof(expected), "%s: reference too long", label);
+    check_render(label, ha_sensor_config_template, fields, expected);
+}
+
+/**
+ * Configs of the entities the sensor registers, with and without a device class
+ */
+static void test_sensor_entities(void) {
+    static const struct {
+        const char *name;
+        const char *device_class_attr;
+        const char *object_id;
+        const char *unit;
+    } entities[] = {
+        {"Pico Onboard Temperature", "\"device_class\":\"temperature\",", "temperature_onboard",
+         "°C"},
+        {"Pico External Temperature 8a3c", "\"device_class\":\"temperature\",",
+         "temperature_external_8a3c", "°C"},
+        {"Pico WiFi Signal", "\"device_class\":\"signal_strength\",", "rssi", "dBm"},
+        {"Pico Onboard Temperature Mean", "\"device_class\":\"temperature\",",
+         "temperature_onboard_mean", "°C"},
+        {"Pico Onboard Temperature Count", "", "temperature_onboard_count", ""},
+    };
+    const char *device_id = "e6614103e7452d2f";
+    const char *availability_topic = "pico/e6614103e7452d2f/status";
+
+    for (size_t i = 0; i < sizeof(entities) / sizeof(entities[0]); i++) {
+        char state_topic[96];
+        snprintf(state_topic, sizeof(state_topic), "pico/%s/%s", device_id, entities[i].object_id);
+        const char *fields[HA_FIELD_COUNT] = {
+            [HA_FIELD_NAME] = entities[i].name,
+            [HA_FIELD_DEVICE_CLASS] = entities[i].device_class_attr,
+            [HA_FIELD_STATE_TOPIC] = state_topic,
+            [HA_FIELD_AVAILABILITY_TOPIC] = availability_topic,
+            [HA_FIELD_UNIT] = entities[i].unit,
+            [HA_FIELD_VALUE_KEY] = entities[i].object_id,
+            [HA_FIELD_DEVICE_ID] = device_id,
+            [HA_FIELD_OBJECT_ID] = entities[i].object_id,
+        };
+        check_config(entities[i].object_id, fields);
+    }
+}
+
+/**
+ * Random printable field text, sometimes empty, never a placeholder byte
+ */
+static void random_field(char *field) {
+    size_t len = rng_below(8) == 0 ? 0 : rng_below(MAX_FIELD_LEN + 1);
+    for (size_t i = 0; i < len; i++) {
+        // Mostly ASCII, now and then a UTF-8 lead or continuation byte
+        field[i] = (char) (rng_below(16) == 0 ? 0x80 + rng_below(0x80) : ' ' + rng_below(95));
+    }
+    field[len] = '\0';
+}
+
+static void test_random_configs(unsigned long configs) {
+    static char strings[HA_FIELD_COUNT][MAX_FIELD_LEN + 1];
+    for (unsigned long c = 0; c < configs && !host_test_bailed(); c++) {
+        const char *fields[HA_FIELD_COUNT] = {NULL};
+        for (int f = 1; f < HA_FIELD_COUNT; f++) {
+            random_field(strings[f]);
+            fields[f] = strings[f];
+        }
+        char label[40];
+        snprintf(label, sizeof(label), "random config %lu", c);
+        check_config(label, fields);
+    }
+}
+
+/**
+ * Placeholders in the positions the discovery config does not use
+ */
+static void test_placement(void) {
+    const char *fields[PAYLOAD_TEMPLATE_MAX_FIELD + 1] = {
+        NULL, "one", "", "three", "4", "five", "", "seven", "eight",
+    };
+    check_render("empty template", "", fields, "");
+    check_render("no placeholders", "{\"a\":1}", fields, "{\"a\":1}");
+    check_render("only a placeholder", PAYLOAD_TEMPLATE_FIELD(1), fields, "one");
+    check_render("only an empty field", PAYLOAD_TEMPLATE_FIELD(2), fields, "");
+    check_render("placeholders at both ends",
+                 PAYLOAD_TEMPLATE_FIELD(3) "-" PAYLOAD_TEMPLATE_FIELD(8), fields, "three-eight");
+    check_render("adjacent placeholders",
+                 PAYLOAD_TEMPLATE_FIELD(1) PAYLOAD_TEMPLATE_FIELD(2) PAYLOAD_TEMPLATE_FIELD(3)
+                     PAYLOAD_TEMPLATE_FIELD(6) PAYLOAD_TEMPLATE_FIELD(4),
+                 fields, "onethree4");
+    check_render("repeated placeholder",
+                 "<" PAYLOAD_TEMPLATE_FIELD(7) "|" PAYLOAD_TEMPLATE_FIELD(7) ">", fields,
+                 "<seven|seven>");
+    check_render("every field",
+                 PAYLOAD_TEMPLATE_FIELD(1) PAYLOAD_TEMPLATE_FIELD(2) PAYLOAD_TEMPLATE_FIELD(3)
+                     PAYLOAD_TEMPLATE_FIELD(4) PAYLOAD_TEMPLATE_FIELD(5) PAYLOAD_TEMPLATE_FIELD(6)
+                         PAYLOAD_TEMPLATE_FIELD(7) PAYLOAD_TEMPLATE_FIELD(8),
+                 fields, "onethree4fiveseveneight");
+    // Field 8 is octal \10; a following digit must not join the escape
+    check_render("digit after field 8", PAYLOAD_TEMPLATE_FIELD(8) "9", fields, "eight9");
+}
+
+int main(int argc, char **argv) {
+    unsigned long configs = argc > 1 ? strtoul(argv[1], NULL, 0) : 10000;
+    unsigned long long seed = argc > 2 ? strtoull(argv[2], NULL, 0) : 0x5eed;
+    rng_seed(seed);
+
+    test_sensor_entities();
+    test_placement();
+    test_random_configs(configs);
+
+    printf("%lu random configs, seed 0x%llx\n", configs, seed);
+    return host_test_summary();
+}
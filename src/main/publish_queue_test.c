@@ -0,0 +1,263 @@
+/**
+ * Publish Queue Test
+ * Checks the outgoing message queue: class order and first-in first-out
+ * within a class, same-topic coalescing that keeps the message's place in
+ * line, lower classes pushed out for higher ones, refusal when nothing can
+ * make room, and payloads kept intact as release_payload() moves later ones
+ * down, the last over a long run of random operations.
+ * Built by host/CMakeLists.txt; exits non-zero if any check fails.
+ *
+ * Usage: publish_queue_test [operations] [seed]
+ *
+ * Copyright (c) 2024 Peter Westlund
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "publish_queue.h"
+#include "host_test.h"
+
+#define TOPICS 8
+#define MAX_PAYLOAD 400
+
+/* Interned topics, compared by pointer */
+static const char topics[TOPICS][16] = {"t0", "t1", "t2", "t3", "t4", "t5", "t6", "t7"};
+
+/**
+ * Payload byte i of the message with the given id
+ */
+static uint8_t pattern(uint32_t id, size_t i) {
+    return (uint8_t) (id * 31 + i * 7 + 1);
+}
+
+/**
+ * Queue a message whose payload starts with its id and continues with a pattern
+ */
+static bool push(publish_queue_t *queue, publish_class_t class, int topic, uint32_t id,
+                 size_t len, bool coalesce) {
+    static uint8_t payload[PUBLISH_QUEUE_SIZE];
+    len = len < sizeof(id) ? sizeof(id) : len > sizeof(payload) ? sizeof(payload) : len;
+    memcpy(payload, &id, sizeof(id));
+    for (size_t i = sizeof(id); i < len; i++) {
+        payload[i] = pattern(id, i);
+    }
+    return publish_queue_push(queue, class, topics[topic], payload, len, 0, false, coalesce);
+}
+
+static uint32_t entry_id(const publish_queue_t *queue, const publish_entry_t *entry) {
+    uint32_t id;
+    memcpy(&id, publish_queue_payload(queue, entry), sizeof(id));
+    return id;
+}
+
+/**
+ * Check every payload is intact and the buffer is packed without gaps or overlaps
+ */
+static bool check_payloads(const publish_queue_t *queue, const char *when) {
+    size_t total = 0;
+    for (int i = 0; i < queue->count; i++) {
+        const publish_entry_t *entry = &queue->entries[i];
+        total += entry->len;
+        if ((size_t) entry->offset + entry->len > queue->used) {
+            CHECK(false, "%s: entry %d past the used bytes", when, i);
+            return false;
+        }
+        const uint8_t *payload = publish_queue_payload(queue, entry);
+        uint32_t id = entry_id(queue, entry);
+        for (size_t b = sizeof(id); b < entry->len; b++) {
+            if (payload[b] != pattern(id, b)) {
+                CHECK(false, "%s: payload of message %u corrupted at byte %zu", when, id, b);
+                return false;
+            }
+        }
+        for (int j = 0; j < i; j++) {
+            const publish_entry_t *other = &queue->entries[j];
+            if (entry->offset < other->offset + other->len &&
+                other->offset < entry->offset + entry->len) {
+                CHECK(false, "%s: payloads of entries %d and %d overlap", when, i, j);
+                return false;
+            }
+        }
+    }
+    CHECK(total == queue->used, "%s: %zu bytes used, payloads take %zu", when, queue->used,
+          total);
+    return total == queue->used;
+}
+
+/**
+ * Pop everything, checking the ids come out in the given order
+ */
+static void check_order(publish_queue_t *queue, const uint32_t *ids, int count,
+                        const char *what) {
+    for (int i = 0; i < count; i++) {
+        const publish_entry_t *entry = publish_queue_peek(queue);
+        if (!entry) {
+            CHECK(false, "%s: queue empty after %d of %d", what, i, count);
+            return;
+        }
+        uint32_t id = entry_id(queue, entry);
+        CHECK(id == ids[i], "%s: message %u sent as #%d, expected %u", what, id, i, ids[i]);
+        publish_queue_pop(queue, true);
+        check_payloads(queue, what);
+    }
+    CHECK(publish_queue_peek(queue) == NULL, "%s: %d messages left", what,
+          publish_queue_depth(queue));
+}
+
+static void test_order(void) {
+    static publish_queue_t queue;
+    publish_queue_init(&queue);
+    push(&queue, PUBLISH_CLASS_DIAGNOSTIC, 0, 1, 20, false);
+    push(&queue, PUBLISH_CLASS_STATE, 1, 2, 20, false);
+    push(&queue, PUBLISH_CLASS_DISCOVERY, 2, 3, 20, false);
+    push(&queue, PUBLISH_CLASS_STATE, 3, 4, 20, false);
+    push(&queue, PUBLISH_CLASS_AVAILABILITY, 4, 5, 20, false);
+    push(&queue, PUBLISH_CLASS_DISCOVERY, 5, 6, 20, false);
+    CHECK(publish_queue_class_depth(&queue, PUBLISH_CLASS_STATE) == 2, "state depth");
+    static const uint32_t expected[] = {5, 3, 6, 2, 4, 1};
+    check_order(&queue, expected, 6, "class order");
+}
+
+static void test_coalesce(void) {
+    static publish_queue_t queue;
+    publish_queue_init(&queue);
+    push(&queue, PUBLISH_CLASS_STATE, 0, 1, 30, true);
+    push(&queue, PUBLISH_CLASS_STATE, 1, 2, 30, true);
+    push(&queue, PUBLISH_CLASS_STATE, 2, 3, 30, true);
+    // A newer, longer value for topic 0 replaces it in first place
+    push(&queue, PUBLISH_CLASS_STATE, 0, 4, 50, true);
+    // Same topic in another class is a different message
+    push(&queue, PUBLISH_CLASS_DIAGNOSTIC, 1, 5, 30, true);
+    // Without coalescing the same topic queues twice
+    push(&queue, PUBLISH_CLASS_STATE, 2, 6, 30, false);
+
+    CHECK(queue.stats[PUBLISH_CLASS_STATE].coalesced == 1, "%u coalesced",
+          queue.stats[PUBLISH_CLASS_STATE].coalesced);
+    CHECK(publish_queue_depth(&queue) == 5, "%d queued", publish_queue_depth(&queue));
+    check_payloads(&queue, "coalesce");
+    static const uint32_t expected[] = {4, 2, 3, 6, 5};
+    check_order(&queue, expected, 5, "coalesce");
+}
+
+static void test_eviction(void) {
+    static publish_queue_t queue;
+    publish_queue_init(&queue);
+
+    // Fill the bytes with diagnostics and states
+    const size_t len = PUBLISH_QUEUE_SIZE / 8;
+    for (uint32_t id = 1; id <= 4; id++) {
+        CHECK(push(&queue, PUBLISH_CLASS_DIAGNOSTIC, (int) id, id, len, false), "diagnostic %u",
+              id);
+    }
+    for (uint32_t id = 5; id <= 8; id++) {
+        CHECK(push(&queue, PUBLISH_CLASS_STATE, (int) id - 4, id, len, false), "state %u", id);
+    }
+    CHECK(!publish_queue_fits(&queue, 1), "queue not full");
+
+    // Availability pushes out the newest of the lowest class
+    CHECK(push(&queue, PUBLISH_CLASS_AVAILABILITY, 0, 9, len, false), "availability refused");
+    CHECK(queue.stats[PUBLISH_CLASS_DIAGNOSTIC].dropped == 1, "no diagnostic pushed out");
+    CHECK(queue.stats[PUBLISH_CLASS_STATE].dropped == 0, "state pushed out before diagnostics");
+    check_payloads(&queue, "eviction");
+
+    // Two slots' worth pushes out two more diagnostics
+    CHECK(push(&queue, PUBLISH_CLASS_DISCOVERY, 0, 10, 2 * len, false), "discovery refused");
+    CHECK(queue.stats[PUBLISH_CLASS_DIAGNOSTIC].dropped == 3, "%u diagnostics pushed out",
+          queue.stats[PUBLISH_CLASS_DIAGNOSTIC].dropped);
+    check_payloads(&queue, "eviction");
+
+    static const uint32_t expected[] = {9, 10, 5, 6, 7, 8, 1};
+    check_order(&queue, expected, 7, "eviction");
+}
+
+static void test_refusal(void) {
+    static publish_queue_t queue;
+    publish_queue_init(&queue);
+
+    const size_t len = PUBLISH_QUEUE_SIZE / 4;
+    for (uint32_t id = 1; id <= 4; id++) {
+        push(&queue, PUBLISH_CLASS_STATE, (int) id, id, len, false);
+    }
+    // Nothing of a lower class to push out
+    CHECK(!push(&queue, PUBLISH_CLASS_STATE, 0, 5, len, false), "state accepted into full queue");
+    CHECK(!push(&queue, PUBLISH_CLASS_DIAGNOSTIC, 0, 6, 1, false), "diagnostic accepted");
+    CHECK(queue.stats[PUBLISH_CLASS_STATE].dropped == 1 &&
+              queue.stats[PUBLISH_CLASS_DIAGNOSTIC].dropped == 1,
+          "refusals not counted");
+    CHECK(publish_queue_depth(&queue) == 4, "queued messages lost on refusal");
+
+    // Larger than the whole queue
+    publish_queue_init(&queue);
+    CHECK(publish_queue_reserve(&queue, PUBLISH_CLASS_AVAILABILITY, topics[0],
+                                PUBLISH_QUEUE_SIZE + 1, 0, false, false) == NULL,
+          "oversized message accepted");
+
+    // Out of entries before out of bytes
+    for (uint32_t id = 0; id < PUBLISH_QUEUE_ENTRIES; id++) {
+        push(&queue, PUBLISH_CLASS_DISCOVERY, 0, id, 4, false);
+    }
+    CHECK(!push(&queue, PUBLISH_CLASS_DISCOVERY, 1, 99, 4, false), "entry past the table");
+    // A higher class takes the newest lower class entry
+    CHECK(push(&queue, PUBLISH_CLASS_AVAILABILITY, 1, 100, 4, false), "availability refused");
+    CHECK(publish_queue_peek(&queue) && entry_id(&queue, publish_queue_peek(&queue)) == 100,
+          "availability not first");
+    CHECK(queue.stats[PUBLISH_CLASS_DISCOVERY].dropped == 2, "discovery not pushed out");
+    CHECK(queue.high_water == PUBLISH_QUEUE_ENTRIES, "high water %d", queue.high_water);
+
+    publish_queue_clear(&queue);
+    CHECK(publish_queue_depth(&queue) == 0 && queue.used == 0, "clear left messages");
+    // The oversized one and the one cleared
+    CHECK(queue.stats[PUBLISH_CLASS_AVAILABILITY].dropped == 2, "cleared availability not counted");
+    CHECK(queue.stats[PUBLISH_CLASS_DISCOVERY].dropped == PUBLISH_QUEUE_ENTRIES + 1,
+          "cleared messages not counted dropped");
+}
+
+/**
+ * Random pushes, coalesces and pops, checking the packed payloads after each
+ */
+static void test_random(unsigned long operations) {
+    static publish_queue_t queue;
+    publish_queue_init(&queue);
+    uint32_t next_id = 1;
+    uint32_t accepted = 0;
+    uint32_t popped = 0;
+
+    for (unsigned long op = 0; op < operations && !host_test_bailed(); op++) {
+        if (rng_below(3) == 0) {
+            const publish_entry_t *entry = publish_queue_peek(&queue);
+            publish_class_t before = entry ? (publish_class_t) entry->class : PUBLISH_CLASS_COUNT;
+            publish_queue_pop(&queue, rng_below(4) != 0);
+            popped += before != PUBLISH_CLASS_COUNT;
+            // Nothing left may outrank what was just sent
+            entry = publish_queue_peek(&queue);
+            CHECK(!entry || entry->class >= before, "op %lu: class %u sent before class %u",
+                  op, before, entry ? entry->class : 0);
+        } else {
+            publish_class_t class = (publish_class_t) rng_below(PUBLISH_CLASS_COUNT);
+            size_t len = rng_below(8) == 0 ? rng_below(MAX_PAYLOAD) : rng_below(64);
+            accepted += push(&queue, class, (int) rng_below(TOPICS), next_id++, len,
+                             rng_below(2) != 0);
+        }
+        char when[32];
+        snprintf(when, sizeof(when), "op %lu", op);
+        check_payloads(&queue, when);
+    }
+    printf("Random: %lu operations, %u accepted, %u popped, high water %d\n", operations,
+           accepted, popped, queue.high_water);
+}
+
+int main(int argc, char **argv) {
+    unsigned long operations = argc > 1 ? strtoul(argv[1], NULL, 0) : 100000;
+    unsigned long long seed = argc > 2 ? strtoull(argv[2], NULL, 0) : 0x5eed;
+    rng_seed(seed);
+
+    test_order();
+    test_coalesce();
+    test_eviction();
+    test_refusal();
+    test_random(operations);
+
+    return host_test_summary();
+}
@@ -11,7 +11,11 @@
 /* Standard library includes */
 #include "pico/stdlib.h"
 #include "pico/cyw43_arch.h"
+#include "pico/multicore.h"
+#include "pico/async_context_poll.h"
 #include "pico/unique_id.h"
+#include "pico/rand.h"
+#include "pico/flash.h"
 #include "hardware/gpio.h"
 #include "hardware/irq.h"
 #include "hardware/adc.h"
@@ -19,9 +23,27 @@
 #include "lwip/apps/mqtt_priv.h" /* needed to set hostname */
 #include "lwip/dns.h"
 #include "lwip/altcp_tls.h"
-#include <math.h> /* for fabs */
+#include <stdlib.h> /* for abs */
 #include "version_display.h"
 #include "ds18b20.h" /* for external temperature sensor */
+#include "adc_capture.h" /* for oversampled onboard temperature */
+#include "fixed_format.h" /* for integer-only payload formatting */
+#include "sample_ring.h"
+#include "sensor_registry.h"
+#include "topic_arena.h"
+#include "history_ring.h"
+#include "publish_queue.h"
+#include "cbor_encode.h" /* for compact binary payloads */
+#include "payload_template.h" /* for discovery configs */
+#include "ha_config_template.h"
+#include "flash_settings.h" /* for the discovery hash across reboots */
+#include "stats_window.h" /* for per-publish aggregates */
+#include "wall_clock.h" /* for sample timestamps */
+#include "mqtt_assembler.h" /* for fragmented incoming messages */
+#include "lwip/apps/sntp.h"
+#if SENSOR_FLASH_LOG
+#include "flash_log.h"
+#endif
 
 /* Configuration constants */
 
@@ -30,11 +52,40 @@
 #define TEMPERATURE_UNITS 'C' /* Set to 'F' for Fahrenheit */
 #endif
 
+#if TEMPERATURE_UNITS == 'F'
+#define TEMPERATURE_UNIT_LABEL "°F"
+#else
+#define TEMPERATURE_UNIT_LABEL "°C"
+#endif
+
+/* DS18B20 read mode: 1 reads only the temperature bytes, trading CRC for bus time */
+#ifndef DS18B20_FAST_READ
+#define DS18B20_FAST_READ 0
+#endif
+
+/* DS18B20 GPIO pins, comma separated, one 1-Wire bus per pin */
+#ifndef DS18B20_GPIO_PINS
+#define DS18B20_GPIO_PINS 2
+#endif
+
+/* DS18B20 conversion resolution in bits (9-12) */
+#ifndef DS18B20_RESOLUTION
+#define DS18B20_RESOLUTION 12
+#endif
+
 /* Home Assistant MQTT Discovery configuration */
 #ifndef HA_DISCOVERY_PREFIX
 #define HA_DISCOVERY_PREFIX "homeassistant"
 #endif
 
+/* Home Assistant publishes its birth message "online" here when it starts */
+#define HA_STATUS_TOPIC HA_DISCOVERY_PREFIX "/status"
+
+/* Discovery is resent up to this long after a birth message, so a fleet does not answer at once */
+#ifndef HA_BIRTH_JITTER_MS
+#define HA_BIRTH_JITTER_MS 5000
+#endif
+
 #ifndef HA_DEVICE_NAME
 #define HA_DEVICE_NAME "Pico W Sensor"
 #endif
@@ -71,15 +122,17 @@
 #endif
 
 #ifndef MQTT_CONFIG_LEN
-#define MQTT_CONFIG_LEN 1000 // For HA discovery config payloads
+#define MQTT_CONFIG_LEN 1000 // Longest HA discovery config payload
+#endif
+
+#ifndef MQTT_PAYLOAD_LEN
+#define MQTT_PAYLOAD_LEN 160 // For sensor state payloads, aggregates included
 #endif
 
 typedef struct {
     mqtt_client_t *mqtt_client_inst;
     struct mqtt_connect_client_info_t mqtt_client_info;
-    char data[MQTT_OUTPUT_RINGBUF_SIZE];
-    char topic[MQTT_TOPIC_LEN];
-    uint32_t len;
+    mqtt_assembler_t incoming; // Reassembles incoming publishes
     ip_addr_t mqtt_server_address;
     bool connect_done;
     int subscribe_count;
@@ -87,6 +140,28 @@ typedef struct {
     char device_id[16];                  // Unique device identifier
     bool ha_discovery_sent;              // Track if HA discovery has been sent
     absolute_time_t discovery_send_time; // When to send discovery
+    uint32_t discovery_hash;             // Hash of every discovery config, see ha_discovery_hash()
+
+    // Interned topics, built once by build_topics()
+    const char *availability_topic;
+    const char *state_topic;   // Batched state topic, with MQTT_BATCH_STATE
+    const char *history_topic; // Readings replayed after an outage
+    const char *cbor_state_topic;   // CBOR copy of the batched state, with MQTT_CBOR
+    const char *cbor_history_topic; // CBOR history replay, with MQTT_CBOR
+    const char *queue_topic;   // Publish queue counters
+    const char *ha_status_topic; // Home Assistant birth and last will
+    const char *led_state_topic;
+    const char *uptime_topic;
+    const char *command_filter; // Wildcard over every command topic
+    const char *command_prefix; // Command topics are this plus the command name
+    size_t command_prefix_len;
+
+    int discovery_next;            // Next entity whose discovery config is still to be queued
+    bool discovery_round;          // Discovery configs are being sent, see finish_discovery_round()
+    bool discovery_failed;         // A config of this round was not delivered
+    uint32_t discovery_dropped;    // Discovery messages the queue had dropped when the round began
+    int discovery_in_flight;       // Configs handed to lwIP, awaiting their callback
+    bool discovery_resend_pending; // Home Assistant restarted and has not had every config since
 } MQTT_CLIENT_DATA_T;
 
 /* Debug level configuration
@@ -136,375 +211,1901 @@ typedef struct {
 #endif
 
 /* Timing constants */
-#define TEMP_WORKER_TIME_S 10 /* Temperature measurement interval in seconds */
+#ifndef TEMP_WORKER_TIME_S
+#define TEMP_WORKER_TIME_S 10 /* Publish interval in seconds */
+#endif
+
+// Set to 1 to publish min, max, mean, standard deviation and count of the samples taken since
+// the last publish with every temperature, as extra Home Assistant entities
+#ifndef SENSOR_AGGREGATE
+#define SENSOR_AGGREGATE 0
+#endif
+
+/* Sensor sampling interval; with SENSOR_AGGREGATE several samples make up each publish */
+#ifndef SENSOR_SAMPLE_INTERVAL_MS
+#if SENSOR_AGGREGATE
+#define SENSOR_SAMPLE_INTERVAL_MS 1000
+#else
+#define SENSOR_SAMPLE_INTERVAL_MS (TEMP_WORKER_TIME_S * 1000)
+#endif
+#endif
+
+/* NTP server for sample timestamps; the resync interval is SNTP_SYNC_INTERVAL_S in lwipopts.h */
+#ifndef SNTP_SERVER
+#define SNTP_SERVER "pool.ntp.org"
+#endif
 #define MQTT_KEEP_ALIVE_S                                                                          \
     30 /* MQTT keep-alive interval - reduced for better connection detection */
 
-/* MQTT QoS settings
- * QoS 0: At most once delivery
- * QoS 1: At least once delivery
- * QoS 2: Exactly once delivery
+/* MQTT QoS settings
+ * QoS 0: At most once delivery
+ * QoS 1: At least once delivery
+ * QoS 2: Exactly once delivery
+ */
+#define MQTT_SUBSCRIBE_QOS 1 /* Command wildcard; Home Assistant status */
+
+/* Per message class, see publish_class_policies */
+#ifndef MQTT_AVAILABILITY_QOS
+#define MQTT_AVAILABILITY_QOS 1
+#endif
+
+#ifndef MQTT_DISCOVERY_QOS
+#define MQTT_DISCOVERY_QOS 1
+#endif
+
+/* States are superseded every publish interval, so by default they do not wait for a PUBACK */
+#ifndef MQTT_STATE_QOS
+#define MQTT_STATE_QOS 0
+#endif
+
+#ifndef MQTT_STATE_RETAIN
+#define MQTT_STATE_RETAIN 0
+#endif
+
+#ifndef MQTT_DIAGNOSTIC_QOS
+#define MQTT_DIAGNOSTIC_QOS 0
+#endif
+
+/* History readings exist nowhere else once dropped from the store */
+#ifndef MQTT_HISTORY_QOS
+#define MQTT_HISTORY_QOS 1
+#endif
+
+/* Last Will and Testament configuration */
+#define MQTT_WILL_TOPIC "/online"
+#define MQTT_WILL_MSG "0"
+#define MQTT_WILL_QOS 1
+
+#ifndef MQTT_DEVICE_NAME
+#define MQTT_DEVICE_NAME "pico"
+#endif
+
+// Set to 1 to add the client name to topics, to support multiple devices using the same server
+#ifndef MQTT_UNIQUE_TOPIC
+#define MQTT_UNIQUE_TOPIC 0
+#endif
+
+// Set to 1 to publish all readings of a cycle as one JSON object on pico/<device>/state
+#ifndef MQTT_BATCH_STATE
+#define MQTT_BATCH_STATE 0
+#endif
+
+#ifndef MQTT_BATCH_PAYLOAD_LEN
+#define MQTT_BATCH_PAYLOAD_LEN 1536 // For the batched state object
+#endif
+
+// Set to 1 to also publish the batched state as CBOR on pico/<device>/state/cbor, and to
+// replay history as CBOR on pico/<device>/history/cbor alongside the JSON history
+#ifndef MQTT_CBOR
+#define MQTT_CBOR 0
+#endif
+
+/* Sensor acquisition runs on core1 with its own scheduler; samples reach core0 via this ring */
+static async_context_poll_t sensor_context;
+static sample_ring_t sample_ring;
+
+/* Temperatures are carried in hundredths of a degree; this marks a failed reading */
+#define TEMP_ERROR_CENTI (-99900)
+
+/* Publish policy, see sensor_publish_policy_t */
+
+/* Minimum change in hundredths of a degree before a temperature is republished */
+#ifndef TEMP_DEADBAND_CENTI
+#define TEMP_DEADBAND_CENTI 10
+#endif
+
+/* Minimum change in hundredths of a dB before the WiFi signal strength is republished */
+#ifndef RSSI_DEADBAND_CENTI
+#define RSSI_DEADBAND_CENTI 300
+#endif
+
+/* Relative deadband in thousandths of the last published value; the larger deadband applies */
+#ifndef SENSOR_DEADBAND_PERMILLE
+#define SENSOR_DEADBAND_PERMILLE 0
+#endif
+
+/* Minimum seconds between publishes of one entity */
+#ifndef SENSOR_MIN_INTERVAL_S
+#define SENSOR_MIN_INTERVAL_S 0
+#endif
+
+/* Maximum seconds an entity stays silent; must stay below the Home Assistant expire_after */
+#ifndef SENSOR_MAX_SILENCE_S
+#define SENSOR_MAX_SILENCE_S 240
+#endif
+
+/* Home Assistant marks an entity unavailable after this long without a state */
+#define HA_EXPIRE_AFTER_S 300
+
+static_assert(SENSOR_MAX_SILENCE_S + TEMP_WORKER_TIME_S < HA_EXPIRE_AFTER_S,
+              "SENSOR_MAX_SILENCE_S must leave a publish cycle before expire_after");
+
+static const sensor_publish_policy_t temperature_policy = {
+    .deadband = TEMP_DEADBAND_CENTI,
+    .deadband_permille = SENSOR_DEADBAND_PERMILLE,
+    .min_interval_ms = SENSOR_MIN_INTERVAL_S * 1000,
+    .max_silence_ms = SENSOR_MAX_SILENCE_S * 1000,
+};
+
+/* Readings per history message replayed after an outage */
+#ifndef HISTORY_REPLAY_BATCH
+#define HISTORY_REPLAY_BATCH 12
+#endif
+
+/* Interval between history messages while replaying */
+#ifndef HISTORY_REPLAY_INTERVAL_MS
+#define HISTORY_REPLAY_INTERVAL_MS 250
+#endif
+
+#ifndef HISTORY_PAYLOAD_LEN
+#define HISTORY_PAYLOAD_LEN 768 // For history messages
+#endif
+
+/* History messages in flight at once; other MQTT_REQ_MAX_IN_FLIGHT slots stay free for states */
+#define HISTORY_MAX_IN_FLIGHT (MQTT_REQ_MAX_IN_FLIGHT / 2)
+
+/* Messages per history batch: the JSON one, plus its CBOR copy with MQTT_CBOR */
+#define HISTORY_BATCH_MESSAGES (MQTT_CBOR ? 2 : 1)
+
+/* History batches in flight at once, at least one */
+#define HISTORY_MAX_BATCHES                                                                       \
+    (HISTORY_MAX_IN_FLIGHT >= HISTORY_BATCH_MESSAGES                                              \
+         ? HISTORY_MAX_IN_FLIGHT / HISTORY_BATCH_MESSAGES                                         \
+         : 1)
+
+/* Readings taken while the broker is unreachable, replayed to the history topic on reconnect */
+static history_ring_t history_ring;
+
+/**
+ * History messages awaiting their PUBACK, all carrying the same readings
+ * The readings stay stored until then, so a message lost with the connection is sent again.
+ */
+typedef struct {
+    MQTT_CLIENT_DATA_T *state;
+    size_t n;        // Readings in the batch
+    uint8_t pending; // Messages sent whose callback has not been seen yet
+    bool failed;     // A message of the batch was not delivered
+} history_batch_t;
+
+/* History batches in flight, in send order from history_batch_head */
+static history_batch_t history_batches[HISTORY_MAX_BATCHES];
+static size_t history_batch_head = 0;
+static size_t history_batch_count = 0;
+static size_t history_unacked = 0; // Readings in flight, passed over when peeking the next batch
+
+/* Messages waiting for room in the MQTT client, drained as earlier publishes complete */
+static publish_queue_t publish_queue;
+
+/**
+ * QoS and retain flag of each message class
+ * Availability and discovery are retained so Home Assistant finds them after a restart.
+ */
+typedef struct {
+    uint8_t qos;
+    bool retain;
+} publish_class_policy_t;
+
+static const publish_class_policy_t publish_class_policies[PUBLISH_CLASS_COUNT] = {
+    [PUBLISH_CLASS_AVAILABILITY] = {.qos = MQTT_AVAILABILITY_QOS, .retain = true},
+    [PUBLISH_CLASS_DISCOVERY] = {.qos = MQTT_DISCOVERY_QOS, .retain = true},
+    [PUBLISH_CLASS_STATE] = {.qos = MQTT_STATE_QOS, .retain = MQTT_STATE_RETAIN},
+    [PUBLISH_CLASS_DIAGNOSTIC] = {.qos = MQTT_DIAGNOSTIC_QOS, .retain = false},
+};
+
+/* Retry interval while the MQTT client has no room for the next queued message */
+#ifndef PUBLISH_QUEUE_RETRY_MS
+#define PUBLISH_QUEUE_RETRY_MS 100
+#endif
+
+/* Interval between publishes of the queue counters */
+#ifndef PUBLISH_STATS_INTERVAL_S
+#define PUBLISH_STATS_INTERVAL_S 60
+#endif
+
+/**
+ * Settings kept in flash across reboots
+ */
+typedef struct {
+    uint32_t discovery_hash;              // Hash of the discovery configs last sent in full
+    uint8_t legacy_rom[DS18B20_ROM_SIZE]; // Probe behind temperature_external, zero if none yet
+} sensor_settings_t;
+
+static_assert(sizeof(sensor_settings_t) == FLASH_SETTINGS_SIZE, "settings must fill a record");
+
+static sensor_settings_t sensor_settings;
+
+/* Set to 1 to keep outage readings in a flash log that survives power loss, instead of RAM */
+#ifndef SENSOR_FLASH_LOG
+#define SENSOR_FLASH_LOG 0
+#endif
+
+#if SENSOR_FLASH_LOG
+/**
+ * Flash log payload for one reading
+ * Uptimes restart at every boot, so each record carries a boot number; it
+ * continues from the newest record in the log. The entity is identified by a
+ * hash of its object id rather than its registry index, which shifts as
+ * probes come and go between boots.
+ */
+typedef struct {
+    uint32_t time_ms;   // Milliseconds since boot, low 32 bits
+    uint16_t boot;      // Boot the reading was taken in
+    uint16_t key;       // entity_history_key() of the entity
+    uint8_t time_ms_hi; // Milliseconds since boot, bits 32-39
+    uint8_t value[3];   // Value in hundredths, 24-bit two's complement, low byte first
+} flash_reading_t;
+
+static_assert(sizeof(flash_reading_t) == FLASH_LOG_PAYLOAD_SIZE, "reading must fill a payload");
+
+/* Largest value a reading holds, about ±83886 in whole units */
+#define FLASH_READING_VALUE_MAX 0x7fffff
+
+static flash_log_t flash_log;
+static bool flash_log_ready = false;
+static uint16_t flash_log_boot = 0;
+#endif
+
+static const sensor_publish_policy_t rssi_policy = {
+    .deadband = RSSI_DEADBAND_CENTI,
+    .deadband_permille = SENSOR_DEADBAND_PERMILLE,
+    .min_interval_ms = SENSOR_MIN_INTERVAL_S * 1000,
+    .max_silence_ms = SENSOR_MAX_SILENCE_S * 1000,
+};
+
+/* Latest sample per source, owned by core0 and updated from sample_ring */
+static sensor_sample_t latest_onboard;
+
+/* References for this implementation:
+ * raspberry-pi-pico-c-sdk.pdf, Section '4.1.1. hardware_adc'
+ * pico-examples/adc/adc_console/adc_console.c
+ * The ADC free-runs into a DMA ring (adc_capture.c); this averages the ring. */
+static int32_t read_onboard_temperature(const char unit) {
+    int32_t tempC = adc_capture_temperature_centi_c();
+
+    if (unit == 'C' || unit != 'F') {
+        return tempC;
+    } else if (unit == 'F') {
+        return ds18b20_celsius_to_fahrenheit(tempC);
+    }
+
+    return -100;
+}
+
+/* One 1-Wire bus per configured GPIO pin */
+static const unsigned int ds18b20_gpio_pins[] = {DS18B20_GPIO_PINS};
+#define DS18B20_BUS_COUNT count_of(ds18b20_gpio_pins)
+static ds18b20_bus_t ds18b20_buses[DS18B20_BUS_COUNT];
+
+/* A DS18B20 probe on one of the buses; fixed once core1 is running */
+typedef struct {
+    ds18b20_bus_t *bus;
+    int index; // Sensor index on the bus
+} ds18b20_probe_t;
+
+static ds18b20_probe_t ds18b20_probes[DS18B20_BUS_COUNT * DS18B20_MAX_DEVICES];
+static int ds18b20_probe_count = 0;
+static sensor_sample_t latest_ds18b20[count_of(ds18b20_probes)];
+
+/* Progress of the DS18B20 acquisition cycle, advanced one bus operation per worker run */
+static struct {
+    bool reading;          // Collecting results, else starting conversions
+    bool busy;             // txn is in progress
+    bool started;          // A conversion was started this cycle
+    int next;              // Bus being started or probe being read
+    absolute_time_t start; // When the cycle began
+    ds18b20_transaction_t txn;
+} ds18b20_cycle;
+
+/* Samples per source since the last publish, indexed like sample sources (core0 only) */
+static stats_window_t sample_windows[1 + count_of(ds18b20_probes)];
+
+/* Unix time of the local timer, kept by SNTP (core0 only) */
+static wall_clock_t wall_clock;
+
+/**
+ * Take an SNTP reply into the wall clock; lwIP calls this through SNTP_SET_SYSTEM_TIME_US
+ */
+void sensor_set_system_time_us(uint32_t sec, uint32_t us) {
+    bool first = !wall_clock_valid(&wall_clock);
+    wall_clock_sync(&wall_clock, time_us_64(), (uint64_t) sec * 1000000 + us);
+    if (first) {
+        INFO_printf("Clock set by SNTP: %lu s since 1970\n", (unsigned long) sec);
+    } else {
+        DEBUG_printf("Clock resynced by SNTP, drift %ld ppb\n", (long) wall_clock.drift_ppb);
+    }
+}
+
+/**
+ * Hand a reading to core0 (core1 only)
+ */
+static void push_sample(uint8_t source, bool valid, int32_t centi_c) {
+    sensor_sample_t sample = {
+        .timestamp_us = time_us_64(),
+        .centi_c = centi_c,
+        .source = source,
+        .valid = valid,
+    };
+    if (!sample_ring_push(&sample_ring, &sample)) {
+        DEBUG_printf("Sample ring full, dropped sample from source %u\n", source);
+    }
+}
+
+/**
+ * Take all queued readings into the latest-value tables (core0 only)
+ */
+static void drain_samples(void) {
+    sensor_sample_t sample;
+    while (sample_ring_pop(&sample_ring, &sample)) {
+        if (sample.source == SAMPLE_SOURCE_ONBOARD) {
+            latest_onboard = sample;
+        } else if (sample.source <= ds18b20_probe_count) {
+            latest_ds18b20[sample.source - 1] = sample;
+        } else {
+            continue;
+        }
+        if (sample.valid) {
+            stats_window_add(&sample_windows[sample.source], sample.centi_c);
+        }
+    }
+}
+
+#if SENSOR_AGGREGATE
+/**
+ * Take samples into the windows between publishes, before the sample ring fills (core0)
+ */
+static void sample_drain_worker_fn(async_context_t *context, async_at_time_worker_t *worker) {
+    drain_samples();
+    async_context_add_at_time_worker_in_ms(context, worker, SENSOR_SAMPLE_INTERVAL_MS);
+}
+static async_at_time_worker_t sample_drain_worker = {.do_work = sample_drain_worker_fn};
+#endif
+
+/**
+ * Onboard ADC sampling worker (core1)
+ */
+static void onboard_worker_fn(async_context_t *context, async_at_time_worker_t *worker) {
+    push_sample(SAMPLE_SOURCE_ONBOARD, true, read_onboard_temperature('C'));
+    async_context_add_at_time_worker_in_ms(context, worker, SENSOR_SAMPLE_INTERVAL_MS);
+}
+static async_at_time_worker_t onboard_worker = {.do_work = onboard_worker_fn};
+
+/**
+ * DS18B20 acquisition worker (core1)
+ * Starts a conversion on every bus, waits the conversion time and then reads
+ * each probe, issuing a single reset or byte per run so the sensor context is
+ * never held longer than one 1-Wire slot. Conversions on all buses run
+ * together, so acquisition takes one conversion period regardless of the
+ * number of buses or probes.
+ */
+static void ds18b20_worker_fn(async_context_t *context, async_at_time_worker_t *worker) {
+    if (ds18b20_cycle.busy) {
+        ds18b20_bus_t *bus = ds18b20_cycle.reading ? ds18b20_probes[ds18b20_cycle.next].bus
+                                                   : &ds18b20_buses[ds18b20_cycle.next];
+        ds18b20_transaction_t *txn = &ds18b20_cycle.txn;
+        if (ds18b20_step(bus, txn)) {
+            async_context_add_at_time_worker_in_ms(context, worker, 0);
+            return;
+        }
+        ds18b20_cycle.busy = false;
+        if (txn->result != DS18B20_OK) {
+            DEBUG_printf("DS18B20 %s %d failed: %s\n", ds18b20_cycle.reading ? "probe" : "bus",
+                         ds18b20_cycle.next, ds18b20_error_string(txn->result));
+        }
+        if (ds18b20_cycle.reading) {
+            push_sample(ds18b20_cycle.next + 1, txn->result == DS18B20_OK, txn->centi_c);
+        } else {
+            ds18b20_cycle.started = ds18b20_cycle.started || txn->result == DS18B20_OK;
+        }
+        ds18b20_cycle.next++;
+    }
+
+    uint32_t conversion_ms = 0;
+    for (size_t b = 0; b < DS18B20_BUS_COUNT; b++) {
+        uint32_t bus_ms = ds18b20_conversion_time_ms(&ds18b20_buses[b]);
+        if (bus_ms > conversion_ms) {
+            conversion_ms = bus_ms;
+        }
+    }
+
+    if (!ds18b20_cycle.reading) {
+        if (ds18b20_cycle.next == 0 && !ds18b20_cycle.started) {
+            ds18b20_cycle.start = get_absolute_time();
+        }
+        while (ds18b20_cycle.next < (int) DS18B20_BUS_COUNT &&
+               ds18b20_device_count(&ds18b20_buses[ds18b20_cycle.next]) == 0) {
+            ds18b20_cycle.next++;
+        }
+        if (ds18b20_cycle.next < (int) DS18B20_BUS_COUNT) {
+            ds18b20_begin_conversion(&ds18b20_buses[ds18b20_cycle.next], &ds18b20_cycle.txn);
+            ds18b20_cycle.busy = true;
+            async_context_add_at_time_worker_in_ms(context, worker, 0);
+            return;
+        }
+        ds18b20_cycle.next = 0;
+        if (!ds18b20_cycle.started) {
+            for (int i = 0; i < ds18b20_probe_count; i++) {
+                push_sample(i + 1, false, 0);
+            }
+            async_context_add_at_time_worker_in_ms(context, worker, SENSOR_SAMPLE_INTERVAL_MS);
+            return;
+        }
+        ds18b20_cycle.started = false;
+        ds18b20_cycle.reading = true;
+        async_context_add_at_time_worker_in_ms(context, worker, conversion_ms);
+        return;
+    }
+
+    if (ds18b20_cycle.next < ds18b20_probe_count) {
+        ds18b20_probe_t *probe = &ds18b20_probes[ds18b20_cycle.next];
+        ds18b20_begin_read(probe->bus, &ds18b20_cycle.txn, probe->index);
+        ds18b20_cycle.busy = true;
+        async_context_add_at_time_worker_in_ms(context, worker, 0);
+        return;
+    }
+
+    // Start the next conversion so a fresh result is ready for the next sample
+    ds18b20_cycle.reading = false;
+    ds18b20_cycle.next = 0;
+    async_context_add_at_time_worker_at(
+        context, worker, delayed_by_ms(ds18b20_cycle.start, SENSOR_SAMPLE_INTERVAL_MS));
+}
+static async_at_time_worker_t ds18b20_worker = {.do_work = ds18b20_worker_fn};
+
+/**
+ * Core1 entry: sensor acquisition on a dedicated polled async context
+ * Keeps the 1-Wire interrupts-off windows away from the cyw43/lwIP interrupts
+ * on core0, and network stalls away from the sampling schedule.
+ */
+static void sensor_core1_entry(void) {
+    if (!async_context_poll_init_with_defaults(&sensor_context)) {
+        panic("Failed to initialize sensor async context");
+    }
+    // Let core0 park this core while it erases or programs the flash log or settings
+    flash_safe_execute_core_init();
+    async_context_add_at_time_worker_in_ms(&sensor_context.core, &onboard_worker, 0);
+    async_context_add_at_time_worker_in_ms(&sensor_context.core, &ds18b20_worker, 0);
+
+    while (true) {
+        async_context_poll(&sensor_context.core);
+        async_context_wait_for_work_until(&sensor_context.core, at_the_end_of_time);
+    }
+}
+
+/**
+ * Read temperature from external DS18B20 sensor
+ * Returns the latest sample received from ds18b20_worker_fn
+ */
+static int32_t read_ds18b20_temperature(int index, const char unit) {
+    if (!latest_ds18b20[index].valid) {
+        return TEMP_ERROR_CENTI; // Return error value - simplified error handling
+    }
+
+    int32_t tempC = latest_ds18b20[index].centi_c;
+    if (unit == 'F') {
+        return ds18b20_celsius_to_fahrenheit(tempC);
+    }
+
+    return tempC;
+}
+
+/* Home Assistant entities; discovery and state publishing iterate over this table */
+static sensor_registry_t sensor_registry;
+
+static bool read_onboard_entity(__unused const sensor_entity_t *entity, int32_t *value) {
+    if (!latest_onboard.valid) {
+        return false;
+    }
+    *value = latest_onboard.centi_c;
+    if (TEMPERATURE_UNITS == 'F') {
+        *value = ds18b20_celsius_to_fahrenheit(*value);
+    }
+    return true;
+}
+
+static bool read_ds18b20_entity(const sensor_entity_t *entity, int32_t *value) {
+    int32_t temp = read_ds18b20_temperature(entity->arg, TEMPERATURE_UNITS);
+    if (temp == TEMP_ERROR_CENTI) {
+        return false;
+    }
+    *value = temp;
+    return true;
+}
+
+static bool read_rssi_entity(__unused const sensor_entity_t *entity, int32_t *value) {
+    int32_t rssi;
+    if (cyw43_wifi_link_status(&cyw43_state, CYW43_ITF_STA) != CYW43_LINK_UP ||
+        cyw43_wifi_get_rssi(&cyw43_state, &rssi) != 0) {
+        return false;
+    }
+    *value = rssi * 100;
+    return true;
+}
+
+/* Aggregates published with every temperature when SENSOR_AGGREGATE is set */
+typedef enum {
+    AGGREGATE_MIN,
+    AGGREGATE_MAX,
+    AGGREGATE_MEAN,
+    AGGREGATE_STDDEV,
+    AGGREGATE_COUNT,
+} aggregate_kind_t;
+
+#define AGGREGATE_KINDS (AGGREGATE_COUNT + 1)
+
+/* Entities main() registers at most: the onboard temperature and every probe, each with its
+ * aggregates, and rssi */
+#define SENSOR_ENTITIES_MAX \
+    ((1 + count_of(ds18b20_probes)) * (1 + (SENSOR_AGGREGATE ? AGGREGATE_KINDS : 0)) + 1)
+static_assert(SENSOR_REGISTRY_MAX >= SENSOR_ENTITIES_MAX,
+              "SENSOR_REGISTRY_MAX too small for every probe and aggregate");
+
+/**
+ * Sample window of a temperature entity, or NULL if it has none
+ */
+static stats_window_t *entity_window(const sensor_entity_t *entity) {
+    if (entity->read == read_onboard_entity) {
+        return &sample_windows[SAMPLE_SOURCE_ONBOARD];
+    }
+    if (entity->read == read_ds18b20_entity) {
+        return &sample_windows[entity->arg + 1];
+    }
+    return NULL;
+}
+
+/**
+ * Start a new window for the parents of the entities just published
+ */
+static void reset_entity_window(const sensor_entity_t *entity) {
+    stats_window_t *window = entity_window(entity);
+    if (window) {
+        stats_window_reset(window);
+    }
+}
+
+static bool read_aggregate_entity(const sensor_entity_t *entity, int32_t *value) {
+    const stats_window_t *window = entity_window(entity->parent);
+    if (!window || window->count == 0) {
+        return false;
+    }
+    switch ((aggregate_kind_t) entity->arg) {
+        case AGGREGATE_MIN:
+            *value = window->min;
+            break;
+        case AGGREGATE_MAX:
+            *value = window->max;
+            break;
+        case AGGREGATE_MEAN:
+            *value = stats_window_mean(window);
+            break;
+        case AGGREGATE_STDDEV:
+            // A spread scales like a temperature but has no offset
+            *value = stats_window_stddev(window);
+            if (TEMPERATURE_UNITS == 'F') {
+                *value = *value * 9 / 5;
+            }
+            return true;
+        case AGGREGATE_COUNT:
+            *value = (int32_t) window->count; // Whole samples, see add_aggregate_entities()
+            return true;
+    }
+    if (TEMPERATURE_UNITS == 'F') {
+        *value = ds18b20_celsius_to_fahrenheit(*value);
+    }
+    return true;
+}
+
+/**
+ * Local time the value of an entity was sampled, time_us_64() for values read on demand
+ */
+static uint64_t entity_sample_us(const sensor_entity_t *entity) {
+    if (entity->parent) {
+        entity = entity->parent;
+    }
+    if (entity->read == read_onboard_entity) {
+        return latest_onboard.timestamp_us;
+    }
+    if (entity->read == read_ds18b20_entity) {
+        return latest_ds18b20[entity->arg].timestamp_us;
+    }
+    return time_us_64();
+}
+
+/**
+ * Append the Unix time of a sample as a "ts" member in milliseconds, once SNTP has set the clock
+ *
+ * @param len Payload length so far, updated if the member fits
+ * @param size Payload buffer size; a byte is left for the closing brace
+ */
+static void append_timestamp(char *payload, size_t *len, size_t size, uint64_t sampled_us) {
+    uint64_t unix_ms = wall_clock_unix_us(&wall_clock, sampled_us) / 1000;
+    if (unix_ms == 0) {
+        return;
+    }
+    int added =
+        snprintf(&payload[*len], size - *len, ",\"ts\":%llu", (unsigned long long) unix_ms);
+    if (added > 0 && *len + (size_t) added + 1 < size) {
+        *len += (size_t) added;
+    }
+}
+
+/**
+ * Register the aggregate entities of a temperature, carried in its state payload
+ */
+static void add_aggregate_entities(const sensor_entity_t *parent) {
+    static const struct {
+        const char *key;
+        const char *name;
+        bool temperature; // Has the parent's device class
+    } aggregates[] = {
+        [AGGREGATE_MIN] = {"min", "Min", true},
+        [AGGREGATE_MAX] = {"max", "Max", true},
+        [AGGREGATE_MEAN] = {"mean", "Mean", true},
+        [AGGREGATE_STDDEV] = {"stddev", "Std Dev", false},
+        [AGGREGATE_COUNT] = {"count", "Samples", false},
+    };
+    for (int i = 0; i < (int) count_of(aggregates); i++) {
+        const char *unit = i == AGGREGATE_COUNT ? "samples" : parent->unit;
+        sensor_entity_t *child = sensor_registry_add_child(
+            &sensor_registry, parent, aggregates[i].key, aggregates[i].name,
+            aggregates[i].temperature ? parent->device_class : NULL, unit, read_aggregate_entity,
+            i);
+        if (!child) {
+            WARN_printf("Sensor registry full, %s %s not published\n", parent->object_id,
+                        aggregates[i].key);
+        } else if (i == AGGREGATE_COUNT) {
+            child->decimals = 0; // A sample count, not hundredths
+        }
+    }
+}
+
+static void schedule_publish_drain(MQTT_CLIENT_DATA_T *state, uint32_t delay_ms);
+
+static void pub_request_cb(void *arg, err_t err) {
+    if (err != 0) {
+        ERROR_printf("MQTT publish callback failed with error %d\n", err);
+        switch (err) {
+            case ERR_MEM:
+                ERROR_printf("  -> Out of memory\n");
+                break;
+            case ERR_BUF:
+                ERROR_printf("  -> Buffer error\n");
+                break;
+            case ERR_TIMEOUT:
+                ERROR_printf("  -> Timeout\n");
+                break;
+            case ERR_CONN:
+                ERROR_printf("  -> Connection error\n");
+                break;
+            default:
+                ERROR_printf("  -> Unknown error\n");
+                break;
+        }
+    } else {
+        INFO_printf("MQTT publish successful\n");
+    }
+
+    // The request slot is only released after this callback returns, so drain from a worker
+    schedule_publish_drain((MQTT_CLIENT_DATA_T *) arg, 0);
+}
+
+/**
+ * Completion of a discovery config; the drain it schedules closes the round once all are in
+ */
+static void discovery_pub_cb(void *arg, err_t err) {
+    MQTT_CLIENT_DATA_T *state = (MQTT_CLIENT_DATA_T *) arg;
+    // Configs of an earlier connection were freed by lwIP without a callback
+    if (state->discovery_in_flight > 0) {
+        state->discovery_in_flight--;
+        state->discovery_failed |= err != ERR_OK;
+    }
+    pub_request_cb(arg, err);
+}
+
+// Home Assistant MQTT Discovery functions
+static const char ha_sensor_config_template[] = HA_SENSOR_CONFIG_TEMPLATE;
+
+/**
+ * Fill in the template fields of an entity's discovery config
+ */
+static void ha_sensor_config_fields(const MQTT_CLIENT_DATA_T *state, const sensor_entity_t *entity,
+                                    const char *fields[HA_FIELD_COUNT]) {
+    fields[0] = NULL;
+    fields[HA_FIELD_NAME] = entity->name;
+    fields[HA_FIELD_DEVICE_CLASS] = entity->device_class_attr;
+    fields[HA_FIELD_STATE_TOPIC] = entity->state_topic;
+    fields[HA_FIELD_AVAILABILITY_TOPIC] = state->availability_topic;
+    fields[HA_FIELD_UNIT] = entity->unit;
+    fields[HA_FIELD_VALUE_KEY] = entity->value_key;
+    fields[HA_FIELD_DEVICE_ID] = state->device_id;
+    fields[HA_FIELD_OBJECT_ID] = entity->object_id;
+}
+
+/**
+ * FNV-1a over a string and its terminator, continuing from hash
+ */
+static uint32_t hash_string(uint32_t hash, const char *str) {
+    do {
+        hash = (hash ^ (uint8_t) *str) * 16777619u;
+    } while (*str++);
+    return hash;
+}
+
+/**
+ * Hash of every discovery config and its topic
+ * The rendered configs follow from the template and the fields, so those are hashed instead.
+ */
+static uint32_t ha_discovery_hash(const MQTT_CLIENT_DATA_T *state) {
+    uint32_t hash = hash_string(2166136261u, ha_sensor_config_template);
+    for (int i = 0; i < sensor_registry.count; i++) {
+        const sensor_entity_t *entity = &sensor_registry.entities[i];
+        const char *fields[HA_FIELD_COUNT];
+        ha_sensor_config_fields(state, entity, fields);
+        hash = hash_string(hash, entity->config_topic);
+        for (int f = 1; f < HA_FIELD_COUNT; f++) {
+            hash = hash_string(hash, fields[f]);
+        }
+    }
+    return hash;
+}
+
+/**
+ * Close the discovery round once every config has been queued and acknowledged
+ * Only a round in which none was dropped or failed saves the discovery hash, so reconnects
+ * and reboots skip discovery until the configs change, and ends a pending resend. Otherwise
+ * discovery is sent again on the next connection.
+ */
+static void finish_discovery_round(MQTT_CLIENT_DATA_T *state) {
+    if (!state->discovery_round || !state->ha_discovery_sent || state->discovery_in_flight > 0 ||
+        publish_queue_class_depth(&publish_queue, PUBLISH_CLASS_DISCOVERY) > 0) {
+        return;
+    }
+    state->discovery_round = false;
+    if (state->discovery_failed ||
+        publish_queue.stats[PUBLISH_CLASS_DISCOVERY].dropped != state->discovery_dropped) {
+        WARN_printf("HA discovery incomplete, resending on the next connection\n");
+        return;
+    }
+    INFO_printf("All HA Discovery configs delivered\n");
+    state->discovery_resend_pending = false;
+    if (sensor_settings.discovery_hash == state->discovery_hash) {
+        return;
+    }
+    sensor_settings.discovery_hash = state->discovery_hash;
+    if (!flash_settings_save(&sensor_settings)) {
+        WARN_printf("Could not save the discovery hash to flash\n");
+    }
+}
+
+/**
+ * Find the probe that publishes as temperature_external
+ * That is the probe whose ROM was saved on the first boot with one. If it is gone and a
+ * single other probe is left, that probe replaced it and takes over; with several left,
+ * none does, so the entity never moves to a probe that had its own.
+ *
+ * @return Index into ds18b20_probes, or -1 for none
+ */
+static int find_legacy_probe(void) {
+    static const uint8_t no_rom[DS18B20_ROM_SIZE];
+    for (int p = 0; p < ds18b20_probe_count; p++) {
+        const ds18b20_probe_t *probe = &ds18b20_probes[p];
+        if (memcmp(probe->bus->roms[probe->index], sensor_settings.legacy_rom,
+                   DS18B20_ROM_SIZE) == 0) {
+            return p;
+        }
+    }
+    bool pinned = memcmp(sensor_settings.legacy_rom, no_rom, DS18B20_ROM_SIZE) != 0;
+    if (ds18b20_probe_count == 0 || (pinned && ds18b20_probe_count > 1)) {
+        if (pinned) {
+            WARN_printf("DS18B20 probe of temperature_external not found\n");
+        }
+        return -1;
+    }
+    const ds18b20_probe_t *probe = &ds18b20_probes[0];
+    memcpy(sensor_settings.legacy_rom, probe->bus->roms[probe->index], DS18B20_ROM_SIZE);
+    if (!flash_settings_save(&sensor_settings)) {
+        WARN_printf("Could not save the temperature_external probe to flash\n");
+    }
+    return 0;
+}
+
+/**
+ * Queue discovery configs while they fit without pushing out other messages
+ * All configs together are larger than the queue, so the rest follow as it drains.
+ * Each config is rendered from the template straight into the queue.
+ */
+static void queue_ha_discovery(MQTT_CLIENT_DATA_T *state) {
+    const publish_class_policy_t *policy = &publish_class_policies[PUBLISH_CLASS_DISCOVERY];
+    while (!state->ha_discovery_sent && state->discovery_next >= 0) {
+        if (state->discovery_next == sensor_registry.count) {
+            INFO_printf("All HA Discovery configs queued\n");
+            state->ha_discovery_sent = true;
+            return;
+        }
+
+        const sensor_entity_t *entity = &sensor_registry.entities[state->discovery_next];
+        const char *fields[HA_FIELD_COUNT];
+        ha_sensor_config_fields(state, entity, fields);
+        size_t len = payload_template_length(ha_sensor_config_template, fields);
+        if (len > MQTT_CONFIG_LEN) {
+            ERROR_printf("%s HA discovery config too long\n", entity->object_id);
+            state->discovery_failed = true;
+            state->discovery_next++;
+            continue;
+        }
+        if (!publish_queue_fits(&publish_queue, len)) {
+            return;
+        }
+
+        INFO_printf("Queueing %s HA discovery config\n", entity->object_id);
+        char *payload =
+            (char *) publish_queue_reserve(&publish_queue, PUBLISH_CLASS_DISCOVERY,
+                                           entity->config_topic, len, policy->qos,
+                                           policy->retain, true);
+        if (payload) {
+            payload_template_render(ha_sensor_config_template, fields, payload);
+        }
+        state->discovery_next++;
+    }
+}
+
+/**
+ * Send queued messages until the MQTT client runs out of request slots or buffer space
+ */
+static void drain_publish_queue(MQTT_CLIENT_DATA_T *state) {
+    queue_ha_discovery(state);
+
+    const publish_entry_t *entry;
+    while ((entry = publish_queue_peek(&publish_queue)) != NULL) {
+        bool discovery = entry->class == PUBLISH_CLASS_DISCOVERY;
+        err_t result = mqtt_publish(state->mqtt_client_inst, entry->topic,
+                                    publish_queue_payload(&publish_queue, entry), entry->len,
+                                    entry->qos, entry->retain,
+                                    discovery ? discovery_pub_cb : pub_request_cb, state);
+        if (result == ERR_MEM || result == ERR_BUF) {
+            // Keep it until a completion or the retry frees room
+            VERBOSE_printf("Publish queue waiting, %d queued, error: %d\n",
+                           publish_queue_depth(&publish_queue), result);
+            schedule_publish_drain(state, PUBLISH_QUEUE_RETRY_MS);
+            break;
+        }
+        if (result == ERR_CONN) {
+            break;
+        }
+        if (result != ERR_OK) {
+            ERROR_printf("Failed to publish to %s, error: %d\n", entry->topic, result);
+        } else if (discovery) {
+            state->discovery_in_flight++;
+        }
+        publish_queue_pop(&publish_queue, result == ERR_OK);
+        queue_ha_discovery(state);
+    }
+    finish_discovery_round(state);
+}
+
+static void publish_drain_worker_fn(__unused async_context_t *context,
+                                    async_at_time_worker_t *worker) {
+    drain_publish_queue((MQTT_CLIENT_DATA_T *) worker->user_data);
+}
+static async_at_time_worker_t publish_drain_worker = {.do_work = publish_drain_worker_fn};
+
+static void schedule_publish_drain(MQTT_CLIENT_DATA_T *state, uint32_t delay_ms) {
+    async_context_t *context = cyw43_arch_async_context();
+    publish_drain_worker.user_data = state;
+    async_context_remove_at_time_worker(context, &publish_drain_worker);
+    async_context_add_at_time_worker_in_ms(context, &publish_drain_worker, delay_ms);
+}
+
+/**
+ * Queue a message with the QoS and retain flag of its class and try to send it right away
+ * A newer message for a topic that is still queued replaces the older one.
+ */
+static bool queue_publish(MQTT_CLIENT_DATA_T *state, publish_class_t class, const char *topic,
+                          const void *payload, size_t len) {
+    const publish_class_policy_t *policy = &publish_class_policies[class];
+    bool queued = publish_queue_push(&publish_queue, class, topic, payload, len, policy->qos,
+                                     policy->retain, true);
+    if (!queued) {
+        WARN_printf("Publish queue full, dropped message for %s\n", topic);
+    }
+    drain_publish_queue(state);
+    return queued;
+}
+
+static void publish_ha_discovery(MQTT_CLIENT_DATA_T *state) {
+    if (state->ha_discovery_sent) {
+        INFO_printf("HA Discovery already sent, skipping\n");
+        return; // Already sent
+    }
+
+    // One discovery config per registered entity, queued as room allows
+    state->discovery_next = 0;
+    state->discovery_round = true;
+    state->discovery_failed = false;
+    state->discovery_dropped = publish_queue.stats[PUBLISH_CLASS_DISCOVERY].dropped;
+    drain_publish_queue(state);
+}
+
+static void publish_ha_availability(MQTT_CLIENT_DATA_T *state, bool online) {
+    const char *status = online ? "online" : "offline";
+    INFO_printf("Publishing availability: %s to %s\n", status, state->availability_topic);
+    queue_publish(state, PUBLISH_CLASS_AVAILABILITY, state->availability_topic, status,
+                  strlen(status));
+}
+
+/**
+ * Publish the queue depth and per-class counters
+ * Payload: {"depth":<n>,"high_water":<n>,"queued":[...],"coalesced":[...],"dropped":[...]}
+ * with one array element per class: availability, discovery, state, diagnostic.
+ */
+static void publish_queue_stats(MQTT_CLIENT_DATA_T *state) {
+    const publish_class_stats_t *stats = publish_queue.stats;
+    char payload[MQTT_PAYLOAD_LEN * 2];
+    int len = snprintf(payload, sizeof(payload),
+                       "{\"depth\":%d,\"high_water\":%d,\"queued\":[%lu,%lu,%lu,%lu],"
+                       "\"coalesced\":[%lu,%lu,%lu,%lu],\"dropped\":[%lu,%lu,%lu,%lu]}",
+                       publish_queue_depth(&publish_queue), publish_queue.high_water,
+                       (unsigned long) stats[0].queued, (unsigned long) stats[1].queued,
+                       (unsigned long) stats[2].queued, (unsigned long) stats[3].queued,
+                       (unsigned long) stats[0].coalesced, (unsigned long) stats[1].coalesced,
+                       (unsigned long) stats[2].coalesced, (unsigned long) stats[3].coalesced,
+                       (unsigned long) stats[0].dropped, (unsigned long) stats[1].dropped,
+                       (unsigned long) stats[2].dropped, (unsigned long) stats[3].dropped);
+    if (len < 0 || len >= (int) sizeof(payload)) {
+        return;
+    }
+    DEBUG_printf("Publish queue: %s\n", payload);
+    queue_publish(state, PUBLISH_CLASS_DIAGNOSTIC, state->queue_topic, payload, (size_t) len);
+}
+
+/**
+ * Intern every topic and payload prefix once the device id is known
+ * Nothing here changes at runtime, so the publish path does no formatting.
+ */
+static void build_topics(MQTT_CLIENT_DATA_T *state) {
+    static topic_arena_t topic_arena;
+    topic_arena_reset(&topic_arena);
+
+    // Control topics are /<client id>/<name> with MQTT_UNIQUE_TOPIC, else /<name>
+#if MQTT_UNIQUE_TOPIC
+    char base[MQTT_TOPIC_LEN];
+    snprintf(base, sizeof(base), "/%s", state->mqtt_client_info.client_id);
+#else
+    const char *base = "";
+#endif
+    state->availability_topic =
+        topic_arena_printf(&topic_arena, "pico/%s/status", state->device_id);
+    state->state_topic = topic_arena_printf(&topic_arena, "pico/%s/state", state->device_id);
+    state->history_topic = topic_arena_printf(&topic_arena, "pico/%s/history", state->device_id);
+    state->queue_topic = topic_arena_printf(&topic_arena, "pico/%s/queue", state->device_id);
+    state->ha_status_topic = topic_arena_printf(&topic_arena, "%s", HA_STATUS_TOPIC);
+    state->led_state_topic = topic_arena_printf(&topic_arena, "%s/led/state", base);
+    state->uptime_topic = topic_arena_printf(&topic_arena, "%s/uptime", base);
+    state->command_filter = topic_arena_printf(&topic_arena, "%s/+", base);
+    state->command_prefix = topic_arena_printf(&topic_arena, "%s/", base);
+    bool ok = state->availability_topic && state->state_topic && state->history_topic &&
+              state->queue_topic && state->led_state_topic &&
+              state->uptime_topic && state->command_filter && state->command_prefix &&
+              state->ha_status_topic;
+#if MQTT_CBOR
+    state->cbor_state_topic =
+        topic_arena_printf(&topic_arena, "pico/%s/state/cbor", state->device_id);
+    state->cbor_history_topic =
+        topic_arena_printf(&topic_arena, "pico/%s/history/cbor", state->device_id);
+    ok = ok && state->cbor_state_topic && state->cbor_history_topic;
+#endif
+
+    for (int i = 0; i < sensor_registry.count; i++) {
+        sensor_entity_t *entity = &sensor_registry.entities[i];
+        entity->config_topic =
+            topic_arena_printf(&topic_arena, "%s/sensor/%s/%s/config", HA_DISCOVERY_PREFIX,
+                               state->device_id, entity->object_id);
+        // The batched state object is keyed by object id, single states by device class, with
+        // the aggregates of a reading appended to its object under their key
+#if MQTT_BATCH_STATE
+        entity->state_topic = state->state_topic;
+        entity->value_key = entity->object_id;
+        entity->payload_prefix = topic_arena_printf(&topic_arena, "\"%s\":", entity->value_key);
+#else
+        if (entity->parent) {
+            entity->state_topic = entity->parent->state_topic;
+            entity->value_key = entity->key;
+            entity->payload_prefix =
+                topic_arena_printf(&topic_arena, ",\"%s\":", entity->value_key);
+        } else {
+            entity->state_topic = topic_arena_printf(&topic_arena, "pico/%s/%s", state->device_id,
+                                                     entity->object_id);
+            entity->value_key = entity->device_class ? entity->device_class : entity->object_id;
+            entity->payload_prefix =
+                topic_arena_printf(&topic_arena, "{\"%s\":", entity->value_key);
+        }
+#endif
+        entity->device_class_attr =
+            entity->device_class
+                ? topic_arena_printf(&topic_arena, "\"device_class\":\"%s\",", entity->device_class)
+                : "";
+        ok = ok && entity->config_topic && entity->state_topic && entity->payload_prefix &&
+             entity->device_class_attr;
+        if (entity->payload_prefix) {
+            entity->payload_prefix_len = strlen(entity->payload_prefix);
+            ok = ok && entity->payload_prefix_len + FIXED_FORMAT_CENTI_LEN < MQTT_PAYLOAD_LEN;
+        }
+    }
+
+    if (!ok) {
+        panic("Topic arena too small, increase TOPIC_ARENA_SIZE");
+    }
+    state->command_prefix_len = strlen(state->command_prefix);
+    INFO_printf("Interned topics use %u of %u bytes\n", (unsigned int) topic_arena.used,
+                (unsigned int) sizeof(topic_arena.buf));
+}
+
+static void control_led(MQTT_CLIENT_DATA_T *state, bool on) {
+    // Publish state on /state topic and on/off led board
+    const char *message = on ? "On" : "Off";
+    if (on)
+        cyw43_arch_gpio_put(CYW43_WL_GPIO_LED_PIN, 1);
+    else
+        cyw43_arch_gpio_put(CYW43_WL_GPIO_LED_PIN, 0);
+
+    queue_publish(state, PUBLISH_CLASS_STATE, state->led_state_topic, message, strlen(message));
+}
+
+#if MQTT_BATCH_STATE
+#if MQTT_CBOR
+/**
+ * Queue the batched readings as a CBOR map of object_id to value in hundredths,
+ * with "ts" as in the JSON
+ *
+ * @param sampled_us Local time of the earliest reading
+ * @param buf Scratch buffer for the payload
+ */
+static void queue_cbor_state(MQTT_CLIENT_DATA_T *state, const int32_t *values,
+                             const bool *included, uint64_t sampled_us, uint8_t *buf,
+                             size_t size) {
+    uint64_t unix_ms = wall_clock_unix_us(&wall_clock, sampled_us) / 1000;
+    size_t count = unix_ms ? 1 : 0;
+    for (int i = 0; i < sensor_registry.count; i++) {
+        count += included[i];
+    }
+
+    cbor_writer_t writer;
+    cbor_writer_init(&writer, buf, size);
+    cbor_put_map(&writer, count);
+    for (int i = 0; i < sensor_registry.count; i++) {
+        if (included[i]) {
+            cbor_put_cstr(&writer, sensor_registry.entities[i].object_id);
+            cbor_put_int(&writer, values[i]);
+        }
+    }
+    if (unix_ms) {
+        cbor_put_cstr(&writer, "ts");
+        cbor_put_uint(&writer, unix_ms);
+    }
+    size_t len = cbor_writer_len(&writer);
+    if (len == 0) {
+        WARN_printf("Batched state does not fit in CBOR payload\n");
+        return;
+    }
+    DEBUG_printf("CBOR state payload: %u bytes\n", (unsigned int) len);
+    if (!queue_publish(state, PUBLISH_CLASS_STATE, state->cbor_state_topic, buf, len)) {
+        ERROR_printf("Failed to queue CBOR state\n");
+    }
+}
+#endif
+
+static void publish_sensor_states(MQTT_CLIENT_DATA_T *state) {
+    // Take the samples core1 produced since the last publish
+    drain_samples();
+
+    // One object holds every valid reading; it is sent when the policy of any member is due
+    uint32_t now_ms = to_ms_since_boot(get_absolute_time());
+    char payload[MQTT_BATCH_PAYLOAD_LEN];
+    int32_t values[SENSOR_REGISTRY_MAX];
+    bool included[SENSOR_REGISTRY_MAX];
+    bool due = false;
+    uint64_t sampled_us = UINT64_MAX; // Earliest sample in the object
+    size_t len = 0;
+    payload[len++] = '{';
+    for (int i = 0; i < sensor_registry.count; i++) {
+        sensor_entity_t *entity = &sensor_registry.entities[i];
+        included[i] = entity->read(entity, &values[i]);
+        if (!included[i]) {
+            DEBUG_printf("%s not available or error reading\n", entity->object_id);
+            continue;
+        }
+
+        char value_str[FIXED_FORMAT_CENTI_LEN];
+        size_t value_len =
+            fixed_format_decimals(values[i], entity->decimals, value_str, sizeof(value_str));
+        DEBUG_printf("Raw reading: %s=%s\n", entity->object_id, value_str);
+
+        // Room for the member, a separator and the closing brace
+        if (len + entity->payload_prefix_len + value_len + 2 > sizeof(payload)) {
+            WARN_printf("%s does not fit in the batched state\n", entity->object_id);
+            included[i] = false;
+            continue;
+        }
+        if (len > 1) {
+            payload[len++] = ',';
+        }
+        memcpy(&payload[len], entity->payload_prefix, entity->payload_prefix_len);
+        len += entity->payload_prefix_len;
+        memcpy(&payload[len], value_str, value_len);
+        len += value_len;
+        // Aggregates ride along with their reading but never make the state due by themselves
+        due = due || (!entity->parent && sensor_entity_due(entity, values[i], now_ms));
+        uint64_t entity_us = entity_sample_us(entity);
+        sampled_us = entity_us < sampled_us ? entity_us : sampled_us;
+    }
+    if (len > 1) {
+        append_timestamp(payload, &len, sizeof(payload), sampled_us);
+    }
+    payload[len++] = '}';
+
+    if (!due) {
+        return;
+    }
+
+    DEBUG_printf("State payload: %.*s\n", (int) len, payload);
+    INFO_printf("Publishing batched state to %s\n", state->state_topic);
+
+    if (!queue_publish(state, PUBLISH_CLASS_STATE, state->state_topic, payload, len)) {
+        ERROR_printf("Failed to queue batched state\n");
+        return;
+    }
+#if MQTT_CBOR
+    // The queue holds a copy of the JSON, so its buffer is free for the CBOR encoding
+    queue_cbor_state(state, values, included, sampled_us, (uint8_t *) payload, sizeof(payload));
+#endif
+    for (int i = 0; i < sensor_registry.count; i++) {
+        if (included[i]) {
+            sensor_entity_mark_published(&sensor_registry.entities[i], values[i], now_ms);
+            reset_entity_window(&sensor_registry.entities[i]);
+        }
+    }
+    INFO_printf("Batched state queued\n");
+}
+#else
+static void publish_sensor_states(MQTT_CLIENT_DATA_T *state) {
+    // Take the samples core1 produced since the last publish
+    drain_samples();
+
+    // Publish each entity with a valid reading whose publish policy is due
+    uint32_t now_ms = to_ms_since_boot(get_absolute_time());
+    for (int i = 0; i < sensor_registry.count; i++) {
+        sensor_entity_t *entity = &sensor_registry.entities[i];
+        int32_t value;
+        if (entity->parent) {
+            continue; // Sent in the parent's payload
+        }
+        if (!entity->read(entity, &value)) {
+            DEBUG_printf("%s not available or error reading\n", entity->object_id);
+            continue;
+        }
+
+        char value_str[FIXED_FORMAT_CENTI_LEN];
+        size_t value_len =
+            fixed_format_decimals(value, entity->decimals, value_str, sizeof(value_str));
+        DEBUG_printf("Raw reading: %s=%s\n", entity->object_id, value_str);
+
+        if (!sensor_entity_due(entity, value, now_ms)) {
+            continue;
+        }
+
+        // JSON payload for Home Assistant: interned prefix, value, aggregates, closing brace
+        char payload[MQTT_PAYLOAD_LEN];
+        size_t len = entity->payload_prefix_len;
+        memcpy(payload, entity->payload_prefix, len);
+        memcpy(&payload[len], value_str, value_len);
+        len += value_len;
+        for (int j = 0; j < sensor_registry.count; j++) {
+            const sensor_entity_t *child = &sensor_registry.entities[j];
+            int32_t child_value;
+            if (child->parent != entity || !child->read(child, &child_value)) {
+                continue;
+            }
+            char child_str[FIXED_FORMAT_CENTI_LEN];
+            size_t child_len =
+                fixed_format_decimals(child_value, child->decimals, child_str, sizeof(child_str));
+            if (len + child->payload_prefix_len + child_len + 1 > sizeof(payload)) {
+                WARN_printf("%s does not fit in the %s state\n", child->key, entity->object_id);
+                break;
+            }
+            memcpy(&payload[len], child->payload_prefix, child->payload_prefix_len);
+            len += child->payload_prefix_len;
+            memcpy(&payload[len], child_str, child_len);
+            len += child_len;
+        }
+        append_timestamp(payload, &len, sizeof(payload), entity_sample_us(entity));
+        payload[len++] = '}';
+
+        DEBUG_printf("%s payload: %.*s\n", entity->object_id, (int) len, payload);
+        INFO_printf("Publishing %s %s to %s\n", entity->object_id, value_str, entity->state_topic);
+
+        if (!queue_publish(state, PUBLISH_CLASS_STATE, entity->state_topic, payload, len)) {
+            ERROR_printf("Failed to queue %s\n", entity->object_id);
+        } else {
+            sensor_entity_mark_published(entity, value, now_ms);
+            reset_entity_window(entity);
+            INFO_printf("%s queued\n", entity->object_id);
+        }
+    }
+}
+#endif
+
+static void sub_request_cb(void *arg, err_t err) {
+    MQTT_CLIENT_DATA_T *state = (MQTT_CLIENT_DATA_T *) arg;
+    if (err != 0) {
+        panic("subscribe request failed %d", err);
+    }
+    state->subscribe_count++;
+}
+
+static void unsub_request_cb(void *arg, err_t err) {
+    MQTT_CLIENT_DATA_T *state = (MQTT_CLIENT_DATA_T *) arg;
+    if (err != 0) {
+        panic("unsubscribe request failed %d", err);
+    }
+    state->subscribe_count--;
+    assert(state->subscribe_count >= 0);
+
+    // Stop if requested
+    if (state->subscribe_count <= 0 && state->stop_client) {
+        mqtt_disconnect(state->mqtt_client_inst);
+    }
+}
+
+static void sub_unsub_topics(MQTT_CLIENT_DATA_T *state, bool sub) {
+    mqtt_request_cb_t cb = sub ? sub_request_cb : unsub_request_cb;
+    // One wildcard covers every command, so adding one costs no round trip
+    mqtt_sub_unsub(state->mqtt_client_inst, state->command_filter, MQTT_SUBSCRIBE_QOS, cb, state,
+                   sub);
+    mqtt_sub_unsub(state->mqtt_client_inst, state->ha_status_topic, MQTT_SUBSCRIBE_QOS, cb, state,
+                   sub);
+}
+
+static void discovery_resend_worker_fn(__unused async_context_t *context,
+                                       async_at_time_worker_t *worker) {
+    MQTT_CLIENT_DATA_T *state = (MQTT_CLIENT_DATA_T *) worker->user_data;
+    if (!mqtt_client_is_connected(state->mqtt_client_inst)) {
+        return;
+    }
+    // Home Assistant may have lost the retained messages along with the broker
+    INFO_printf("Home Assistant started, resending availability, discovery and states\n");
+    publish_ha_availability(state, true);
+    state->ha_discovery_sent = false;
+    publish_ha_discovery(state);
+    sensor_registry_reset_published(&sensor_registry);
+}
+static async_at_time_worker_t discovery_resend_worker = {.do_work = discovery_resend_worker_fn};
+
+/**
+ * Compare an incoming payload, which is not NUL terminated, with a string
+ */
+static bool payload_is(const mqtt_message_t *message, const char *text, bool ignore_case) {
+    size_t len = strlen(text);
+    if (message->len != len) {
+        return false;
+    }
+    return ignore_case ? lwip_strnicmp((const char *) message->data, text, len) == 0
+                       : memcmp(message->data, text, len) == 0;
+}
+
+/**
+ * Handle a Home Assistant status message, resending discovery on its birth message
  */
-#define MQTT_SUBSCRIBE_QOS 1
-#define MQTT_PUBLISH_QOS 1
-#define MQTT_PUBLISH_RETAIN 0
+static void handle_ha_status(MQTT_CLIENT_DATA_T *state, const mqtt_message_t *message) {
+    if (!payload_is(message, "online", false)) {
+        return;
+    }
+    // lwIP does not pass on the retain flag, so a retained copy received on subscribing also
+    // counts; resending then is cheap, while missing a real birth leaves Home Assistant without
+    // the configs until the next one. The resend stays pending across reconnects until every
+    // config is delivered.
+    state->discovery_resend_pending = true;
+    uint32_t delay_ms = get_rand_32() % (HA_BIRTH_JITTER_MS + 1);
+    INFO_printf("Home Assistant birth message, resending discovery in %u ms\n",
+                (unsigned int) delay_ms);
+    async_context_t *context = cyw43_arch_async_context();
+    discovery_resend_worker.user_data = state;
+    async_context_remove_at_time_worker(context, &discovery_resend_worker);
+    async_context_add_at_time_worker_in_ms(context, &discovery_resend_worker, delay_ms);
+}
 
-/* Last Will and Testament configuration */
-#define MQTT_WILL_TOPIC "/online"
-#define MQTT_WILL_MSG "0"
-#define MQTT_WILL_QOS 1
+static void handle_led_command(MQTT_CLIENT_DATA_T *state, const mqtt_message_t *message) {
+    if (payload_is(message, "On", true) || payload_is(message, "1", false))
+        control_led(state, true);
+    else if (payload_is(message, "Off", true) || payload_is(message, "0", false))
+        control_led(state, false);
+}
 
-#ifndef MQTT_DEVICE_NAME
-#define MQTT_DEVICE_NAME "pico"
-#endif
+static void handle_print_command(__unused MQTT_CLIENT_DATA_T *state,
+                                 const mqtt_message_t *message) {
+    INFO_printf("%.*s\n", (int) message->len, (const char *) message->data);
+}
 
-// Set to 1 to add the client name to topics, to support multiple devices using the same server
-#ifndef MQTT_UNIQUE_TOPIC
-#define MQTT_UNIQUE_TOPIC 0
-#endif
+static void handle_ping_command(MQTT_CLIENT_DATA_T *state,
+                                __unused const mqtt_message_t *message) {
+    char buf[11];
+    snprintf(buf, sizeof(buf), "%u", to_ms_since_boot(get_absolute_time()) / 1000);
+    queue_publish(state, PUBLISH_CLASS_DIAGNOSTIC, state->uptime_topic, buf, strlen(buf));
+}
 
-/* References for this implementation:
- * raspberry-pi-pico-c-sdk.pdf, Section '4.1.1. hardware_adc'
- * pico-examples/adc/adc_console/adc_console.c */
-static float read_onboard_temperature(const char unit) {
-    /* 12-bit conversion, assume max value == ADC_VREF == 3.3 V */
-    const float conversionFactor = 3.3f / (1 << 12);
+static void handle_exit_command(MQTT_CLIENT_DATA_T *state,
+                                __unused const mqtt_message_t *message) {
+    state->stop_client = true;      // stop the client when ALL subscriptions are stopped
+    sub_unsub_topics(state, false); // unsubscribe
+}
 
-    float adc = (float) adc_read() * conversionFactor;
-    float tempC = 27.0f - (adc - 0.706f) / 0.001721f;
+/* A command, received on <command prefix><name> */
+typedef struct {
+    const char *name;
+    void (*handler)(MQTT_CLIENT_DATA_T *state, const mqtt_message_t *message);
+} command_t;
 
-    if (unit == 'C' || unit != 'F') {
-        return tempC;
-    } else if (unit == 'F') {
-        return tempC * 9 / 5 + 32;
+/* Slots in the command table, a power of two */
+#define COMMAND_SLOTS 8
+
+/* Perfect hash of a command name over its first character and length */
+#define COMMAND_HASH(first, len) (((unsigned int) (first) + (len)) % COMMAND_SLOTS)
+
+/* Commands by hash; two commands in one slot fail the build (-Werror=override-init) */
+static const command_t commands[COMMAND_SLOTS] = {
+    [COMMAND_HASH('l', 3)] = {"led", handle_led_command},
+    [COMMAND_HASH('p', 5)] = {"print", handle_print_command},
+    [COMMAND_HASH('p', 4)] = {"ping", handle_ping_command},
+    [COMMAND_HASH('e', 4)] = {"exit", handle_exit_command},
+};
+
+/**
+ * Look up a command by name with one hash and one string compare
+ *
+ * @return The command, or NULL if there is none by that name
+ */
+static const command_t *find_command(const char *name) {
+    size_t len = strlen(name);
+    if (len == 0) {
+        return NULL;
     }
+    const command_t *command = &commands[COMMAND_HASH(name[0], len)];
+    return command->name && strcmp(command->name, name) == 0 ? command : NULL;
+}
 
-    return -1.0f;
+/**
+ * Check every command is in the slot its name hashes to, as the table is written by hand
+ */
+static void check_commands(void) {
+    for (unsigned int i = 0; i < COMMAND_SLOTS; i++) {
+        const char *name = commands[i].name;
+        if (name && COMMAND_HASH(name[0], strlen(name)) != i) {
+            panic("Command %s is not in slot COMMAND_HASH('%c', %u)", name, name[0],
+                  (unsigned int) strlen(name));
+        }
+    }
 }
 
 /**
- * Read temperature from external DS18B20 sensor
+ * Act on a complete incoming message, from the assembler
  */
-static float read_ds18b20_temperature(const char unit) {
-    float tempC = 0.0f;
-    ds18b20_result_t result = ds18b20_read_temperature(&tempC);
+static void handle_message(void *arg, const mqtt_message_t *message) {
+    MQTT_CLIENT_DATA_T *state = (MQTT_CLIENT_DATA_T *) arg;
+    DEBUG_printf("Topic: %s, Message: %.*s\n", message->topic, (int) message->len,
+                 (const char *) message->data);
+    if (strcmp(message->topic, state->ha_status_topic) == 0) {
+        handle_ha_status(state, message);
+        return;
+    }
 
-    if (result != DS18B20_OK) {
-        return -999.0f; // Return error value - simplified error handling
+    // The wildcard also matches the device's own /uptime, which has no command
+    if (strncmp(message->topic, state->command_prefix, state->command_prefix_len) != 0) {
+        return;
+    }
+    const command_t *command = find_command(&message->topic[state->command_prefix_len]);
+    if (!command) {
+        DEBUG_printf("No command for %s\n", message->topic);
+        return;
     }
+    command->handler(state, message);
+}
 
-    if (unit == 'F') {
-        return tempC * 9.0f / 5.0f + 32.0f; // Simple conversion
+static void mqtt_incoming_data_cb(void *arg, const u8_t *data, u16_t len, u8_t flags) {
+    MQTT_CLIENT_DATA_T *state = (MQTT_CLIENT_DATA_T *) arg;
+    VERBOSE_printf("Raw MQTT data received: len=%d, flags=0x%x\n", len, flags);
+    uint32_t dropped = state->incoming.stats.dropped;
+    mqtt_assembler_data(&state->incoming, data, len, (flags & MQTT_DATA_FLAG_LAST) != 0);
+    if (state->incoming.stats.dropped != dropped) {
+        WARN_printf("Dropped incoming message: fragmented and over %u bytes, topic too long, or "
+                    "incomplete\n", (unsigned int) MQTT_ASSEMBLER_BUF_LEN);
     }
+}
 
-    return tempC;
+static void mqtt_incoming_publish_cb(void *arg, const char *topic, u32_t tot_len) {
+    MQTT_CLIENT_DATA_T *state = (MQTT_CLIENT_DATA_T *) arg;
+    mqtt_assembler_begin(&state->incoming, topic, tot_len);
 }
 
-static void pub_request_cb(__unused void *arg, err_t err) {
-    if (err != 0) {
-        ERROR_printf("MQTT publish callback failed with error %d\n", err);
-        switch (err) {
-            case ERR_MEM:
-                ERROR_printf("  -> Out of memory\n");
-                break;
-            case ERR_BUF:
-                ERROR_printf("  -> Buffer error\n");
-                break;
-            case ERR_TIMEOUT:
-                ERROR_printf("  -> Timeout\n");
-                break;
-            case ERR_CONN:
-                ERROR_printf("  -> Connection error\n");
-                break;
-            default:
-                ERROR_printf("  -> Unknown error\n");
-                break;
+#if SENSOR_FLASH_LOG
+/**
+ * Key identifying an entity's readings in the flash log across boots
+ */
+static uint16_t entity_history_key(const sensor_entity_t *entity) {
+    uint32_t hash = hash_string(2166136261u, entity->object_id);
+    return (uint16_t) (hash ^ (hash >> 16));
+}
+
+/**
+ * Registry index of the entity a flash log reading came from
+ *
+ * @return Index, or SENSOR_REGISTRY_MAX if no current entity has the key
+ */
+static uint8_t flash_reading_source(const flash_reading_t *reading) {
+    for (int i = 0; i < sensor_registry.count; i++) {
+        if (!sensor_registry.entities[i].parent &&
+            entity_history_key(&sensor_registry.entities[i]) == reading->key) {
+            return (uint8_t) i;
         }
-    } else {
-        INFO_printf("MQTT publish successful\n");
     }
+    return SENSOR_REGISTRY_MAX;
 }
 
-// Home Assistant MQTT Discovery functions
-static void publish_ha_discovery(MQTT_CLIENT_DATA_T *state) {
-    if (state->ha_discovery_sent) {
-        INFO_printf("HA Discovery already sent, skipping\n");
-        return; // Already sent
+static void flash_reading_set_value(flash_reading_t *reading, int32_t value) {
+    if (value > FLASH_READING_VALUE_MAX) {
+        value = FLASH_READING_VALUE_MAX;
+    } else if (value < -FLASH_READING_VALUE_MAX) {
+        value = -FLASH_READING_VALUE_MAX;
     }
-
-    char config_topic[MQTT_TOPIC_LEN];
-    char config_payload[MQTT_CONFIG_LEN];
-    char state_topic[MQTT_TOPIC_LEN];
-    char availability_topic[MQTT_TOPIC_LEN];
-
-    snprintf(availability_topic, sizeof(availability_topic), "pico/%s/status", state->device_id);
-
-    // Onboard temperature sensor discovery
-    snprintf(config_topic, sizeof(config_topic), "%s/sensor/%s/temperature_onboard/config",
-             HA_DISCOVERY_PREFIX, state->device_id);
-
-    snprintf(state_topic, sizeof(state_topic), "pico/%s/temperature_onboard", state->device_id);
-
-    snprintf(config_payload, sizeof(config_payload),
-             "{"
-             "\"name\":\"Pico Onboard Temperature\","
-             "\"device_class\":\"temperature\","
-             "\"state_topic\":\"%s\","
-             "\"availability_topic\":\"%s\","
-             "\"payload_available\":\"online\","
-             "\"payload_not_available\":\"offline\","
-             "\"unit_of_measurement\":\"°C\","
-             "\"value_template\":\"{{ value_json.temperature }}\","
-             "\"unique_id\":\"%s_temperature_onboard\","
-             "\"device\":{"
-             "\"identifiers\":[\"%s\"],"
-             "\"name\":\"%s\","
-             "\"model\":\"%s\","
-             "\"manufacturer\":\"%s\","
-             "\"sw_version\":\"1.0\""
-             "},"
-             "\"expire_after\":300"
-             "}",
-             state_topic, availability_topic, state->device_id, state->device_id, HA_DEVICE_NAME,
-             HA_DEVICE_MODEL, HA_DEVICE_MANUFACTURER);
-
-    INFO_printf("Publishing onboard sensor HA discovery config\n");
-    err_t result1 =
-        mqtt_publish(state->mqtt_client_inst, config_topic, config_payload, strlen(config_payload),
-                     MQTT_PUBLISH_QOS, true, pub_request_cb, state);
-
-    // DS18B20 external temperature sensor discovery
-    snprintf(config_topic, sizeof(config_topic), "%s/sensor/%s/temperature_external/config",
-             HA_DISCOVERY_PREFIX, state->device_id);
-
-    snprintf(state_topic, sizeof(state_topic), "pico/%s/temperature_external", state->device_id);
-
-    snprintf(config_payload, sizeof(config_payload),
-             "{"
-             "\"name\":\"Pico External Temperature\","
-             "\"device_class\":\"temperature\","
-             "\"state_topic\":\"%s\","
-             "\"availability_topic\":\"%s\","
-             "\"payload_available\":\"online\","
-             "\"payload_not_available\":\"offline\","
-             "\"unit_of_measurement\":\"°C\","
-             "\"value_template\":\"{{ value_json.temperature }}\","
-             "\"unique_id\":\"%s_temperature_external\","
-             "\"device\":{"
-             "\"identifiers\":[\"%s\"],"
-             "\"name\":\"%s\","
-             "\"model\":\"%s\","
-             "\"manufacturer\":\"%s\","
-             "\"sw_version\":\"1.0\""
-             "},"
-             "\"expire_after\":300"
-             "}",
-             state_topic, availability_topic, state->device_id, state->device_id, HA_DEVICE_NAME,
-             HA_DEVICE_MODEL, HA_DEVICE_MANUFACTURER);
-
-    INFO_printf("Publishing external sensor HA discovery config\n");
-    err_t result2 =
-        mqtt_publish(state->mqtt_client_inst, config_topic, config_payload, strlen(config_payload),
-                     MQTT_PUBLISH_QOS, true, pub_request_cb, state);
-
-    if (result1 == ERR_OK && result2 == ERR_OK) {
-        INFO_printf("Both HA Discovery configs published successfully\n");
-        state->ha_discovery_sent = true;
-    } else {
-        ERROR_printf("Failed to publish HA discovery configs, errors: %d, %d\n", result1, result2);
+    for (int i = 0; i < 3; i++) {
+        reading->value[i] = (uint8_t) ((uint32_t) value >> (8 * i));
     }
 }
 
-static void publish_ha_availability(MQTT_CLIENT_DATA_T *state, bool online) {
-    char availability_topic[MQTT_TOPIC_LEN];
-    snprintf(availability_topic, sizeof(availability_topic), "pico/%s/status", state->device_id);
-
-    const char *status = online ? "online" : "offline";
-    INFO_printf("Publishing availability: %s to %s\n", status, availability_topic);
+static int32_t flash_reading_value(const flash_reading_t *reading) {
+    uint32_t raw = reading->value[0] | (uint32_t) reading->value[1] << 8 |
+                   (uint32_t) reading->value[2] << 16;
+    return (int32_t) (raw ^ 0x800000) - 0x800000;
+}
 
-    // Don't use lwip locking here since we're already in a callback
-    err_t result = mqtt_publish(state->mqtt_client_inst, availability_topic, status, strlen(status),
-                                MQTT_PUBLISH_QOS, true, pub_request_cb, state);
+/**
+ * Mount the flash log and continue the boot numbering of the records in it
+ */
+static void flash_log_start(void) {
+    // Entities sharing a key would swap readings; rename one if this ever fires
+    for (int i = 0; i < sensor_registry.count; i++) {
+        for (int j = 0; j < i; j++) {
+            if (!sensor_registry.entities[i].parent && !sensor_registry.entities[j].parent &&
+                entity_history_key(&sensor_registry.entities[i]) ==
+                    entity_history_key(&sensor_registry.entities[j])) {
+                WARN_printf("Flash log key of %s and %s collide\n",
+                            sensor_registry.entities[i].object_id,
+                            sensor_registry.entities[j].object_id);
+            }
+        }
+    }
 
-    if (result != ERR_OK) {
-        ERROR_printf("Failed to publish availability, error: %d\n", result);
-    } else {
-        INFO_printf("Availability published successfully\n");
+    flash_log_result_t result = flash_log_mount(&flash_log);
+    if (result != FLASH_LOG_OK) {
+        WARN_printf("Flash log unavailable, keeping outage readings in RAM: %s\n",
+                    flash_log_error_string(result));
+        return;
+    }
+    flash_reading_t last;
+    if (flash_log_last(&flash_log, &last)) {
+        flash_log_boot = last.boot + 1;
     }
+    flash_log_ready = true;
+    INFO_printf("Flash log: %u segments, %u unsent readings, boot %u\n",
+                (unsigned int) flash_log.segments, (unsigned int) flash_log_unsent(&flash_log),
+                flash_log_boot);
 }
+#endif
 
-static const char *full_topic(MQTT_CLIENT_DATA_T *state, const char *name) {
-#if MQTT_UNIQUE_TOPIC
-    static char full_topic[MQTT_TOPIC_LEN];
-    snprintf(full_topic, sizeof(full_topic), "/%s%s", state->mqtt_client_info.client_id, name);
-    return full_topic;
-#else
-    return name;
+/**
+ * Store one outage reading
+ */
+static void history_push(const history_sample_t *sample) {
+#if SENSOR_FLASH_LOG
+    if (flash_log_ready) {
+        flash_reading_t reading = {
+            .time_ms = (uint32_t) sample->time_ms,
+            .boot = flash_log_boot,
+            .key = entity_history_key(&sensor_registry.entities[sample->source]),
+            .time_ms_hi = (uint8_t) (sample->time_ms >> 32),
+        };
+        flash_reading_set_value(&reading, sample->value);
+        flash_log_result_t result = flash_log_append(&flash_log, &reading);
+        if (result != FLASH_LOG_OK) {
+            WARN_printf("Flash log append failed: %s\n", flash_log_error_string(result));
+        }
+        return;
+    }
 #endif
+    history_ring_push(&history_ring, sample);
 }
 
-static void control_led(MQTT_CLIENT_DATA_T *state, bool on) {
-    // Publish state on /state topic and on/off led board
-    const char *message = on ? "On" : "Off";
-    if (on)
-        cyw43_arch_gpio_put(CYW43_WL_GPIO_LED_PIN, 1);
-    else
-        cyw43_arch_gpio_put(CYW43_WL_GPIO_LED_PIN, 0);
-
-    mqtt_publish(state->mqtt_client_inst, full_topic(state, "/led/state"), message, strlen(message),
-                 MQTT_PUBLISH_QOS, MQTT_PUBLISH_RETAIN, pub_request_cb, state);
+/**
+ * Get the number of stored outage readings
+ */
+static uint32_t history_count(void) {
+#if SENSOR_FLASH_LOG
+    if (flash_log_ready) {
+        return flash_log_unsent(&flash_log);
+    }
+#endif
+    return history_ring_count(&history_ring);
 }
 
-static void publish_temperature(MQTT_CLIENT_DATA_T *state) {
-    static float old_onboard_temp = -999.0; // Initialize with unlikely value
-    static float old_ds18b20_temp = -999.0; // Initialize with unlikely value
-
-    // Read both sensors
-    float onboard_temp = read_onboard_temperature(TEMPERATURE_UNITS);
-    float ds18b20_temp = read_ds18b20_temperature(TEMPERATURE_UNITS);
-
-    DEBUG_printf("Raw temperature readings: Onboard=%.2f, DS18B20=%.2f\n", onboard_temp,
-                 ds18b20_temp);
-
-    // Publish onboard temperature if changed significantly (0.1 degree threshold)
-    if (fabs(onboard_temp - old_onboard_temp) > 0.1) {
-        old_onboard_temp = onboard_temp;
-
-        // Create Home Assistant compatible topic for onboard sensor
-        char temperature_topic[MQTT_TOPIC_LEN];
-        snprintf(temperature_topic, sizeof(temperature_topic), "pico/%s/temperature_onboard",
-                 state->device_id);
-
-        // Create JSON payload for Home Assistant
-        char temp_payload[100];
-        snprintf(temp_payload, sizeof(temp_payload), "{\"temperature\":%.2f}", onboard_temp);
+/**
+ * Decode the oldest stored readings not in flight, all from the same boot
+ *
+ * @param samples Output array
+ * @param max Size of the output array
+ * @param boot Set to the boot the readings were taken in
+ * @return Number of readings decoded
+ */
+static size_t history_peek(history_sample_t *samples, size_t max, uint16_t *boot) {
+#if SENSOR_FLASH_LOG
+    if (flash_log_ready) {
+        flash_reading_t readings[HISTORY_REPLAY_BATCH];
+        size_t count = flash_log_peek(&flash_log, history_unacked, readings,
+                                      max < HISTORY_REPLAY_BATCH ? max : HISTORY_REPLAY_BATCH);
+        size_t n = 0;
+        for (; n < count && readings[n].boot == readings[0].boot; n++) {
+            samples[n].time_ms = ((uint64_t) readings[n].time_ms_hi << 32) | readings[n].time_ms;
+            samples[n].value = flash_reading_value(&readings[n]);
+            samples[n].source = flash_reading_source(&readings[n]);
+        }
+        *boot = count ? readings[0].boot : flash_log_boot;
+        return n;
+    }
+    *boot = flash_log_boot;
+#else
+    *boot = 0;
+#endif
+    return history_ring_peek(&history_ring, history_unacked, samples, max);
+}
 
-        DEBUG_printf("Onboard temperature payload: %s\n", temp_payload);
-        INFO_printf("Publishing onboard temperature %.2f to %s\n", onboard_temp, temperature_topic);
+/**
+ * Remove the oldest stored readings once the broker has acknowledged them
+ */
+static void history_drop(size_t n) {
+#if SENSOR_FLASH_LOG
+    if (flash_log_ready) {
+        flash_log_result_t result = flash_log_mark_sent(&flash_log, n);
+        if (result != FLASH_LOG_OK) {
+            WARN_printf("Flash log mark sent failed: %s\n", flash_log_error_string(result));
+        }
+        return;
+    }
+#endif
+    history_ring_drop(&history_ring, n);
+}
 
-        err_t result = mqtt_publish(state->mqtt_client_inst, temperature_topic, temp_payload,
-                                    strlen(temp_payload), MQTT_PUBLISH_QOS, MQTT_PUBLISH_RETAIN,
-                                    pub_request_cb, state);
+/* History samples carry the registry index of their entity as the source */
+static_assert(SENSOR_REGISTRY_MAX <= HISTORY_RING_SOURCES && HISTORY_RING_SOURCES <= 256,
+              "every registry index must be a history source");
 
-        if (result != ERR_OK) {
-            ERROR_printf("Failed to publish onboard temperature, error: %d\n", result);
-        } else {
-            INFO_printf("Onboard temperature published successfully\n");
+/**
+ * Store the current readings while the broker is unreachable, once per publish interval
+ */
+static void record_history(void) {
+    static uint64_t recorded_ms = 0;
+    uint64_t now_ms = time_us_64() / 1000;
+    if (recorded_ms && now_ms - recorded_ms < TEMP_WORKER_TIME_S * 1000) {
+        return;
+    }
+    recorded_ms = now_ms;
+
+    drain_samples();
+    history_sample_t samples[SENSOR_REGISTRY_MAX];
+    int count = 0;
+    for (int i = 0; i < sensor_registry.count; i++) {
+        sensor_entity_t *entity = &sensor_registry.entities[i];
+        history_sample_t sample = {.source = (uint8_t) i};
+        // Aggregates describe a publish interval, not a point in time
+        if (entity->parent || !entity->read(entity, &sample.value)) {
+            continue;
         }
+        // Stamped with the acquisition time, in time order since records are delta encoded
+        sample.time_ms = entity_sample_us(entity) / 1000;
+        int j = count++;
+        for (; j > 0 && samples[j - 1].time_ms > sample.time_ms; j--) {
+            samples[j] = samples[j - 1];
+        }
+        samples[j] = sample;
     }
+    for (int i = 0; i < count; i++) {
+        history_push(&samples[i]);
+    }
+#if SENSOR_FLASH_LOG
+    if (flash_log_ready) {
+        DEBUG_printf("Flash log holds %u unsent readings, %u dropped\n",
+                     (unsigned int) flash_log_unsent(&flash_log), (unsigned int) flash_log.dropped);
+        return;
+    }
+#endif
+    DEBUG_printf("History holds %u readings in %u bytes, %u dropped\n",
+                 (unsigned int) history_ring_count(&history_ring),
+                 (unsigned int) history_ring.used, (unsigned int) history_ring.dropped);
+}
 
-    // Publish DS18B20 temperature if valid and changed significantly
-    if (ds18b20_temp > -999.0f && fabs(ds18b20_temp - old_ds18b20_temp) > 0.1) {
-        old_ds18b20_temp = ds18b20_temp;
-
-        // Create Home Assistant compatible topic for DS18B20 sensor
-        char ds18b20_topic[MQTT_TOPIC_LEN];
-        snprintf(ds18b20_topic, sizeof(ds18b20_topic), "pico/%s/temperature_external",
-                 state->device_id);
+/**
+ * Forget the history messages in flight, so replay starts again from the oldest stored reading
+ * Used when they went with the connection, whose requests lwIP frees without a callback.
+ */
+static void history_forget_in_flight(void) {
+    for (size_t i = 0; i < HISTORY_MAX_BATCHES; i++) {
+        history_batches[i].pending = 0;
+        history_batches[i].failed = false;
+    }
+    history_batch_head = 0;
+    history_batch_count = 0;
+    history_unacked = 0;
+}
 
-        // Create JSON payload for Home Assistant
-        char ds18b20_payload[100];
-        snprintf(ds18b20_payload, sizeof(ds18b20_payload), "{\"temperature\":%.2f}", ds18b20_temp);
+/**
+ * Remove the readings of acknowledged history batches, oldest first
+ * A failed batch holds back the ones after it; once none is pending any more, it and
+ * everything after it is sent again, so readings may arrive twice but are never lost.
+ */
+static void history_settle(void) {
+    while (history_batch_count > 0 && history_batches[history_batch_head].pending == 0 &&
+           !history_batches[history_batch_head].failed) {
+        history_batch_t *batch = &history_batches[history_batch_head];
+        history_drop(batch->n);
+        history_unacked -= batch->n;
+        history_batch_head = (history_batch_head + 1) % HISTORY_MAX_BATCHES;
+        history_batch_count--;
+    }
+    for (size_t i = 0; i < history_batch_count; i++) {
+        if (history_batches[(history_batch_head + i) % HISTORY_MAX_BATCHES].pending) {
+            return;
+        }
+    }
+    if (history_batch_count > 0) {
+        WARN_printf("History publish failed, resending %u readings\n",
+                    (unsigned int) history_unacked);
+        history_forget_in_flight();
+    }
+}
 
-        DEBUG_printf("DS18B20 temperature payload: %s\n", ds18b20_payload);
-        INFO_printf("Publishing DS18B20 temperature %.2f to %s\n", ds18b20_temp, ds18b20_topic);
+static void history_pub_cb(void *arg, err_t err) {
+    history_batch_t *batch = (history_batch_t *) arg;
+    // A forgotten batch belongs to an earlier connection and is sent again anyway
+    if (batch->pending > 0) {
+        batch->pending--;
+        batch->failed |= err != ERR_OK;
+        history_settle();
+    }
+    pub_request_cb(batch->state, err);
+}
 
-        err_t result = mqtt_publish(state->mqtt_client_inst, ds18b20_topic, ds18b20_payload,
-                                    strlen(ds18b20_payload), MQTT_PUBLISH_QOS, MQTT_PUBLISH_RETAIN,
-                                    pub_request_cb, state);
+/**
+ * Name of the entity a stored reading came from
+ */
+static const char *history_object_id(const history_sample_t *sample) {
+    return sample->source < sensor_registry.count
+               ? sensor_registry.entities[sample->source].object_id
+               : "unknown";
+}
 
-        if (result != ERR_OK) {
-            ERROR_printf("Failed to publish DS18B20 temperature, error: %d\n", result);
-        } else {
-            INFO_printf("DS18B20 temperature published successfully\n");
+#if MQTT_CBOR
+/**
+ * Encode stored readings as CBOR, with the structure of the JSON history and
+ * values as integers in hundredths
+ *
+ * @param n Set to the number of readings that fit
+ * @return Payload length
+ */
+static size_t format_history_cbor(const history_sample_t *samples, size_t count, uint16_t boot,
+                                  uint8_t *payload, size_t size, size_t *n) {
+    uint64_t now_us = time_us_64();
+    uint64_t unix_ms = wall_clock_unix_us(&wall_clock, now_us) / 1000;
+    cbor_writer_t writer;
+    // Hold back a byte for the break that ends the readings
+    cbor_writer_init(&writer, payload, size - 1);
+#if SENSOR_FLASH_LOG
+    bool same_boot = boot == flash_log_boot;
+    cbor_put_map(&writer, same_boot ? (unix_ms ? 4 : 3) : 2);
+    cbor_put_cstr(&writer, "boot");
+    cbor_put_uint(&writer, boot);
+#else
+    (void) boot;
+    bool same_boot = true;
+    cbor_put_map(&writer, unix_ms ? 3 : 2);
+#endif
+    if (same_boot) {
+        cbor_put_cstr(&writer, "uptime_ms");
+        cbor_put_uint(&writer, now_us / 1000);
+        if (unix_ms) {
+            cbor_put_cstr(&writer, "unix_ms");
+            cbor_put_uint(&writer, unix_ms);
+        }
+    }
+    cbor_put_cstr(&writer, "readings");
+    cbor_put_array_indefinite(&writer);
+    for (*n = 0; *n < count && !writer.overflow; (*n)++) {
+        const history_sample_t *sample = &samples[*n];
+        size_t mark = writer.used;
+        cbor_put_array(&writer, 3);
+        cbor_put_cstr(&writer, history_object_id(sample));
+        cbor_put_uint(&writer, sample->time_ms);
+        cbor_put_int(&writer, sample->value);
+        if (writer.overflow) {
+            writer.used = mark;
+            writer.overflow = false;
+            break;
         }
-    } else if (ds18b20_temp <= -999.0f) {
-        DEBUG_printf("DS18B20 sensor not available or error reading\n");
     }
+    writer.size = size;
+    cbor_put_break(&writer);
+    return cbor_writer_len(&writer);
 }
+#endif
 
-static void sub_request_cb(void *arg, err_t err) {
-    MQTT_CLIENT_DATA_T *state = (MQTT_CLIENT_DATA_T *) arg;
-    if (err != 0) {
-        panic("subscribe request failed %d", err);
+/**
+ * Encode stored readings as JSON
+ * Payload: {"uptime_ms":<now>,"readings":[["<object_id>",<uptime_ms>,<value>],...]}
+ * Once SNTP has set the clock "unix_ms":<now> follows "uptime_ms", so readings
+ * can be placed in Unix time. With SENSOR_FLASH_LOG the payload starts with
+ * "boot":<n>, and both are left out when the readings come from an earlier boot.
+ *
+ * @param n Set to the number of readings that fit
+ * @return Payload length
+ */
+static size_t format_history_json(const history_sample_t *samples, size_t count, uint16_t boot,
+                                  char *payload, size_t size, size_t *n) {
+    uint64_t now_us = time_us_64();
+    unsigned long long unix_ms = wall_clock_unix_us(&wall_clock, now_us) / 1000;
+#if SENSOR_FLASH_LOG
+    // Uptimes from an earlier boot do not relate to the current uptime
+    bool same_boot = boot == flash_log_boot;
+    int len = snprintf(payload, size, "{\"boot\":%u,", boot);
+#else
+    (void) boot;
+    bool same_boot = true;
+    int len = snprintf(payload, size, "{");
+#endif
+    if (same_boot) {
+        len += snprintf(&payload[len], size - len, "\"uptime_ms\":%llu,",
+                        (unsigned long long) (now_us / 1000));
+        if (unix_ms) {
+            len += snprintf(&payload[len], size - len, "\"unix_ms\":%llu,", unix_ms);
+        }
     }
-    state->subscribe_count++;
+    len += snprintf(&payload[len], size - len, "\"readings\":[");
+    for (*n = 0; *n < count; (*n)++) {
+        const history_sample_t *sample = &samples[*n];
+        char value_str[FIXED_FORMAT_CENTI_LEN];
+        fixed_format_centi(sample->value, value_str, sizeof(value_str));
+
+        // Keep room for the closing brackets
+        int added = snprintf(&payload[len], size - len, "%s[\"%s\",%llu,%s]", *n ? "," : "",
+                             history_object_id(sample), (unsigned long long) sample->time_ms,
+                             value_str);
+        if (added < 0 || len + added + 2 >= (int) size) {
+            break;
+        }
+        len += added;
+    }
+    payload[len++] = ']';
+    payload[len++] = '}';
+    return (size_t) len;
 }
 
-static void unsub_request_cb(void *arg, err_t err) {
-    MQTT_CLIENT_DATA_T *state = (MQTT_CLIENT_DATA_T *) arg;
-    if (err != 0) {
-        panic("unsubscribe request failed %d", err);
+/**
+ * Publish the oldest stored readings not yet in flight as one batch: a JSON message, and with
+ * MQTT_CBOR the same readings as CBOR on their own topic
+ * They are removed by history_pub_cb() once the broker acknowledges every message.
+ */
+static void publish_history_batch(MQTT_CLIENT_DATA_T *state) {
+    history_sample_t samples[HISTORY_REPLAY_BATCH];
+    uint16_t boot;
+    size_t count = history_peek(samples, HISTORY_REPLAY_BATCH, &boot);
+    if (count == 0) {
+        return; // Everything left is in flight
     }
-    state->subscribe_count--;
-    assert(state->subscribe_count >= 0);
 
-    // Stop if requested
-    if (state->subscribe_count <= 0 && state->stop_client) {
-        mqtt_disconnect(state->mqtt_client_inst);
+    size_t n;
+    char payload[HISTORY_PAYLOAD_LEN];
+    size_t len = format_history_json(samples, count, boot, payload, sizeof(payload), &n);
+#if MQTT_CBOR
+    // Both messages carry the same readings, as many as fit in each
+    uint8_t cbor_payload[HISTORY_PAYLOAD_LEN];
+    size_t cbor_n;
+    size_t cbor_len =
+        format_history_cbor(samples, n, boot, cbor_payload, sizeof(cbor_payload), &cbor_n);
+    if (cbor_n < n) {
+        n = cbor_n;
+        len = format_history_json(samples, n, boot, payload, sizeof(payload), &n);
     }
-}
+#endif
 
-static void sub_unsub_topics(MQTT_CLIENT_DATA_T *state, bool sub) {
-    mqtt_request_cb_t cb = sub ? sub_request_cb : unsub_request_cb;
-    mqtt_sub_unsub(state->mqtt_client_inst, full_topic(state, "/led"), MQTT_SUBSCRIBE_QOS, cb,
-                   state, sub);
-    mqtt_sub_unsub(state->mqtt_client_inst, full_topic(state, "/print"), MQTT_SUBSCRIBE_QOS, cb,
-                   state, sub);
-    mqtt_sub_unsub(state->mqtt_client_inst, full_topic(state, "/ping"), MQTT_SUBSCRIBE_QOS, cb,
-                   state, sub);
-    mqtt_sub_unsub(state->mqtt_client_inst, full_topic(state, "/exit"), MQTT_SUBSCRIBE_QOS, cb,
-                   state, sub);
+    history_batch_t *batch =
+        &history_batches[(history_batch_head + history_batch_count) % HISTORY_MAX_BATCHES];
+    *batch = (history_batch_t){.state = state, .n = n, .pending = 1};
+    err_t result = mqtt_publish(state->mqtt_client_inst, state->history_topic, payload,
+                                (u16_t) len, MQTT_HISTORY_QOS, false, history_pub_cb, batch);
+    if (result != ERR_OK) {
+        batch->pending = 0;
+        DEBUG_printf("History publish deferred, error: %d\n", result);
+        return;
+    }
+#if MQTT_CBOR
+    result = mqtt_publish(state->mqtt_client_inst, state->cbor_history_topic, cbor_payload,
+                          (u16_t) cbor_len, MQTT_HISTORY_QOS, false, history_pub_cb, batch);
+    if (result == ERR_OK) {
+        batch->pending++;
+    } else {
+        // Resent with the batch once the JSON message is through
+        batch->failed = true;
+        WARN_printf("CBOR history publish failed, error: %d\n", result);
+    }
+#endif
+    history_batch_count++;
+    history_unacked += n;
+    INFO_printf("Replayed %u readings, %u not yet sent\n", (unsigned int) n,
+                (unsigned int) (history_count() - history_unacked));
 }
 
-static void mqtt_incoming_data_cb(void *arg, const u8_t *data, u16_t len, u8_t flags) {
-    MQTT_CLIENT_DATA_T *state = (MQTT_CLIENT_DATA_T *) arg;
-#if MQTT_UNIQUE_TOPIC
-    const char *basic_topic = state->topic + strlen(state->mqtt_client_info.client_id) + 1;
-#else
-    const char *basic_topic = state->topic;
-#endif
-    strncpy(state->data, (const char *) data, len);
-    state->len = len;
-    state->data[len] = '\0';
-
-    VERBOSE_printf("Raw MQTT data received: topic=%s, len=%d, flags=0x%x\n", state->topic, len,
-                   flags);
-    DEBUG_printf("Topic: %s, Message: %s\n", state->topic, state->data);
-    if (strcmp(basic_topic, "/led") == 0) {
-        if (lwip_stricmp((const char *) state->data, "On") == 0 ||
-            strcmp((const char *) state->data, "1") == 0)
-            control_led(state, true);
-        else if (lwip_stricmp((const char *) state->data, "Off") == 0 ||
-                 strcmp((const char *) state->data, "0") == 0)
-            control_led(state, false);
-    } else if (strcmp(basic_topic, "/print") == 0) {
-        INFO_printf("%.*s\n", len, data);
-    } else if (strcmp(basic_topic, "/ping") == 0) {
-        char buf[11];
-        snprintf(buf, sizeof(buf), "%u", to_ms_since_boot(get_absolute_time()) / 1000);
-        mqtt_publish(state->mqtt_client_inst, full_topic(state, "/uptime"), buf, strlen(buf),
-                     MQTT_PUBLISH_QOS, MQTT_PUBLISH_RETAIN, pub_request_cb, state);
-    } else if (strcmp(basic_topic, "/exit") == 0) {
-        state->stop_client = true;      // stop the client when ALL subscriptions are stopped
-        sub_unsub_topics(state, false); // unsubscribe
+static void history_worker_fn(async_context_t *context, async_at_time_worker_t *worker) {
+    MQTT_CLIENT_DATA_T *state = (MQTT_CLIENT_DATA_T *) worker->user_data;
+
+    // Stop when done or disconnected; the temperature worker restarts replay after a reconnect
+    if (!mqtt_client_is_connected(state->mqtt_client_inst) ||
+        history_count() == 0) {
+        return;
     }
+    // Live messages go first; history only uses an idle queue
+    if (history_batch_count < HISTORY_MAX_BATCHES &&
+        publish_queue_depth(&publish_queue) == 0) {
+        publish_history_batch(state);
+    }
+    async_context_add_at_time_worker_in_ms(context, worker, HISTORY_REPLAY_INTERVAL_MS);
 }
+static async_at_time_worker_t history_worker = {.do_work = history_worker_fn};
 
-static void mqtt_incoming_publish_cb(void *arg, const char *topic, u32_t tot_len) {
-    MQTT_CLIENT_DATA_T *state = (MQTT_CLIENT_DATA_T *) arg;
-    strncpy(state->topic, topic, sizeof(state->topic));
+static void start_history_replay(MQTT_CLIENT_DATA_T *state, async_context_t *context) {
+    if (history_count() == 0) {
+        return;
+    }
+    INFO_printf("Replaying %u readings stored during the outage\n",
+                (unsigned int) history_count());
+    history_worker.user_data = state;
+    async_context_remove_at_time_worker(context, &history_worker);
+    async_context_add_at_time_worker_in_ms(context, &history_worker, HISTORY_REPLAY_INTERVAL_MS);
 }
 
 static void temperature_worker_fn(async_context_t *context, async_at_time_worker_t *worker) {
     MQTT_CLIENT_DATA_T *state = (MQTT_CLIENT_DATA_T *) worker->user_data;
     static int publish_step = 0;
+    static absolute_time_t stats_time = {0};
 
     // Check if MQTT is still connected
     if (!mqtt_client_is_connected(state->mqtt_client_inst)) {
         ERROR_printf("MQTT connection lost! Attempting to reconnect...\n");
         // Reset publish step to restart sequence after reconnection
         publish_step = 0;
+        record_history();
         async_context_add_at_time_worker_in_ms(context, worker, 5000); // Try again in 5 seconds
         return;
     }
@@ -529,7 +2130,8 @@ static void temperature_worker_fn(async_context_t *context, async_at_time_worker
         case 2:
             // Third run - publish initial temperature
             INFO_printf("Step 3: Publishing initial temperature\n");
-            publish_temperature(state);
+            publish_sensor_states(state);
+            start_history_replay(state, context);
             publish_step++;
             async_context_add_at_time_worker_in_ms(context, worker, TEMP_WORKER_TIME_S * 1000);
             break;
@@ -537,7 +2139,11 @@ static void temperature_worker_fn(async_context_t *context, async_at_time_worker
         default:
             // Normal operation - just publish temperature
             INFO_printf("Normal operation: Publishing temperature\n");
-            publish_temperature(state);
+            publish_sensor_states(state);
+            if (absolute_time_diff_us(stats_time, get_absolute_time()) >= 0) {
+                publish_queue_stats(state);
+                stats_time = make_timeout_time_ms(PUBLISH_STATS_INTERVAL_S * 1000);
+            }
             async_context_add_at_time_worker_in_ms(context, worker, TEMP_WORKER_TIME_S * 1000);
             break;
     }
@@ -550,8 +2156,15 @@ static void mqtt_connection_cb(mqtt_client_t *client, void *arg, mqtt_connection
         state->connect_done = true;
         INFO_printf("MQTT connected successfully!\n");
 
-        // Reset discovery flag for reconnection
-        state->ha_discovery_sent = false;
+        // Discovery configs are retained, so they are only sent again once they change or
+        // Home Assistant announces a restart; every state is sent again
+        state->ha_discovery_sent = !state->discovery_resend_pending &&
+                                   state->discovery_hash == sensor_settings.discovery_hash;
+        state->discovery_next = -1;
+        state->discovery_round = false;
+        state->discovery_in_flight = 0;
+        sensor_registry_reset_published(&sensor_registry);
+        history_forget_in_flight();
 
         // Subscribe to topics first
         sub_unsub_topics(state, true);
@@ -569,6 +2182,9 @@ static void mqtt_connection_cb(mqtt_client_t *client, void *arg, mqtt_connection
         ERROR_printf("MQTT disconnected!\n");
         state->connect_done = false;
 
+        // Everything queued is sent afresh after reconnecting
+        publish_queue_clear(&publish_queue);
+
         // Check WiFi status
         int wifi_status = cyw43_wifi_link_status(&cyw43_state, CYW43_ITF_STA);
         INFO_printf("WiFi link status: %d\n", wifi_status);
@@ -615,6 +2231,7 @@ static void start_client(MQTT_CLIENT_DATA_T *state) {
     // This is important for MBEDTLS_SSL_SERVER_NAME_INDICATION
     mbedtls_ssl_set_hostname(altcp_tls_context(state->mqtt_client_inst->conn), MQTT_SERVER);
 #endif
+    mqtt_assembler_init(&state->incoming, handle_message, state);
     mqtt_set_inpub_callback(state->mqtt_client_inst, mqtt_incoming_publish_cb,
                             mqtt_incoming_data_cb, state);
     cyw43_arch_lwip_end();
@@ -641,16 +2258,87 @@ int main(void) {
     adc_set_temp_sensor_enabled(true);
     adc_select_input(4);
 
-    // Initialize DS18B20 external temperature sensor
-    INFO_printf("Initializing DS18B20 sensor on GPIO 2...\n");
-    ds18b20_result_t ds18b20_result = ds18b20_init(2);
-    if (ds18b20_result == DS18B20_OK) {
-        INFO_printf("DS18B20 sensor initialized successfully\n");
-    } else {
-        WARN_printf("DS18B20 sensor initialization failed: %s\n",
-                    ds18b20_error_string(ds18b20_result));
+    // Oversample the temperature sensor into a DMA ring at zero CPU cost
+    if (!adc_capture_start()) {
+        panic("Failed to start ADC capture");
+    }
+    INFO_printf("Onboard temperature: %d samples at %d Hz per reading\n", ADC_CAPTURE_SAMPLES,
+                ADC_CAPTURE_RATE_HZ);
+    sensor_entity_t *onboard_entity = sensor_registry_add(
+        &sensor_registry, "temperature_onboard", "Pico Onboard Temperature", "temperature",
+        TEMPERATURE_UNIT_LABEL, read_onboard_entity, 0, &temperature_policy);
+    if (SENSOR_AGGREGATE && onboard_entity) {
+        add_aggregate_entities(onboard_entity);
+    }
+
+    // Settings name the probe behind temperature_external, so load them before the probes
+    bool settings_loaded = flash_settings_load(&sensor_settings);
+
+    // Initialize DS18B20 external temperature sensors, one bus per GPIO pin
+    for (size_t b = 0; b < DS18B20_BUS_COUNT; b++) {
+        ds18b20_bus_t *bus = &ds18b20_buses[b];
+        INFO_printf("Initializing DS18B20 sensors on GPIO %u...\n", ds18b20_gpio_pins[b]);
+        ds18b20_result_t ds18b20_result = ds18b20_init(bus, ds18b20_gpio_pins[b]);
+        if (ds18b20_result == DS18B20_OK) {
+            INFO_printf("DS18B20 bus on GPIO %u initialized, %d probe(s) found\n",
+                        ds18b20_gpio_pins[b], ds18b20_device_count(bus));
+        } else {
+            WARN_printf("DS18B20 initialization on GPIO %u failed: %s\n", ds18b20_gpio_pins[b],
+                        ds18b20_error_string(ds18b20_result));
+            continue;
+        }
+#if DS18B20_FAST_READ
+        ds18b20_set_read_mode(bus, DS18B20_READ_FAST);
+#endif
+
+        for (int i = 0; i < ds18b20_device_count(bus); i++) {
+            ds18b20_result_t resolution_result = ds18b20_set_resolution(bus, i, DS18B20_RESOLUTION);
+            if (resolution_result != DS18B20_OK) {
+                WARN_printf("DS18B20 probe %d: failed to set %d-bit resolution: %s\n", i,
+                            DS18B20_RESOLUTION, ds18b20_error_string(resolution_result));
+            }
+            ds18b20_probes[ds18b20_probe_count].bus = bus;
+            ds18b20_probes[ds18b20_probe_count].index = i;
+            ds18b20_probe_count++;
+        }
+    }
+
+    // One probe keeps the original entity, pinned by its ROM code so that probes found
+    // earlier in search order later on do not take it over; the others are keyed by ROM
+    int legacy_probe = find_legacy_probe();
+    for (int p = 0; p < ds18b20_probe_count; p++) {
+        ds18b20_probe_t *probe = &ds18b20_probes[p];
+        char rom[DS18B20_ROM_SIZE * 2 + 1];
+        ds18b20_rom_string(probe->bus, probe->index, rom, sizeof(rom));
+        char object_id[SENSOR_OBJECT_ID_LEN];
+        char name[SENSOR_NAME_LEN];
+        if (p == legacy_probe) {
+            snprintf(object_id, sizeof(object_id), "temperature_external");
+            snprintf(name, sizeof(name), "Pico External Temperature");
+        } else {
+            // Serial number bytes right after the family code tell probes apart
+            snprintf(object_id, sizeof(object_id), "temperature_external_%s", rom);
+            snprintf(name, sizeof(name), "Pico External Temperature %.4s", &rom[2]);
+        }
+        sensor_entity_t *probe_entity = sensor_registry_add(
+            &sensor_registry, object_id, name, "temperature", TEMPERATURE_UNIT_LABEL,
+            read_ds18b20_entity, p, &temperature_policy);
+        if (!probe_entity) {
+            WARN_printf("Sensor registry full, DS18B20 probe %d not published\n", p);
+        } else if (SENSOR_AGGREGATE) {
+            add_aggregate_entities(probe_entity);
+        }
+        INFO_printf("DS18B20 probe %d: GPIO %u, ROM %s, %d-bit -> %s\n", p,
+                    probe->bus->onewire.gpio, rom, ds18b20_get_resolution(probe->bus, probe->index),
+                    object_id);
+    }
+    if (ds18b20_probe_count == 0) {
         WARN_printf("External temperature sensor will not be available\n");
     }
+    if (!sensor_registry_add(&sensor_registry, "rssi", "Pico WiFi Signal", "signal_strength",
+                             "dBm", read_rssi_entity, 0, &rssi_policy)) {
+        WARN_printf("Sensor registry full, rssi not published\n");
+    }
 
     static MQTT_CLIENT_DATA_T state;
 
@@ -658,6 +2346,18 @@ int main(void) {
         panic("Failed to inizialize CYW43");
     }
 
+#if SENSOR_FLASH_LOG
+    // Mount before core1 runs, since a blank region is formatted here
+    flash_log_start();
+#endif
+
+    // Sample sensors on core1, away from the network stack
+    multicore_launch_core1(sensor_core1_entry);
+#if SENSOR_AGGREGATE
+    async_context_add_at_time_worker_in_ms(cyw43_arch_async_context(), &sample_drain_worker,
+                                           SENSOR_SAMPLE_INTERVAL_MS);
+#endif
+
     // Use board unique id
     char unique_id_buf[5];
     pico_get_unique_board_id_string(unique_id_buf, sizeof(unique_id_buf));
@@ -676,6 +2376,7 @@ int main(void) {
     strncpy(state.device_id, client_id_buf, sizeof(state.device_id) - 1);
     state.device_id[sizeof(state.device_id) - 1] = 0;
     state.ha_discovery_sent = false;
+    state.discovery_next = -1;
     state.discovery_send_time = nil_time;
 
     state.mqtt_client_info.client_id = client_id_buf;
@@ -687,9 +2388,15 @@ int main(void) {
     state.mqtt_client_info.client_user = NULL;
     state.mqtt_client_info.client_pass = NULL;
 #endif
-    static char will_topic[MQTT_TOPIC_LEN];
-    snprintf(will_topic, sizeof(will_topic), "pico/%s/status", state.device_id);
-    state.mqtt_client_info.will_topic = will_topic;
+    build_topics(&state);
+    check_commands();
+    state.discovery_hash = ha_discovery_hash(&state);
+    if (settings_loaded) {
+        INFO_printf("Discovery configs %s since last sent\n",
+                    state.discovery_hash == sensor_settings.discovery_hash ? "unchanged"
+                                                                           : "changed");
+    }
+    state.mqtt_client_info.will_topic = state.availability_topic;
     state.mqtt_client_info.will_msg = "offline";
     state.mqtt_client_info.will_qos = MQTT_WILL_QOS;
     state.mqtt_client_info.will_retain = true;
@@ -724,6 +2431,13 @@ int main(void) {
     }
     INFO_printf("\nConnected to Wifi\n");
 
+    // Timestamp samples once the clock is set; lwIP resyncs it every SNTP_SYNC_INTERVAL_S
+    cyw43_arch_lwip_begin();
+    sntp_setoperatingmode(SNTP_OPMODE_POLL);
+    sntp_setservername(0, SNTP_SERVER);
+    sntp_init();
+    cyw43_arch_lwip_end();
+
     // We are not in a callback so locking is needed when calling lwip
     // Make a DNS request for the MQTT server IP address
     cyw43_arch_lwip_begin();
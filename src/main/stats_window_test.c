@@ -0,0 +1,153 @@
+/**
+ * Statistics Window Test
+ * Feeds random windows through the streaming statistics and checks min,
+ * max, mean and standard deviation against a two-pass reference over a
+ * plain copy of the samples: small and large counts, values far from zero
+ * with little spread, where a float mean loses the hundredths, negative
+ * values, ties in rounding and windows large enough for the fallback sum.
+ * Built by host/CMakeLists.txt; exits non-zero if any check fails.
+ *
+ * Usage: stats_window_test [windows] [seed]
+ *
+ * Copyright (c) 2024 Peter Westlund
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "stats_window.h"
+#include "host_test.h"
+
+#define MAX_SAMPLES 400000
+
+static int32_t samples[MAX_SAMPLES];
+
+/**
+ * Check a rounded result against the exact value it should be rounded from
+ * Either neighbour is taken when the exact value is a hair from a tie, where long double
+ * cannot tell which side it is on.
+ */
+static bool rounds_to(int32_t result, long double exact) {
+    long double nearest = roundl(exact);
+    if (result == (int32_t) nearest) {
+        return true;
+    }
+    long double frac = exact - floorl(exact);
+    return fabsl(frac - 0.5L) < 1e-9L && (result == (int32_t) floorl(exact) ||
+                                          result == (int32_t) ceill(exact));
+}
+
+/**
+ * Add samples to a fresh window and compare it with a two-pass reference over them
+ *
+ * @param fallback Expect the window to need the fallback sum, whose m2 may be off by one
+ */
+static void check_window(const char *label, const int32_t *values, uint32_t count,
+                         bool fallback) {
+    stats_window_t window;
+    stats_window_reset(&window);
+    for (uint32_t i = 0; i < count; i++) {
+        stats_window_add(&window, values[i]);
+    }
+
+    int32_t min = values[0];
+    int32_t max = values[0];
+    long long sum = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        min = values[i] < min ? values[i] : min;
+        max = values[i] > max ? values[i] : max;
+        sum += values[i];
+    }
+    long double mean = (long double) sum / count;
+    long double m2 = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        long double diff = values[i] - mean;
+        m2 += diff * diff;
+    }
+    long double stddev = count > 1 ? sqrtl(m2 / (count - 1)) : 0;
+
+    CHECK(window.count == count, "%s: count %u, expected %u", label, window.count, count);
+    CHECK(window.min == min && window.max == max, "%s: min/max %ld/%ld, expected %ld/%ld", label,
+          (long) window.min, (long) window.max, (long) min, (long) max);
+    int32_t got_mean = stats_window_mean(&window);
+    CHECK(rounds_to(got_mean, mean), "%s: mean %ld, expected %.4Lf", label, (long) got_mean,
+          mean);
+    int32_t got_stddev = stats_window_stddev(&window);
+    bool stddev_ok = fallback ? fabsl(got_stddev - stddev) <= 0.5L + 1e-3L
+                              : rounds_to(got_stddev, stddev);
+    CHECK(stddev_ok, "%s: stddev %ld, expected %.4Lf", label, (long) got_stddev, stddev);
+}
+
+static void test_fixed(void) {
+    stats_window_t window;
+    stats_window_reset(&window);
+    CHECK(stats_window_mean(&window) == 0 && stats_window_stddev(&window) == 0,
+          "empty window not 0");
+    stats_window_add(&window, -2150);
+    CHECK(stats_window_mean(&window) == -2150 && stats_window_stddev(&window) == 0,
+          "single sample: mean %ld, stddev %ld", (long) stats_window_mean(&window),
+          (long) stats_window_stddev(&window));
+
+    // Ties round away from zero, also when the first sample is on the other side of it
+    CHECK(stats_window_mean(&(stats_window_t){.count = 2, .origin = 1, .sum = 1}) == 2,
+          "1.5 not rounded up");
+    CHECK(stats_window_mean(&(stats_window_t){.count = 2, .origin = -1, .sum = -1}) == -2,
+          "-1.5 not rounded down");
+    CHECK(stats_window_mean(&(stats_window_t){.count = 2, .origin = 10, .sum = -21}) == -1,
+          "-0.5 not rounded down");
+    CHECK(stats_window_mean(&(stats_window_t){.count = 2, .origin = -10, .sum = 21}) == 1,
+          "0.5 not rounded up");
+
+    static const int32_t pair[] = {0, 1};
+    check_window("0 and 1", pair, 2, false);
+    static const int32_t tie[] = {0, 1, 0, 1, 0, 1, 0, 1}; // Variance 2/7
+    check_window("alternating", tie, 8, false);
+    static const int32_t extremes[] = {INT32_MIN, INT32_MIN + 1, INT32_MIN + 3};
+    check_window("near INT32_MIN", extremes, 3, false);
+    static const int32_t spread[] = {-100000, 100000, -100000, 100000};
+    check_window("wide spread", spread, 4, false);
+
+    // 100 degrees with a hundredth of noise, where a float mean drifts by whole hundredths
+    for (uint32_t i = 0; i < 100000; i++) {
+        samples[i] = 10000 + (int32_t) rng_below(3) - 1;
+    }
+    check_window("long window near 100 degrees", samples, 100000, false);
+
+    // Enough spread over enough samples for the fallback sum
+    for (uint32_t i = 0; i < MAX_SAMPLES; i++) {
+        samples[i] = (int32_t) rng_below(2000001) - 1000000;
+    }
+    check_window("fallback sum", samples, MAX_SAMPLES, true);
+}
+
+/**
+ * Random temperature-like window: a base, a drift and noise of random size
+ */
+static uint32_t random_window(void) {
+    uint32_t count = rng_below(4) == 0 ? 1 + rng_below(4) : 1 + rng_below(5000);
+    int32_t base = rng_below(8) == 0 ? (int32_t) rng() / 2 : (int32_t) rng_below(25001) - 12500;
+    int32_t noise = (int32_t) rng_below(1u << rng_below(16));
+    int32_t drift = (int32_t) rng_below(5) - 2;
+    for (uint32_t i = 0; i < count; i++) {
+        samples[i] = base + drift * (int32_t) (i / 16) + (int32_t) rng_below(2 * noise + 1) - noise;
+    }
+    return count;
+}
+
+int main(int argc, char **argv) {
+    unsigned long windows = argc > 1 ? strtoul(argv[1], NULL, 0) : 2000;
+    unsigned long long seed = argc > 2 ? strtoull(argv[2], NULL, 0) : 0x5eed;
+    rng_seed(seed);
+
+    test_fixed();
+    for (unsigned long w = 0; w < windows && !host_test_bailed(); w++) {
+        char label[40];
+        snprintf(label, sizeof(label), "random window %lu", w);
+        check_window(label, samples, random_window(), false);
+    }
+
+    printf("%lu random windows, seed 0x%llx\n", windows, seed);
+    return host_test_summary();
+}
@@ -0,0 +1,171 @@
+/**
+ * Wall Clock Test
+ * Runs the wall clock against simulated crystals with random rate errors,
+ * synced at random intervals with random jitter, and checks the conversion
+ * to Unix time: nothing before the first sync, the anchor after one sync,
+ * the drift estimate and the time between syncs after several, no update
+ * from syncs too close together, and the reset on a time step.
+ * Built by host/CMakeLists.txt; exits non-zero if any check fails.
+ *
+ * Usage: wall_clock_test [crystals] [seed]
+ *
+ * Copyright (c) 2024 Peter Westlund
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "wall_clock.h"
+#include "host_test.h"
+
+#define SECOND_US 1000000ull
+#define HOUR_US (3600 * SECOND_US)
+#define UNIX_START_US (1700000000ull * SECOND_US)
+#define MAX_JITTER_US 5000 // SNTP answers are off by up to this much
+#define SYNCS 24
+
+/**
+ * A local timer counting at a wrong rate from boot, and the true time it started at
+ */
+typedef struct {
+    int32_t drift_ppb; // Positive when the local timer runs slow
+    uint64_t boot_unix_us;
+} crystal_t;
+
+static uint64_t true_unix_us(const crystal_t *crystal, uint64_t local_us) {
+    return crystal->boot_unix_us + local_us + (int64_t) local_us * crystal->drift_ppb / 1000000000;
+}
+
+static int64_t jitter_us(void) {
+    return (int64_t) rng_below(2 * MAX_JITTER_US + 1) - MAX_JITTER_US;
+}
+
+static int64_t abs64(int64_t value) {
+    return value < 0 ? -value : value;
+}
+
+static void test_unsynced(void) {
+    wall_clock_t clock = {0};
+    CHECK(!wall_clock_valid(&clock), "zeroed clock valid");
+    CHECK(wall_clock_unix_us(&clock, 0) == 0 && wall_clock_unix_us(&clock, HOUR_US) == 0,
+          "unsynced clock gave a time");
+}
+
+static void test_first_sync(void) {
+    wall_clock_t clock = {0};
+    wall_clock_sync(&clock, 10 * SECOND_US, UNIX_START_US);
+    CHECK(wall_clock_valid(&clock), "synced clock not valid");
+    CHECK(clock.drift_ppb == 0, "drift %ld after one sync", (long) clock.drift_ppb);
+    CHECK(wall_clock_unix_us(&clock, 10 * SECOND_US) == UNIX_START_US, "anchor moved");
+    CHECK(wall_clock_unix_us(&clock, 70 * SECOND_US) == UNIX_START_US + 60 * SECOND_US,
+          "minute after the sync off");
+    // Readings taken before the sync are placed before it
+    CHECK(wall_clock_unix_us(&clock, 4 * SECOND_US) == UNIX_START_US - 6 * SECOND_US,
+          "reading before the sync off");
+}
+
+/**
+ * Syncs closer together than WALL_CLOCK_MIN_DRIFT_INTERVAL_US move the anchor only
+ */
+static void test_short_interval(void) {
+    wall_clock_t clock = {0};
+    wall_clock_sync(&clock, 0, UNIX_START_US);
+    wall_clock_sync(&clock, HOUR_US, UNIX_START_US + HOUR_US + 360000); // 100 ppm slow
+    int32_t drift_ppb = clock.drift_ppb;
+    CHECK(drift_ppb > 99000 && drift_ppb < 101000, "drift %ld, expected 100000",
+          (long) drift_ppb);
+
+    uint64_t local_us = HOUR_US + WALL_CLOCK_MIN_DRIFT_INTERVAL_US - SECOND_US;
+    wall_clock_sync(&clock, local_us, UNIX_START_US + local_us + 50 * MAX_JITTER_US);
+    CHECK(clock.drift_ppb == drift_ppb, "short interval moved drift to %ld",
+          (long) clock.drift_ppb);
+    CHECK(wall_clock_unix_us(&clock, local_us) == UNIX_START_US + local_us + 50 * MAX_JITTER_US,
+          "short interval sync not anchored");
+}
+
+/**
+ * A time step, such as the first SNTP answer after a fallback time, is no drift
+ */
+static void test_step(void) {
+    wall_clock_t clock = {0};
+    wall_clock_sync(&clock, 0, UNIX_START_US);
+    wall_clock_sync(&clock, HOUR_US, UNIX_START_US + HOUR_US + 36000); // 10 ppm slow
+    CHECK(clock.drift_ppb != 0, "no drift estimated");
+
+    uint64_t local_us = 2 * HOUR_US;
+    uint64_t unix_us = UNIX_START_US + local_us + 3 * HOUR_US;
+    wall_clock_sync(&clock, local_us, unix_us);
+    CHECK(clock.drift_ppb == 0, "step taken for %ld ppb of drift", (long) clock.drift_ppb);
+    CHECK(wall_clock_unix_us(&clock, local_us + HOUR_US) == unix_us + HOUR_US,
+          "hour after the step off");
+
+    // Backwards too
+    wall_clock_sync(&clock, local_us + HOUR_US, UNIX_START_US);
+    CHECK(clock.drift_ppb == 0, "backward step taken for %ld ppb of drift",
+          (long) clock.drift_ppb);
+}
+
+/**
+ * Sync a random crystal at random intervals and check the estimate and the time between syncs
+ */
+static void test_crystal(uint32_t index) {
+    crystal_t crystal = {
+        .drift_ppb = (int32_t) rng_below(2 * 200000 + 1) - 200000,
+        .boot_unix_us = UNIX_START_US + (uint64_t) rng_below(1000000) * SECOND_US,
+    };
+    wall_clock_t clock = {0};
+    uint64_t local_us = SECOND_US + rng_below(30 * SECOND_US);
+    uint64_t interval_us = 0;
+
+    for (int sync = 0; sync < SYNCS && !host_test_bailed(); sync++) {
+        int64_t jitter = jitter_us();
+        uint64_t unix_us = true_unix_us(&crystal, local_us);
+        if (sync > 0) {
+            // Before the sync the clock is off by the rate error over the interval, and both
+            // jitters; from the second interval on the rate error is the estimate's
+            int64_t error = (int64_t) (wall_clock_unix_us(&clock, local_us) - unix_us);
+            int64_t limit = 2 * MAX_JITTER_US + 2;
+            if (sync == 1) {
+                limit += abs64((int64_t) interval_us * crystal.drift_ppb / 1000000000);
+            } else {
+                // The estimate came from an interval of at least an hour with two jitters
+                limit += (int64_t) (interval_us / HOUR_US + 1) * 2 * MAX_JITTER_US;
+            }
+            CHECK(abs64(error) <= limit, "crystal %u sync %d: off by %lld us, limit %lld",
+                  index, sync, (long long) error, (long long) limit);
+        }
+        wall_clock_sync(&clock, local_us, unix_us + jitter);
+        CHECK(abs64((int64_t) (wall_clock_unix_us(&clock, local_us) - unix_us)) <= MAX_JITTER_US,
+              "crystal %u sync %d: not anchored", index, sync);
+
+        if (sync > 0) {
+            // Two jitters over the interval, plus a second's truncation at the drift
+            int64_t limit = 2 * MAX_JITTER_US * 1000 / (int64_t) (interval_us / SECOND_US) + 1000;
+            CHECK(abs64(clock.drift_ppb - crystal.drift_ppb) <= limit,
+                  "crystal %u sync %d: drift %ld, true %ld", index, sync,
+                  (long) clock.drift_ppb, (long) crystal.drift_ppb);
+        }
+
+        // Between one and twelve hours, not on a whole second
+        interval_us = HOUR_US + rng_below(11) * HOUR_US + rng_below(SECOND_US);
+        local_us += interval_us;
+    }
+    CHECK(clock.syncs == SYNCS, "crystal %u: %u syncs counted", index, clock.syncs);
+}
+
+int main(int argc, char **argv) {
+    unsigned long crystals = argc > 1 ? strtoul(argv[1], NULL, 0) : 1000;
+    unsigned long long seed = argc > 2 ? strtoull(argv[2], NULL, 0) : 0x5eed;
+    rng_seed(seed);
+
+    test_unsynced();
+    test_first_sync();
+    test_short_interval();
+    test_step();
+    for (uint32_t i = 0; i < crystals && !host_test_bailed(); i++) {
+        test_crystal(i);
+    }
+
+    printf("%lu crystals, %d syncs each, seed 0x%llx\n", crystals, SYNCS, seed);
+    return host_test_summary();
+}
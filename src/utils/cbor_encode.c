@@ -0,0 +1,113 @@
+/**
+ * CBOR Encoder Implementation
+ *
+ * Copyright (c) 2024 Peter Westlund
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "cbor_encode.h"
+#include <string.h>
+
+/* Major types, in the top three bits of the initial byte */
+#define CBOR_UINT 0x00
+#define CBOR_NEGINT 0x20
+#define CBOR_TEXT 0x60
+#define CBOR_ARRAY 0x80
+#define CBOR_MAP 0xa0
+
+#define CBOR_INDEFINITE 0x1f
+#define CBOR_BREAK 0xff
+
+void cbor_writer_init(cbor_writer_t *writer, void *buf, size_t size) {
+    writer->buf = buf;
+    writer->size = size;
+    writer->used = 0;
+    writer->overflow = false;
+}
+
+static bool reserve(cbor_writer_t *writer, size_t len) {
+    if (writer->overflow || writer->size - writer->used < len) {
+        writer->overflow = true;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Write an initial byte with its argument in the shortest form
+ */
+static void put_head(cbor_writer_t *writer, uint8_t major, uint64_t arg) {
+    uint8_t head[9];
+    size_t len;
+    if (arg < 24) {
+        head[0] = major | (uint8_t) arg;
+        len = 1;
+    } else if (arg <= UINT8_MAX) {
+        head[0] = major | 24;
+        len = 2;
+    } else if (arg <= UINT16_MAX) {
+        head[0] = major | 25;
+        len = 3;
+    } else if (arg <= UINT32_MAX) {
+        head[0] = major | 26;
+        len = 5;
+    } else {
+        head[0] = major | 27;
+        len = 9;
+    }
+    // Argument follows big endian
+    for (size_t i = len - 1; i > 0; i--) {
+        head[i] = (uint8_t) arg;
+        arg >>= 8;
+    }
+    if (reserve(writer, len)) {
+        memcpy(&writer->buf[writer->used], head, len);
+        writer->used += len;
+    }
+}
+
+void cbor_put_uint(cbor_writer_t *writer, uint64_t value) {
+    put_head(writer, CBOR_UINT, value);
+}
+
+void cbor_put_int(cbor_writer_t *writer, int64_t value) {
+    // Negative n is stored as -1 - n, which cannot overflow
+    if (value < 0) {
+        put_head(writer, CBOR_NEGINT, (uint64_t) (-1 - value));
+    } else {
+        put_head(writer, CBOR_UINT, (uint64_t) value);
+    }
+}
+
+void cbor_put_text(cbor_writer_t *writer, const char *text, size_t len) {
+    put_head(writer, CBOR_TEXT, len);
+    if (reserve(writer, len)) {
+        memcpy(&writer->buf[writer->used], text, len);
+        writer->used += len;
+    }
+}
+
+void cbor_put_cstr(cbor_writer_t *writer, const char *text) {
+    cbor_put_text(writer, text, strlen(text));
+}
+
+void cbor_put_array(cbor_writer_t *writer, size_t count) {
+    put_head(writer, CBOR_ARRAY, count);
+}
+
+void cbor_put_map(cbor_writer_t *writer, size_t count) {
+    put_head(writer, CBOR_MAP, count);
+}
+
+void cbor_put_array_indefinite(cbor_writer_t *writer) {
+    if (reserve(writer, 1)) {
+        writer->buf[writer->used++] = CBOR_ARRAY | CBOR_INDEFINITE;
+    }
+}
+
+void cbor_put_break(cbor_writer_t *writer) {
+    if (reserve(writer, 1)) {
+        writer->buf[writer->used++] = CBOR_BREAK;
+    }
+}
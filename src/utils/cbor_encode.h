@@ -0,0 +1,86 @@
+/**
+ * CBOR Encoder Header
+ * Minimal RFC 8949 encoder for compact telemetry payloads. Writes straight
+ * into a caller buffer with no heap use; integers always take the shortest
+ * form, so a temperature in hundredths is three bytes.
+ *
+ * Copyright (c) 2024 Peter Westlund
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef CBOR_ENCODE_H
+#define CBOR_ENCODE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Encoder state
+ * Once a value does not fit, overflow is set and further writes are ignored.
+ * Saving used and restoring it, with overflow cleared, takes back the values
+ * written since.
+ */
+typedef struct {
+    uint8_t *buf;
+    size_t size;
+    size_t used;
+    bool overflow;
+} cbor_writer_t;
+
+/**
+ * Start encoding into a buffer
+ */
+void cbor_writer_init(cbor_writer_t *writer, void *buf, size_t size);
+
+/**
+ * Encode an unsigned integer
+ */
+void cbor_put_uint(cbor_writer_t *writer, uint64_t value);
+
+/**
+ * Encode a signed integer
+ */
+void cbor_put_int(cbor_writer_t *writer, int64_t value);
+
+/**
+ * Encode a UTF-8 text string
+ */
+void cbor_put_text(cbor_writer_t *writer, const char *text, size_t len);
+
+/**
+ * Encode a NUL terminated UTF-8 text string
+ */
+void cbor_put_cstr(cbor_writer_t *writer, const char *text);
+
+/**
+ * Start an array of count items
+ */
+void cbor_put_array(cbor_writer_t *writer, size_t count);
+
+/**
+ * Start a map of count key/value pairs
+ */
+void cbor_put_map(cbor_writer_t *writer, size_t count);
+
+/**
+ * Start an array whose length is not known yet; end it with cbor_put_break()
+ */
+void cbor_put_array_indefinite(cbor_writer_t *writer);
+
+/**
+ * End an indefinite length array
+ */
+void cbor_put_break(cbor_writer_t *writer);
+
+/**
+ * Get the encoded length
+ *
+ * @return Bytes written, 0 if anything did not fit
+ */
+static inline size_t cbor_writer_len(const cbor_writer_t *writer) {
+    return writer->overflow ? 0 : writer->used;
+}
+
+#endif // CBOR_ENCODE_H
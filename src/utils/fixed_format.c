@@ -0,0 +1,48 @@
+/**
+ * Fixed-Point Formatting Utility Implementation
+ *
+ * Copyright (c) 2024 Peter Westlund
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "fixed_format.h"
+
+size_t fixed_format_centi(int32_t value, char *buf, size_t len) {
+    return fixed_format_decimals(value, 2, buf, len);
+}
+
+size_t fixed_format_decimals(int32_t value, unsigned int decimals, char *buf, size_t len) {
+    char digits[FIXED_FORMAT_CENTI_LEN];
+    size_t n = 0;
+
+    // Work on the magnitude as unsigned so INT32_MIN does not overflow
+    uint32_t magnitude = value < 0 ? 0u - (uint32_t) value : (uint32_t) value;
+
+    // Digits are produced least significant first: decimals, point, integer part
+    do {
+        digits[n++] = (char) ('0' + magnitude % 10);
+        magnitude /= 10;
+        if (n == decimals) {
+            digits[n++] = '.';
+            if (magnitude == 0) {
+                digits[n++] = '0';
+            }
+        }
+    } while (magnitude != 0 || n <= decimals);
+    if (value < 0) {
+        digits[n++] = '-';
+    }
+
+    if (n + 1 > len) {
+        if (len > 0) {
+            buf[0] = '\0';
+        }
+        return 0;
+    }
+    for (size_t i = 0; i < n; i++) {
+        buf[i] = digits[n - 1 - i];
+    }
+    buf[n] = '\0';
+    return n;
+}
@@ -0,0 +1,41 @@
+/**
+ * Fixed-Point Formatting Utility Header
+ * Integer-only decimal formatting for temperatures carried in hundredths,
+ * so payload generation does not pull in the soft-float printf path
+ *
+ * Copyright (c) 2024 Peter Westlund
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef FIXED_FORMAT_H
+#define FIXED_FORMAT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Longest formatted value: "-21474836.48" plus terminator */
+#define FIXED_FORMAT_CENTI_LEN 13
+
+/**
+ * Format a value in hundredths with two decimals, e.g. -1234 -> "-12.34"
+ *
+ * @param value Value in hundredths
+ * @param buf Output buffer
+ * @param len Buffer size, FIXED_FORMAT_CENTI_LEN always suffices
+ * @return Characters written excluding the terminator, 0 if buf is too small
+ */
+size_t fixed_format_centi(int32_t value, char *buf, size_t len);
+
+/**
+ * Format a fixed point value with 0, 1 or 2 decimals, e.g. (-1234, 1) -> "-123.4"
+ *
+ * @param value Value in units of the last decimal
+ * @param decimals Digits after the point, 0 for a whole number without a point
+ * @param buf Output buffer
+ * @param len Buffer size, FIXED_FORMAT_CENTI_LEN always suffices
+ * @return Characters written excluding the terminator, 0 if buf is too small
+ */
+size_t fixed_format_decimals(int32_t value, unsigned int decimals, char *buf, size_t len);
+
+#endif // FIXED_FORMAT_H
@@ -0,0 +1,140 @@
+/**
+ * History Ring Implementation
+ * Records are <source> <time delta> <zigzag value delta>, each a LEB128 varint.
+ *
+ * Copyright (c) 2024 Peter Westlund
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "history_ring.h"
+#include <string.h>
+
+/* Longest record: 1-byte source, 10-byte time delta, 5-byte value delta */
+#define HISTORY_RECORD_MAX 16
+
+/**
+ * Decoder position and the state the next record is relative to
+ */
+typedef struct {
+    size_t offset;
+    uint64_t time_ms;
+    int32_t values[HISTORY_RING_SOURCES];
+} history_cursor_t;
+
+static size_t put_varint(uint8_t *buf, uint64_t value) {
+    size_t len = 0;
+    while (value >= 0x80) {
+        buf[len++] = (uint8_t) (value | 0x80);
+        value >>= 7;
+    }
+    buf[len++] = (uint8_t) value;
+    return len;
+}
+
+static uint64_t get_varint(const history_ring_t *ring, size_t *offset) {
+    uint64_t value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        uint8_t byte = ring->buf[*offset];
+        *offset = (*offset + 1) % HISTORY_RING_SIZE;
+        value |= (uint64_t) (byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            break;
+        }
+    }
+    return value;
+}
+
+/**
+ * Decode the record at the cursor and advance past it
+ */
+static void history_decode(const history_ring_t *ring, history_cursor_t *cursor,
+                           history_sample_t *sample) {
+    uint8_t source = (uint8_t) get_varint(ring, &cursor->offset);
+    uint64_t delta_ms = get_varint(ring, &cursor->offset);
+    uint32_t zigzag = (uint32_t) get_varint(ring, &cursor->offset);
+    int32_t delta = (int32_t) (zigzag >> 1) ^ -(int32_t) (zigzag & 1);
+
+    cursor->time_ms += delta_ms;
+    cursor->values[source] = (int32_t) ((uint32_t) cursor->values[source] + (uint32_t) delta);
+
+    sample->time_ms = cursor->time_ms;
+    sample->value = cursor->values[source];
+    sample->source = source;
+}
+
+void history_ring_init(history_ring_t *ring) {
+    memset(ring, 0, sizeof(*ring));
+}
+
+bool history_ring_push(history_ring_t *ring, const history_sample_t *sample) {
+    if (sample->source >= HISTORY_RING_SOURCES) {
+        return false;
+    }
+
+    // Wrapping subtraction gives the shortest delta; zigzag keeps small negatives short
+    uint64_t time_ms = sample->time_ms > ring->tail_time_ms ? sample->time_ms : ring->tail_time_ms;
+    int32_t delta = (int32_t) ((uint32_t) sample->value -
+                               (uint32_t) ring->tail_values[sample->source]);
+    uint32_t zigzag = ((uint32_t) delta << 1) ^ (uint32_t) (delta >> 31);
+
+    uint8_t record[HISTORY_RECORD_MAX];
+    size_t len = put_varint(record, sample->source);
+    len += put_varint(&record[len], time_ms - ring->tail_time_ms);
+    len += put_varint(&record[len], zigzag);
+
+    // Make room by dropping the oldest records
+    while (HISTORY_RING_SIZE - ring->used < len) {
+        history_ring_drop(ring, 1);
+        ring->dropped++;
+    }
+
+    size_t offset = (ring->start + ring->used) % HISTORY_RING_SIZE;
+    for (size_t i = 0; i < len; i++) {
+        ring->buf[offset] = record[i];
+        offset = (offset + 1) % HISTORY_RING_SIZE;
+    }
+    ring->used += len;
+    ring->count++;
+
+    ring->tail_time_ms = time_ms;
+    ring->tail_values[sample->source] = sample->value;
+    return true;
+}
+
+size_t history_ring_peek(const history_ring_t *ring, size_t skip, history_sample_t *samples,
+                         size_t max) {
+    history_cursor_t cursor = {.offset = ring->start, .time_ms = ring->head_time_ms};
+    memcpy(cursor.values, ring->head_values, sizeof(cursor.values));
+
+    // Skipped records are still decoded, as each is relative to the one before
+    size_t left = ring->count;
+    for (; skip > 0 && left > 0; skip--, left--) {
+        history_sample_t sample;
+        history_decode(ring, &cursor, &sample);
+    }
+
+    size_t n = 0;
+    while (n < max && n < left) {
+        history_decode(ring, &cursor, &samples[n]);
+        n++;
+    }
+    return n;
+}
+
+void history_ring_drop(history_ring_t *ring, size_t n) {
+    history_cursor_t cursor = {.offset = ring->start, .time_ms = ring->head_time_ms};
+    memcpy(cursor.values, ring->head_values, sizeof(cursor.values));
+
+    for (; n > 0 && ring->count > 0; n--) {
+        history_sample_t sample;
+        size_t before = cursor.offset;
+        history_decode(ring, &cursor, &sample);
+        ring->used -= (cursor.offset + HISTORY_RING_SIZE - before) % HISTORY_RING_SIZE;
+        ring->count--;
+    }
+
+    ring->start = cursor.offset;
+    ring->head_time_ms = cursor.time_ms;
+    memcpy(ring->head_values, cursor.values, sizeof(ring->head_values));
+}
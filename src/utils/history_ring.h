@@ -0,0 +1,99 @@
+/**
+ * History Ring Header
+ * Compact RAM store of timestamped readings kept while the broker is
+ * unreachable. Records are delta encoded as variable-length integers, so a
+ * typical reading takes four bytes; when the ring is full the oldest
+ * readings are dropped.
+ *
+ * Copyright (c) 2024 Peter Westlund
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef HISTORY_RING_H
+#define HISTORY_RING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Ring size in bytes */
+#ifndef HISTORY_RING_SIZE
+#define HISTORY_RING_SIZE 8192
+#endif
+
+/* Number of distinct sources, e.g. sensor entities */
+#ifndef HISTORY_RING_SOURCES
+#define HISTORY_RING_SOURCES 32
+#endif
+
+/**
+ * One stored reading
+ */
+typedef struct {
+    uint64_t time_ms; // Milliseconds since boot
+    int32_t value;    // Value in hundredths
+    uint8_t source;   // Source id, below HISTORY_RING_SOURCES
+} history_sample_t;
+
+/**
+ * Ring state
+ * Each record holds the source, the time since the previous record and the
+ * change from the previous value of the same source. The decoder keeps the
+ * state as of the oldest record and the encoder the state as of the newest.
+ */
+typedef struct {
+    uint8_t buf[HISTORY_RING_SIZE];
+    size_t start; // Offset of the oldest record
+    size_t used;  // Bytes in use
+    uint32_t count;
+    uint32_t dropped; // Records overwritten because the ring was full
+
+    uint64_t head_time_ms; // Time of the last record taken out
+    int32_t head_values[HISTORY_RING_SOURCES];
+    uint64_t tail_time_ms; // Time of the last record put in
+    int32_t tail_values[HISTORY_RING_SOURCES];
+} history_ring_t;
+
+/**
+ * Empty the ring
+ */
+void history_ring_init(history_ring_t *ring);
+
+/**
+ * Append a reading, dropping the oldest ones if there is no room
+ *
+ * @param ring Ring to append to
+ * @param sample Reading to store; times before the newest stored reading are clamped to it
+ * @return false if the source id is out of range
+ */
+bool history_ring_push(history_ring_t *ring, const history_sample_t *sample);
+
+/**
+ * Decode the oldest readings without removing them
+ *
+ * @param ring Ring to read from
+ * @param skip Number of oldest readings to pass over, e.g. ones sent but not yet acknowledged
+ * @param samples Output array
+ * @param max Size of the output array
+ * @return Number of readings decoded
+ */
+size_t history_ring_peek(const history_ring_t *ring, size_t skip, history_sample_t *samples,
+                         size_t max);
+
+/**
+ * Remove the oldest readings, typically after they were peeked and delivered
+ *
+ * @param ring Ring to remove from
+ * @param n Number of readings to remove
+ */
+void history_ring_drop(history_ring_t *ring, size_t n);
+
+/**
+ * Get the number of stored readings
+ */
+static inline uint32_t history_ring_count(const history_ring_t *ring) {
+    return ring->count;
+}
+
+#endif // HISTORY_RING_H
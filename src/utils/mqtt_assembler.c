@@ -0,0 +1,112 @@
+/**
+ * MQTT Message Assembler Implementation
+ *
+ * Copyright (c) 2024 Peter Westlund
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "mqtt_assembler.h"
+#include <string.h>
+
+void mqtt_assembler_init(mqtt_assembler_t *assembler, mqtt_message_fn dispatch, void *arg) {
+    memset(assembler, 0, sizeof(*assembler));
+    assembler->dispatch = dispatch;
+    assembler->arg = arg;
+}
+
+static uint8_t *acquire_buffer(mqtt_assembler_t *assembler) {
+    for (int i = 0; i < MQTT_ASSEMBLER_BUFFERS; i++) {
+        if (!assembler->buffer_used[i]) {
+            assembler->buffer_used[i] = true;
+            return assembler->buffers[i];
+        }
+    }
+    return NULL;
+}
+
+static void release_buffer(mqtt_assembler_t *assembler) {
+    if (assembler->buffer) {
+        size_t i = (size_t) (assembler->buffer - assembler->buffers[0]) / MQTT_ASSEMBLER_BUF_LEN;
+        assembler->buffer_used[i] = false;
+        assembler->buffer = NULL;
+    }
+}
+
+/**
+ * End the message in progress, dropping it unless it was dispatched
+ */
+static void finish(mqtt_assembler_t *assembler, bool dispatched) {
+    if (!dispatched) {
+        assembler->stats.dropped++;
+    }
+    release_buffer(assembler);
+    assembler->active = false;
+}
+
+void mqtt_assembler_begin(mqtt_assembler_t *assembler, const char *topic, size_t total_len) {
+    if (assembler->active) {
+        finish(assembler, false); // Its last fragment never came
+    }
+    assembler->active = true;
+    assembler->total = total_len;
+    assembler->received = 0;
+    size_t topic_len = strlen(topic);
+    assembler->discard = topic_len >= sizeof(assembler->topic);
+    if (!assembler->discard) {
+        memcpy(assembler->topic, topic, topic_len + 1);
+    }
+}
+
+void mqtt_assembler_data(mqtt_assembler_t *assembler, const uint8_t *data, size_t len, bool last) {
+    if (!assembler->active) {
+        return; // No publish start, e.g. the rest of a dropped message
+    }
+    if (assembler->discard || len > assembler->total - assembler->received) {
+        assembler->discard = true;
+        if (last) {
+            finish(assembler, false);
+        }
+        return;
+    }
+
+    if (len == 0 && !last) {
+        return; // Nothing to keep, and the rest may still come in one piece
+    }
+
+    // A whole payload in one fragment goes out without a copy
+    if (assembler->received == 0 && last && len == assembler->total) {
+        mqtt_message_t message = {.topic = assembler->topic, .data = data, .len = len};
+        assembler->stats.direct++;
+        assembler->active = false;
+        assembler->dispatch(assembler->arg, &message);
+        return;
+    }
+
+    if (!assembler->buffer) {
+        if (assembler->total > MQTT_ASSEMBLER_BUF_LEN ||
+            !(assembler->buffer = acquire_buffer(assembler))) {
+            assembler->discard = true;
+            if (last) {
+                finish(assembler, false);
+            }
+            return;
+        }
+    }
+    if (len > 0) {
+        memcpy(&assembler->buffer[assembler->received], data, len);
+        assembler->received += len;
+    }
+    if (!last) {
+        return;
+    }
+    if (assembler->received != assembler->total) {
+        finish(assembler, false); // Fragments did not add up to the announced length
+        return;
+    }
+    mqtt_message_t message = {
+        .topic = assembler->topic, .data = assembler->buffer, .len = assembler->received};
+    assembler->stats.assembled++;
+    assembler->dispatch(assembler->arg, &message);
+    finish(assembler, true);
+}
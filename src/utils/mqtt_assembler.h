@@ -0,0 +1,105 @@
+/**
+ * MQTT Message Assembler Header
+ * Turns the publish start and payload fragments delivered by the lwIP MQTT
+ * client into whole messages. A payload that arrives in one fragment is
+ * passed on straight from lwIP's buffer; a fragmented one is copied into a
+ * buffer from a small fixed pool, chosen by the total length announced at
+ * the start of the publish. Messages that do not fit, or whose fragments do
+ * not add up to that length, are dropped whole, never truncated.
+ *
+ * Copyright (c) 2024 Peter Westlund
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef MQTT_ASSEMBLER_H
+#define MQTT_ASSEMBLER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Longest fragmented payload; single-fragment payloads are not limited */
+#ifndef MQTT_ASSEMBLER_BUF_LEN
+#define MQTT_ASSEMBLER_BUF_LEN 512
+#endif
+
+/* Buffers in the pool; lwIP delivers one publish at a time, so one is usually enough */
+#ifndef MQTT_ASSEMBLER_BUFFERS
+#define MQTT_ASSEMBLER_BUFFERS 1
+#endif
+
+/* Longest topic, including the terminator */
+#ifndef MQTT_ASSEMBLER_TOPIC_LEN
+#define MQTT_ASSEMBLER_TOPIC_LEN 128
+#endif
+
+/**
+ * A complete incoming message, valid only during the dispatch call
+ * The payload is not NUL terminated.
+ */
+typedef struct {
+    const char *topic;
+    const uint8_t *data;
+    size_t len;
+} mqtt_message_t;
+
+typedef void (*mqtt_message_fn)(void *arg, const mqtt_message_t *message);
+
+/**
+ * Counters
+ */
+typedef struct {
+    uint32_t direct;    // Messages dispatched from lwIP's buffer
+    uint32_t assembled; // Messages dispatched after copying their fragments
+    uint32_t dropped;   // Messages too long, without a free buffer, or inconsistent
+} mqtt_assembler_stats_t;
+
+/**
+ * Assembler state
+ */
+typedef struct {
+    uint8_t buffers[MQTT_ASSEMBLER_BUFFERS][MQTT_ASSEMBLER_BUF_LEN];
+    bool buffer_used[MQTT_ASSEMBLER_BUFFERS];
+    uint8_t *buffer; // Buffer of the message in progress, NULL until a second fragment
+    char topic[MQTT_ASSEMBLER_TOPIC_LEN];
+    size_t total;    // Payload length announced for the message in progress
+    size_t received; // Payload bytes seen so far
+    bool active;     // A message is in progress
+    bool discard;    // The rest of the message in progress is skipped
+    mqtt_message_fn dispatch;
+    void *arg;
+    mqtt_assembler_stats_t stats;
+} mqtt_assembler_t;
+
+/**
+ * Initialize an assembler
+ *
+ * @param assembler Assembler to initialize
+ * @param dispatch Called with every complete message
+ * @param arg Passed to dispatch
+ */
+void mqtt_assembler_init(mqtt_assembler_t *assembler, mqtt_message_fn dispatch, void *arg);
+
+/**
+ * Start a message, from the lwIP incoming publish callback
+ * A message still in progress is dropped.
+ *
+ * @param assembler Assembler
+ * @param topic Topic, copied
+ * @param total_len Payload length of the whole message
+ */
+void mqtt_assembler_begin(mqtt_assembler_t *assembler, const char *topic, size_t total_len);
+
+/**
+ * Add a payload fragment, from the lwIP incoming data callback
+ * The message is dispatched from here once its last fragment arrives.
+ *
+ * @param assembler Assembler
+ * @param data Fragment, may be NULL if len is 0
+ * @param len Fragment length
+ * @param last true for the last fragment, i.e. MQTT_DATA_FLAG_LAST
+ */
+void mqtt_assembler_data(mqtt_assembler_t *assembler, const uint8_t *data, size_t len, bool last);
+
+#endif // MQTT_ASSEMBLER_H
@@ -0,0 +1,43 @@
+/**
+ * Payload Template Implementation
+ *
+ * Copyright (c) 2024 Peter Westlund
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "payload_template.h"
+#include <string.h>
+
+/* Every placeholder byte, for strcspn() */
+static const char placeholders[] = "\1\2\3\4\5\6\7\10";
+
+size_t payload_template_length(const char *tmpl, const char *const *fields) {
+    size_t len = 0;
+    for (;;) {
+        size_t run = strcspn(tmpl, placeholders);
+        len += run;
+        tmpl += run;
+        if (*tmpl == '\0') {
+            return len;
+        }
+        len += strlen(fields[(unsigned char) *tmpl++]);
+    }
+}
+
+size_t payload_template_render(const char *tmpl, const char *const *fields, char *out) {
+    char *start = out;
+    for (;;) {
+        size_t run = strcspn(tmpl, placeholders);
+        memcpy(out, tmpl, run);
+        out += run;
+        tmpl += run;
+        if (*tmpl == '\0') {
+            return (size_t) (out - start);
+        }
+        const char *field = fields[(unsigned char) *tmpl++];
+        size_t field_len = strlen(field);
+        memcpy(out, field, field_len);
+        out += field_len;
+    }
+}
@@ -0,0 +1,53 @@
+/**
+ * Payload Template Header
+ * Fixed text payloads with a few runtime fields. The template is a string
+ * constant, so it stays in flash, with every constant part already joined
+ * at compile time; each field is marked by a control byte 0x01-0x08, which
+ * valid JSON text never contains unescaped. Rendering copies the runs
+ * between placeholders and splices the field strings in.
+ *
+ * Copyright (c) 2024 Peter Westlund
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef PAYLOAD_TEMPLATE_H
+#define PAYLOAD_TEMPLATE_H
+
+#include <stddef.h>
+
+/* Placeholder for field n, 1-8, to be joined with the literals around it */
+#define PAYLOAD_TEMPLATE_FIELD(n) PAYLOAD_TEMPLATE_FIELD_(n)
+#define PAYLOAD_TEMPLATE_FIELD_(n) PAYLOAD_TEMPLATE_FIELD_##n
+#define PAYLOAD_TEMPLATE_FIELD_1 "\1"
+#define PAYLOAD_TEMPLATE_FIELD_2 "\2"
+#define PAYLOAD_TEMPLATE_FIELD_3 "\3"
+#define PAYLOAD_TEMPLATE_FIELD_4 "\4"
+#define PAYLOAD_TEMPLATE_FIELD_5 "\5"
+#define PAYLOAD_TEMPLATE_FIELD_6 "\6"
+#define PAYLOAD_TEMPLATE_FIELD_7 "\7"
+#define PAYLOAD_TEMPLATE_FIELD_8 "\10"
+
+/* Highest field number supported by PAYLOAD_TEMPLATE_FIELD() */
+#define PAYLOAD_TEMPLATE_MAX_FIELD 8
+
+/**
+ * Get the rendered length of a template
+ *
+ * @param tmpl Template
+ * @param fields Field strings, indexed by field number; entry 0 is unused
+ * @return Length in bytes, without a terminator
+ */
+size_t payload_template_length(const char *tmpl, const char *const *fields);
+
+/**
+ * Render a template
+ *
+ * @param tmpl Template
+ * @param fields Field strings, indexed by field number; entry 0 is unused
+ * @param out Output buffer of payload_template_length() bytes; no terminator is written
+ * @return Bytes written
+ */
+size_t payload_template_render(const char *tmpl, const char *const *fields, char *out);
+
+#endif // PAYLOAD_TEMPLATE_H
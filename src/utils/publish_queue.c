@@ -0,0 +1,181 @@
+/**
+ * Publish Queue Implementation
+ *
+ * Copyright (c) 2024 Peter Westlund
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "publish_queue.h"
+#include <string.h>
+
+void publish_queue_init(publish_queue_t *queue) {
+    memset(queue, 0, sizeof(*queue));
+}
+
+void publish_queue_clear(publish_queue_t *queue) {
+    for (int i = 0; i < queue->count; i++) {
+        queue->stats[queue->entries[i].class].dropped++;
+    }
+    queue->used = 0;
+    queue->count = 0;
+}
+
+bool publish_queue_fits(const publish_queue_t *queue, size_t len) {
+    return queue->count < PUBLISH_QUEUE_ENTRIES && PUBLISH_QUEUE_SIZE - queue->used >= len;
+}
+
+/**
+ * Release the payload bytes of an entry, moving later payloads down
+ */
+static void release_payload(publish_queue_t *queue, const publish_entry_t *entry) {
+    size_t end = entry->offset + entry->len;
+    memmove(&queue->buf[entry->offset], &queue->buf[end], queue->used - end);
+    queue->used -= entry->len;
+    for (int i = 0; i < queue->count; i++) {
+        if (queue->entries[i].offset > entry->offset) {
+            queue->entries[i].offset -= entry->len;
+        }
+    }
+}
+
+static void remove_entry(publish_queue_t *queue, int index) {
+    publish_entry_t entry = queue->entries[index];
+    queue->entries[index] = queue->entries[--queue->count];
+    release_payload(queue, &entry);
+}
+
+/**
+ * Find the newest message of the lowest class below the given one
+ *
+ * @return Index, or -1 if there is none
+ */
+static int find_victim(const publish_queue_t *queue, publish_class_t class) {
+    int victim = -1;
+    for (int i = 0; i < queue->count; i++) {
+        const publish_entry_t *entry = &queue->entries[i];
+        if (entry->class <= class) {
+            continue;
+        }
+        if (victim < 0 || entry->class > queue->entries[victim].class ||
+            (entry->class == queue->entries[victim].class &&
+             (int32_t) (entry->sequence - queue->entries[victim].sequence) > 0)) {
+            victim = i;
+        }
+    }
+    return victim;
+}
+
+/**
+ * Check whether pushing out every lower class message would make room
+ */
+static bool can_make_room(const publish_queue_t *queue, publish_class_t class, size_t len) {
+    size_t bytes = PUBLISH_QUEUE_SIZE - queue->used;
+    int slots = PUBLISH_QUEUE_ENTRIES - queue->count;
+    for (int i = 0; i < queue->count; i++) {
+        if (queue->entries[i].class > class) {
+            bytes += queue->entries[i].len;
+            slots++;
+        }
+    }
+    return slots > 0 && bytes >= len;
+}
+
+uint8_t *publish_queue_reserve(publish_queue_t *queue, publish_class_t class, const char *topic,
+                               size_t len, uint8_t qos, bool retain, bool coalesce) {
+    publish_class_stats_t *stats = &queue->stats[class];
+    uint32_t sequence = queue->next_sequence;
+
+    // A newer value for a queued topic replaces the old one and keeps its place in line
+    if (coalesce) {
+        for (int i = 0; i < queue->count; i++) {
+            const publish_entry_t *entry = &queue->entries[i];
+            if (entry->class == class && entry->topic == topic) {
+                sequence = entry->sequence;
+                remove_entry(queue, i);
+                stats->coalesced++;
+                break;
+            }
+        }
+    }
+
+    if (len > PUBLISH_QUEUE_SIZE || !can_make_room(queue, class, len)) {
+        stats->dropped++;
+        return NULL;
+    }
+    while (!publish_queue_fits(queue, len)) {
+        int victim = find_victim(queue, class);
+        queue->stats[queue->entries[victim].class].dropped++;
+        remove_entry(queue, victim);
+    }
+
+    publish_entry_t *entry = &queue->entries[queue->count++];
+    *entry = (publish_entry_t){
+        .topic = topic,
+        .offset = (uint16_t) queue->used,
+        .len = (uint16_t) len,
+        .sequence = sequence,
+        .class = (uint8_t) class,
+        .qos = qos,
+        .retain = retain,
+    };
+    queue->used += len;
+    if (sequence == queue->next_sequence) {
+        queue->next_sequence++;
+    }
+    if (queue->count > queue->high_water) {
+        queue->high_water = queue->count;
+    }
+    stats->queued++;
+    return &queue->buf[entry->offset];
+}
+
+bool publish_queue_push(publish_queue_t *queue, publish_class_t class, const char *topic,
+                        const void *payload, size_t len, uint8_t qos, bool retain, bool coalesce) {
+    uint8_t *buf = publish_queue_reserve(queue, class, topic, len, qos, retain, coalesce);
+    if (buf == NULL) {
+        return false;
+    }
+    memcpy(buf, payload, len);
+    return true;
+}
+
+/**
+ * Index of the highest class, oldest message
+ */
+static int next_index(const publish_queue_t *queue) {
+    int next = -1;
+    for (int i = 0; i < queue->count; i++) {
+        const publish_entry_t *entry = &queue->entries[i];
+        if (next < 0 || entry->class < queue->entries[next].class ||
+            (entry->class == queue->entries[next].class &&
+             (int32_t) (entry->sequence - queue->entries[next].sequence) < 0)) {
+            next = i;
+        }
+    }
+    return next;
+}
+
+const publish_entry_t *publish_queue_peek(const publish_queue_t *queue) {
+    int next = next_index(queue);
+    return next < 0 ? NULL : &queue->entries[next];
+}
+
+void publish_queue_pop(publish_queue_t *queue, bool sent) {
+    int next = next_index(queue);
+    if (next < 0) {
+        return;
+    }
+    if (!sent) {
+        queue->stats[queue->entries[next].class].dropped++;
+    }
+    remove_entry(queue, next);
+}
+
+int publish_queue_class_depth(const publish_queue_t *queue, publish_class_t class) {
+    int depth = 0;
+    for (int i = 0; i < queue->count; i++) {
+        depth += queue->entries[i].class == class;
+    }
+    return depth;
+}
@@ -0,0 +1,153 @@
+/**
+ * Publish Queue Header
+ * Outgoing MQTT messages waiting for room in the lwIP client. Messages are
+ * sent highest class first, oldest first within a class. A newer message for
+ * a topic that is still queued replaces the older one in place, and when the
+ * queue is full a message may push out a queued one of a lower class.
+ *
+ * Copyright (c) 2024 Peter Westlund
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef PUBLISH_QUEUE_H
+#define PUBLISH_QUEUE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Payload storage in bytes; room for a few discovery configs plus states */
+#ifndef PUBLISH_QUEUE_SIZE
+#define PUBLISH_QUEUE_SIZE 3072
+#endif
+
+/* Maximum number of queued messages */
+#ifndef PUBLISH_QUEUE_ENTRIES
+#define PUBLISH_QUEUE_ENTRIES 24
+#endif
+
+/**
+ * Message classes, highest priority first
+ */
+typedef enum {
+    PUBLISH_CLASS_AVAILABILITY = 0,
+    PUBLISH_CLASS_DISCOVERY,
+    PUBLISH_CLASS_STATE,
+    PUBLISH_CLASS_DIAGNOSTIC,
+    PUBLISH_CLASS_COUNT
+} publish_class_t;
+
+/**
+ * One queued message; the payload lives in the queue buffer
+ */
+typedef struct {
+    const char *topic; // Interned topic, compared by pointer
+    uint16_t offset;   // Payload offset in the queue buffer
+    uint16_t len;      // Payload length
+    uint32_t sequence; // Enqueue order
+    uint8_t class;     // publish_class_t
+    uint8_t qos;
+    bool retain;
+} publish_entry_t;
+
+/**
+ * Per-class counters
+ */
+typedef struct {
+    uint32_t queued;    // Messages accepted
+    uint32_t coalesced; // Messages replaced by a newer one for the same topic
+    uint32_t dropped;   // Messages refused or pushed out for lack of room
+} publish_class_stats_t;
+
+/**
+ * Queue state
+ * Payloads are packed in enqueue order; removing one moves the later ones down.
+ */
+typedef struct {
+    uint8_t buf[PUBLISH_QUEUE_SIZE];
+    size_t used;
+    publish_entry_t entries[PUBLISH_QUEUE_ENTRIES];
+    int count;
+    int high_water; // Highest count seen
+    uint32_t next_sequence;
+    publish_class_stats_t stats[PUBLISH_CLASS_COUNT];
+} publish_queue_t;
+
+/**
+ * Empty the queue and clear its counters
+ */
+void publish_queue_init(publish_queue_t *queue);
+
+/**
+ * Drop all queued messages, counting them as dropped
+ */
+void publish_queue_clear(publish_queue_t *queue);
+
+/**
+ * Check whether a message fits without pushing anything out
+ */
+bool publish_queue_fits(const publish_queue_t *queue, size_t len);
+
+/**
+ * Queue a message
+ *
+ * @param queue Queue to add to
+ * @param class Message class
+ * @param topic Interned topic; must outlive the queued message
+ * @param payload Payload, copied into the queue
+ * @param len Payload length
+ * @param qos MQTT QoS
+ * @param retain MQTT retain flag
+ * @param coalesce Replace a queued message of the same class and topic instead of adding one
+ * @return false if the message was dropped for lack of room
+ */
+bool publish_queue_push(publish_queue_t *queue, publish_class_t class, const char *topic,
+                        const void *payload, size_t len, uint8_t qos, bool retain, bool coalesce);
+
+/**
+ * Queue a message whose payload the caller writes in place
+ * Takes the same parameters as publish_queue_push(), without the payload.
+ *
+ * @return Payload buffer of len bytes, valid until the queue is next changed, or NULL if
+ *         the message was dropped for lack of room
+ */
+uint8_t *publish_queue_reserve(publish_queue_t *queue, publish_class_t class, const char *topic,
+                               size_t len, uint8_t qos, bool retain, bool coalesce);
+
+/**
+ * Get the next message to send without removing it
+ *
+ * @return Entry, or NULL if the queue is empty
+ */
+const publish_entry_t *publish_queue_peek(const publish_queue_t *queue);
+
+/**
+ * Get the payload of a queued message
+ */
+static inline const uint8_t *publish_queue_payload(const publish_queue_t *queue,
+                                                   const publish_entry_t *entry) {
+    return &queue->buf[entry->offset];
+}
+
+/**
+ * Remove the message returned by publish_queue_peek()
+ *
+ * @param queue Queue to remove from
+ * @param sent false to count the message as dropped
+ */
+void publish_queue_pop(publish_queue_t *queue, bool sent);
+
+/**
+ * Get the number of queued messages
+ */
+static inline int publish_queue_depth(const publish_queue_t *queue) {
+    return queue->count;
+}
+
+/**
+ * Get the number of queued messages of one class
+ */
+int publish_queue_class_depth(const publish_queue_t *queue, publish_class_t class);
+
+#endif // PUBLISH_QUEUE_H
@@ -0,0 +1,46 @@
+/**
+ * Sample Ring Implementation
+ * Lock-free single-producer/single-consumer ring of timestamped sensor samples
+ *
+ * Copyright (c) 2024 Peter Westlund
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "sample_ring.h"
+#include "hardware/sync.h"
+#include <assert.h>
+
+static_assert((SAMPLE_RING_SIZE & (SAMPLE_RING_SIZE - 1)) == 0,
+              "SAMPLE_RING_SIZE must be a power of two");
+
+bool sample_ring_push(sample_ring_t *ring, const sensor_sample_t *sample) {
+    uint32_t head = ring->head;
+    if (head - ring->tail == SAMPLE_RING_SIZE) {
+        ring->dropped++;
+        return false;
+    }
+
+    ring->slots[head & (SAMPLE_RING_SIZE - 1)] = *sample;
+
+    // Publish the slot contents before the new head becomes visible to the other core
+    __dmb();
+    ring->head = head + 1;
+    return true;
+}
+
+bool sample_ring_pop(sample_ring_t *ring, sensor_sample_t *sample) {
+    uint32_t tail = ring->tail;
+    if (ring->head == tail) {
+        return false;
+    }
+
+    // Read the slot only after observing the head that covers it
+    __dmb();
+    *sample = ring->slots[tail & (SAMPLE_RING_SIZE - 1)];
+
+    // Finish reading the slot before handing it back to the producer
+    __dmb();
+    ring->tail = tail + 1;
+    return true;
+}
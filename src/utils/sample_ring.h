@@ -0,0 +1,64 @@
+/**
+ * Sample Ring Header
+ * Lock-free single-producer/single-consumer ring of timestamped sensor samples,
+ * used to hand readings from the acquisition core to the network core
+ *
+ * Copyright (c) 2024 Peter Westlund
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef SAMPLE_RING_H
+#define SAMPLE_RING_H
+
+#include "pico/stdlib.h"
+
+/* Number of slots, must be a power of two */
+#ifndef SAMPLE_RING_SIZE
+#define SAMPLE_RING_SIZE 32
+#endif
+
+/* Source id of the onboard ADC sensor; DS18B20 probe n uses n + 1 */
+#define SAMPLE_SOURCE_ONBOARD 0
+
+/**
+ * One sensor reading
+ */
+typedef struct {
+    uint64_t timestamp_us; // time_us_64() when the value was taken
+    int32_t centi_c;       // Temperature in hundredths of a degree Celsius
+    uint8_t source;        // SAMPLE_SOURCE_ONBOARD or DS18B20 probe index + 1
+    bool valid;            // false if the sensor could not be read
+} sensor_sample_t;
+
+/**
+ * Ring state
+ * head is only written by the producer and tail only by the consumer; both
+ * are free-running counters, so the ring is full when head - tail == size.
+ */
+typedef struct {
+    sensor_sample_t slots[SAMPLE_RING_SIZE];
+    volatile uint32_t head;
+    volatile uint32_t tail;
+    volatile uint32_t dropped; // Samples lost because the ring was full
+} sample_ring_t;
+
+/**
+ * Append a sample (producer side)
+ *
+ * @param ring Ring to append to
+ * @param sample Sample to copy into the ring
+ * @return false if the ring was full and the sample was dropped
+ */
+bool sample_ring_push(sample_ring_t *ring, const sensor_sample_t *sample);
+
+/**
+ * Take the oldest sample (consumer side)
+ *
+ * @param ring Ring to take from
+ * @param sample Pointer to store the sample
+ * @return false if the ring is empty
+ */
+bool sample_ring_pop(sample_ring_t *ring, sensor_sample_t *sample);
+
+#endif // SAMPLE_RING_H
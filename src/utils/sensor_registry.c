@@ -0,0 +1,96 @@
+/**
+ * Sensor Registry Implementation
+ *
+ * Copyright (c) 2024 Peter Westlund
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "sensor_registry.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+sensor_entity_t *sensor_registry_add(sensor_registry_t *registry, const char *object_id,
+                                     const char *name, const char *device_class,
+                                     const char *unit, sensor_read_fn read, int arg,
+                                     const sensor_publish_policy_t *policy) {
+    if (registry->count >= SENSOR_REGISTRY_MAX) {
+        return NULL;
+    }
+
+    sensor_entity_t *entity = &registry->entities[registry->count++];
+    snprintf(entity->object_id, sizeof(entity->object_id), "%s", object_id);
+    snprintf(entity->name, sizeof(entity->name), "%s", name);
+    entity->device_class = device_class;
+    entity->unit = unit;
+    entity->read = read;
+    entity->arg = arg;
+    entity->decimals = 2;
+    entity->policy = *policy;
+    entity->parent = NULL;
+    entity->key = NULL;
+    entity->last_value = 0;
+    entity->last_published_ms = 0;
+    entity->published = false;
+    entity->config_topic = NULL;
+    entity->state_topic = NULL;
+    entity->value_key = NULL;
+    entity->payload_prefix = NULL;
+    entity->payload_prefix_len = 0;
+    entity->device_class_attr = NULL;
+    return entity;
+}
+
+sensor_entity_t *sensor_registry_add_child(sensor_registry_t *registry,
+                                           const sensor_entity_t *parent, const char *key,
+                                           const char *name_suffix, const char *device_class,
+                                           const char *unit, sensor_read_fn read, int arg) {
+    char object_id[SENSOR_OBJECT_ID_LEN];
+    char name[SENSOR_NAME_LEN];
+    snprintf(object_id, sizeof(object_id), "%s_%s", parent->object_id, key);
+    snprintf(name, sizeof(name), "%s %s", parent->name, name_suffix);
+    sensor_entity_t *entity = sensor_registry_add(registry, object_id, name, device_class, unit,
+                                                  read, arg, &parent->policy);
+    if (entity) {
+        entity->parent = parent;
+        entity->key = key;
+    }
+    return entity;
+}
+
+void sensor_registry_reset_published(sensor_registry_t *registry) {
+    for (int i = 0; i < registry->count; i++) {
+        registry->entities[i].published = false;
+    }
+}
+
+bool sensor_entity_due(const sensor_entity_t *entity, int32_t value, uint32_t now_ms) {
+    const sensor_publish_policy_t *policy = &entity->policy;
+    if (!entity->published) {
+        return true;
+    }
+
+    // Unsigned difference stays correct across the millisecond counter wrap
+    uint32_t silent_ms = now_ms - entity->last_published_ms;
+    if (policy->max_silence_ms && silent_ms >= policy->max_silence_ms) {
+        return true;
+    }
+    if (silent_ms < policy->min_interval_ms) {
+        return false;
+    }
+
+    // The larger of the absolute and relative deadbands applies
+    int64_t change = llabs((int64_t) value - entity->last_value);
+    int64_t deadband = policy->deadband;
+    int64_t relative = llabs((int64_t) entity->last_value) * policy->deadband_permille / 1000;
+    if (relative > deadband) {
+        deadband = relative;
+    }
+    return change > deadband;
+}
+
+void sensor_entity_mark_published(sensor_entity_t *entity, int32_t value, uint32_t now_ms) {
+    entity->last_value = value;
+    entity->last_published_ms = now_ms;
+    entity->published = true;
+}
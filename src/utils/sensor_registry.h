@@ -0,0 +1,143 @@
+/**
+ * Sensor Registry Header
+ * Table of Home Assistant sensor entities driving discovery, state publishing
+ * and change detection, so adding a sensor means adding a table entry
+ *
+ * Copyright (c) 2024 Peter Westlund
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef SENSOR_REGISTRY_H
+#define SENSOR_REGISTRY_H
+
+#include "pico/stdlib.h"
+
+/* Maximum number of entities */
+#ifndef SENSOR_REGISTRY_MAX
+#define SENSOR_REGISTRY_MAX 32
+#endif
+
+/* Buffer sizes for entity strings */
+#define SENSOR_OBJECT_ID_LEN 48
+#define SENSOR_NAME_LEN 48
+
+typedef struct sensor_entity sensor_entity_t;
+
+/**
+ * When an entity is republished
+ * A value is sent when it moves past the deadband and min_interval_ms has passed since
+ * the last publish, or unconditionally once max_silence_ms has passed, so Home Assistant
+ * never expires a stable entity.
+ */
+typedef struct {
+    int32_t deadband;           // Absolute change needed, in hundredths
+    uint16_t deadband_permille; // Relative change needed, in thousandths of the last value
+    uint32_t min_interval_ms;   // Rate limit between publishes, 0 for none
+    uint32_t max_silence_ms;    // Heartbeat: republish after this long, 0 for never
+} sensor_publish_policy_t;
+
+/**
+ * Read the current value of an entity
+ *
+ * @param entity Entity to read, entity->arg selects e.g. the probe
+ * @param value Pointer to store the value, in hundredths of the entity unit unless
+ *              entity->decimals says otherwise
+ * @return false if no valid reading is available
+ */
+typedef bool (*sensor_read_fn)(const sensor_entity_t *entity, int32_t *value);
+
+/**
+ * One Home Assistant sensor entity
+ * The state topic is <base>/<object_id>; values are fixed point, in hundredths unless
+ * decimals is changed after adding the entity, e.g. to 0 for a count.
+ * An entity with a parent, e.g. the minimum of a temperature, has no state
+ * topic of its own: its value goes out in the parent's state payload.
+ */
+struct sensor_entity {
+    char object_id[SENSOR_OBJECT_ID_LEN]; // Home Assistant object id and topic level
+    char name[SENSOR_NAME_LEN];           // Friendly name shown in Home Assistant
+    const char *device_class;             // e.g. "temperature", or NULL for none
+    const char *unit;                     // e.g. "°C"
+    sensor_read_fn read;                  // Source of the value
+    int arg;                              // Passed to read through the entity
+    uint8_t decimals;                     // Published decimals of the value, 2 by default
+    sensor_publish_policy_t policy;       // When to republish
+    const sensor_entity_t *parent;        // Entity whose payload carries this one, or NULL
+    const char *key;                      // Payload key for a child, e.g. "min"
+
+    int32_t last_value;         // Last published value
+    uint32_t last_published_ms; // Time of the last publish
+    bool published;             // last_value and last_published_ms are valid
+
+    // Interned by the publisher once the device id is known, NULL until then
+    const char *config_topic;   // Discovery config topic
+    const char *state_topic;    // State topic
+    const char *value_key;      // Key of the value in the state payload
+    const char *payload_prefix; // Payload up to the value, e.g. {"temperature": or "rssi":
+    size_t payload_prefix_len;
+    const char *device_class_attr; // Discovery device_class member with its comma, or ""
+};
+
+typedef struct {
+    sensor_entity_t entities[SENSOR_REGISTRY_MAX];
+    int count;
+} sensor_registry_t;
+
+/**
+ * Add an entity to the registry
+ *
+ * @param registry Registry to add to
+ * @param object_id Home Assistant object id
+ * @param name Friendly name
+ * @param device_class Home Assistant device class or NULL (string must outlive the registry)
+ * @param unit Unit of measurement (string must outlive the registry)
+ * @param read Read function
+ * @param arg Argument for the read function
+ * @param policy Publish policy, copied into the entity
+ * @return The new entity, or NULL if the registry is full
+ */
+sensor_entity_t *sensor_registry_add(sensor_registry_t *registry, const char *object_id,
+                                     const char *name, const char *device_class,
+                                     const char *unit, sensor_read_fn read, int arg,
+                                     const sensor_publish_policy_t *policy);
+
+/**
+ * Add an entity published with its parent, with object id <parent>_<key>
+ *
+ * @param registry Registry to add to
+ * @param parent Entity whose state payload carries this one
+ * @param key Payload key and object id suffix (string must outlive the registry)
+ * @param name_suffix Appended to the parent's friendly name
+ * @param device_class Home Assistant device class or NULL (string must outlive the registry)
+ * @param unit Unit of measurement (string must outlive the registry)
+ * @param read Read function
+ * @param arg Argument for the read function
+ * @return The new entity, or NULL if the registry is full
+ */
+sensor_entity_t *sensor_registry_add_child(sensor_registry_t *registry,
+                                           const sensor_entity_t *parent, const char *key,
+                                           const char *name_suffix, const char *device_class,
+                                           const char *unit, sensor_read_fn read, int arg);
+
+/**
+ * Forget all published values, so every entity is sent again
+ */
+void sensor_registry_reset_published(sensor_registry_t *registry);
+
+/**
+ * Check whether the publish policy calls for sending a value now
+ *
+ * @param entity Entity the value belongs to
+ * @param value Current value
+ * @param now_ms Current time in milliseconds, may wrap
+ * @return true if the value should be published
+ */
+bool sensor_entity_due(const sensor_entity_t *entity, int32_t value, uint32_t now_ms);
+
+/**
+ * Record a value as published at now_ms
+ */
+void sensor_entity_mark_published(sensor_entity_t *entity, int32_t value, uint32_t now_ms);
+
+#endif // SENSOR_REGISTRY_H
@@ -0,0 +1,93 @@
+/**
+ * Statistics Window Implementation
+ *
+ * Copyright (c) 2024 Peter Westlund
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "stats_window.h"
+
+/**
+ * Integer square root, rounded down
+ */
+static uint64_t isqrt64(uint64_t value) {
+    uint64_t root = 0;
+    uint64_t bit = 1ull << 62;
+    while (bit > value) {
+        bit >>= 2;
+    }
+    while (bit) {
+        if (value >= root + bit) {
+            value -= root + bit;
+            root = (root >> 1) + bit;
+        } else {
+            root >>= 1;
+        }
+        bit >>= 2;
+    }
+    return root;
+}
+
+void stats_window_reset(stats_window_t *window) {
+    *window = (stats_window_t){0};
+}
+
+void stats_window_add(stats_window_t *window, int32_t value) {
+    if (window->count == 0) {
+        window->min = value;
+        window->max = value;
+        window->origin = value;
+    } else if (value < window->min) {
+        window->min = value;
+    } else if (value > window->max) {
+        window->max = value;
+    }
+    window->count++;
+    int64_t diff = (int64_t) value - window->origin;
+    window->sum += diff;
+    window->sum_sq += (uint64_t) (diff * diff);
+}
+
+int32_t stats_window_mean(const stats_window_t *window) {
+    if (window->count == 0) {
+        return 0;
+    }
+    // origin + sum / n as floor + rem / n with 0 <= rem < n, rounded half away from zero
+    int64_t n = window->count;
+    int64_t whole = window->sum / n;
+    int64_t rem = window->sum % n;
+    if (rem < 0) {
+        whole--;
+        rem += n;
+    }
+    whole += window->origin;
+    if (2 * rem > n || (2 * rem == n && whole >= 0)) {
+        whole++;
+    }
+    return (int32_t) whole;
+}
+
+int32_t stats_window_stddev(const stats_window_t *window) {
+    if (window->count < 2) {
+        return 0;
+    }
+    // round(sqrt(v)) is (floor(sqrt(4 v)) + 1) / 2, for the variance v = m2 / (n - 1) where the
+    // sum of squared differences from the mean m2 = sum_sq - sum^2 / n
+    uint64_t n = window->count;
+    uint64_t sum = window->sum < 0 ? -(uint64_t) window->sum : (uint64_t) window->sum;
+    uint64_t variance4;
+    if (window->sum_sq <= UINT64_MAX / 4 / n) {
+        // Exact: n m2 = n sum_sq - sum^2, and sum^2 <= n sum_sq
+        uint64_t n_m2 = n * window->sum_sq - sum * sum;
+        variance4 = 4 * n_m2 / n / (n - 1);
+    } else {
+        // Huge windows: with sum = q n + r, sum^2 / n = q sum + q r + r^2 / n, each term in
+        // range; m2 is then off by under one in a sum beyond 2^62 / n
+        uint64_t q = sum / n;
+        uint64_t r = sum % n;
+        uint64_t m2 = window->sum_sq - q * sum - q * r - r * r / n;
+        variance4 = 4 * (m2 / (n - 1)) + 4 * (m2 % (n - 1)) / (n - 1);
+    }
+    return (int32_t) ((isqrt64(variance4) + 1) / 2);
+}
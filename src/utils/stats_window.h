@@ -0,0 +1,52 @@
+/**
+ * Statistics Window Header
+ * Streaming min, max, mean and variance of the samples taken between two
+ * publishes, in constant memory per sensor. Integer sums of the samples and
+ * their squares are kept relative to the first sample, so they stay small:
+ * no floating point, and results exactly rounded while 4 * count^2 times the
+ * largest squared difference fits in 64 bits, e.g. 200000 samples spanning
+ * 100 degrees.
+ *
+ * Copyright (c) 2024 Peter Westlund
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef STATS_WINDOW_H
+#define STATS_WINDOW_H
+
+#include <stdint.h>
+
+/**
+ * Window state; values are fixed point in hundredths
+ */
+typedef struct {
+    uint32_t count;
+    int32_t min;
+    int32_t max;
+    int32_t origin;  // First sample
+    int64_t sum;     // Sum of differences from origin
+    uint64_t sum_sq; // Sum of squared differences from origin
+} stats_window_t;
+
+/**
+ * Start a new, empty window
+ */
+void stats_window_reset(stats_window_t *window);
+
+/**
+ * Add a sample to the window
+ */
+void stats_window_add(stats_window_t *window, int32_t value);
+
+/**
+ * Get the mean, rounded to hundredths; 0 for an empty window
+ */
+int32_t stats_window_mean(const stats_window_t *window);
+
+/**
+ * Get the sample standard deviation, rounded to hundredths; 0 below two samples
+ */
+int32_t stats_window_stddev(const stats_window_t *window);
+
+#endif // STATS_WINDOW_H
@@ -0,0 +1,54 @@
+/**
+ * Topic Arena Implementation
+ *
+ * Copyright (c) 2024 Peter Westlund
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "topic_arena.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+void topic_arena_reset(topic_arena_t *arena) {
+    arena->used = 0;
+}
+
+/**
+ * Find a string already in the arena
+ */
+static const char *topic_arena_find(const topic_arena_t *arena, const char *str, size_t len) {
+    size_t offset = 0;
+    while (offset < arena->used) {
+        const char *candidate = &arena->buf[offset];
+        size_t candidate_len = strlen(candidate);
+        if (candidate_len == len && memcmp(candidate, str, len) == 0) {
+            return candidate;
+        }
+        offset += candidate_len + 1;
+    }
+    return NULL;
+}
+
+const char *topic_arena_printf(topic_arena_t *arena, const char *format, ...) {
+    // Format straight into the free space, then keep it only if it is new
+    char *dest = &arena->buf[arena->used];
+    size_t space = sizeof(arena->buf) - arena->used;
+
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(dest, space, format, args);
+    va_end(args);
+
+    if (len < 0 || (size_t) len >= space) {
+        return NULL;
+    }
+
+    const char *existing = topic_arena_find(arena, dest, (size_t) len);
+    if (existing) {
+        return existing;
+    }
+    arena->used += (size_t) len + 1;
+    return dest;
+}
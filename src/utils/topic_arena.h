@@ -0,0 +1,45 @@
+/**
+ * Topic Arena Header
+ * Compact store of interned MQTT topic and payload-prefix strings, built once
+ * at boot so the publish path only passes pointers around
+ *
+ * Copyright (c) 2024 Peter Westlund
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef TOPIC_ARENA_H
+#define TOPIC_ARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Arena size in bytes; room for discovery, state and control topics of every entity */
+#ifndef TOPIC_ARENA_SIZE
+#define TOPIC_ARENA_SIZE 6144
+#endif
+
+/**
+ * Strings are stored back to back, each with its terminator, and never freed
+ */
+typedef struct {
+    char buf[TOPIC_ARENA_SIZE];
+    size_t used;
+} topic_arena_t;
+
+/**
+ * Empty the arena, invalidating all strings handed out so far
+ */
+void topic_arena_reset(topic_arena_t *arena);
+
+/**
+ * Format a string into the arena, returning the existing copy if it is already interned
+ *
+ * @param arena Arena to store the string in
+ * @param format printf style format
+ * @return Interned string, or NULL if the arena is full
+ */
+const char *topic_arena_printf(topic_arena_t *arena, const char *format, ...)
+    __attribute__((format(printf, 2, 3)));
+
+#endif // TOPIC_ARENA_H
@@ -0,0 +1,43 @@
+/**
+ * Wall Clock Implementation
+ *
+ * Copyright (c) 2024 Peter Westlund
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "wall_clock.h"
+
+/**
+ * Correction for the drift over an interval, in microseconds
+ */
+static int64_t drift_correction_us(const wall_clock_t *clock, int64_t elapsed_us) {
+    // Milliseconds keep the product in range over years at the largest drift
+    return elapsed_us / 1000 * clock->drift_ppb / 1000000;
+}
+
+void wall_clock_sync(wall_clock_t *clock, uint64_t local_us, uint64_t unix_us) {
+    if (clock->syncs > 0) {
+        int64_t elapsed_us = (int64_t) (local_us - clock->local_us);
+        if (elapsed_us >= (int64_t) WALL_CLOCK_MIN_DRIFT_INTERVAL_US) {
+            // What is left over after the current estimate is a further rate error
+            int64_t error_us = (int64_t) (unix_us - wall_clock_unix_us(clock, local_us));
+            int64_t drift_ppb = clock->drift_ppb + error_us * 1000 / (elapsed_us / 1000000);
+            if (drift_ppb > WALL_CLOCK_MAX_DRIFT_PPB || drift_ppb < -WALL_CLOCK_MAX_DRIFT_PPB) {
+                drift_ppb = 0; // The time was set, not drifted
+            }
+            clock->drift_ppb = (int32_t) drift_ppb;
+        }
+    }
+    clock->local_us = local_us;
+    clock->unix_us = unix_us;
+    clock->syncs++;
+}
+
+uint64_t wall_clock_unix_us(const wall_clock_t *clock, uint64_t local_us) {
+    if (clock->syncs == 0) {
+        return 0;
+    }
+    int64_t elapsed_us = (int64_t) (local_us - clock->local_us);
+    return clock->unix_us + (uint64_t) (elapsed_us + drift_correction_us(clock, elapsed_us));
+}
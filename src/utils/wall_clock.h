@@ -0,0 +1,66 @@
+/**
+ * Wall Clock Header
+ * Maps the monotonic microsecond timer to Unix time from occasional time
+ * syncs (e.g. SNTP). Each sync anchors the clock; after the second sync the
+ * rate error of the local crystal is estimated as well, so time stays close
+ * between syncs an hour or more apart. Readings keep their local timestamp
+ * and are converted when published, so a sync never moves a reading taken
+ * before it by more than the correction.
+ *
+ * Copyright (c) 2024 Peter Westlund
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef WALL_CLOCK_H
+#define WALL_CLOCK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Shortest interval between syncs that updates the drift estimate */
+#ifndef WALL_CLOCK_MIN_DRIFT_INTERVAL_US
+#define WALL_CLOCK_MIN_DRIFT_INTERVAL_US (60ull * 1000 * 1000)
+#endif
+
+/* Largest believable drift in parts per billion; anything beyond is a time step */
+#ifndef WALL_CLOCK_MAX_DRIFT_PPB
+#define WALL_CLOCK_MAX_DRIFT_PPB 500000
+#endif
+
+/**
+ * Clock state; zero initialized means not synced
+ */
+typedef struct {
+    uint64_t local_us; // Local time of the last sync
+    uint64_t unix_us;  // Unix time at the last sync
+    int32_t drift_ppb; // Local clock rate error, positive when it runs slow
+    uint32_t syncs;    // Number of syncs taken
+} wall_clock_t;
+
+/**
+ * Anchor the clock to a time sync
+ *
+ * @param clock Clock to update
+ * @param local_us Local time when the sync was taken, e.g. time_us_64()
+ * @param unix_us Unix time in microseconds at that moment
+ */
+void wall_clock_sync(wall_clock_t *clock, uint64_t local_us, uint64_t unix_us);
+
+/**
+ * Check whether the clock has been synced
+ */
+static inline bool wall_clock_valid(const wall_clock_t *clock) {
+    return clock->syncs > 0;
+}
+
+/**
+ * Convert a local time to Unix time
+ *
+ * @param clock Clock to use
+ * @param local_us Local time, before or after the last sync
+ * @return Unix time in microseconds, 0 if the clock has not been synced
+ */
+uint64_t wall_clock_unix_us(const wall_clock_t *clock, uint64_t local_us);
+
+#endif // WALL_CLOCK_H